@@ -22,6 +22,14 @@ uint8_t isCustomCommand(uint8_t data) {
 	return 0x00;
 }*/
 
+/**
+ * Verifies whether the custom command is urgent. Urgent commands (alarms) are transmitted in
+ * the high priority class, ahead of the other queued commands and between two of their frames.
+ * They overtake the numbered commands so they are not numbered nor acknowledged themselves.
+ * Both devices have to agree on it, e.g. ((code) >= 0xF0)
+ */
+#define COM_IS_URGENT(code) 0
+
 /**
  * ---------------------------
  * REQUIRED COMMANDS SECTION
@@ -34,6 +42,23 @@ uint8_t isCustomCommand(uint8_t data) {
 #define COM_RESUME 0x05
 #define COM_RESYNC_COMMAND_NUMBER 0x06
 
+/**
+ * Data length of a command on the line, the same for every queue size of either device: a single
+ * byte below 128, otherwise the low 7 bits with COM_LENGTH_EXTENDED set followed by a byte with
+ * the bits above them
+ */
+#define COM_LENGTH_EXTENDED 0x80
+
+/**
+ * Verifies whether the code is one of the required commands controlling the communication
+ */
+#define COM_IS_CONTROL(code) (((code) >= COM_ACK) && ((code) <= COM_RESYNC_COMMAND_NUMBER))
+
+/**
+ * Bytes of a command that collide with the framing are sent as COM_ESCAPE_CHAR followed by the byte
+ */
+#define COM_NEEDS_ESCAPE(data) (((data) == COM_END) || ((data) == COM_ESCAPE_CHAR))
+
 /**
  * Verifies whether the byte is a standard command code or not
  */
@@ -0,0 +1,29 @@
+/*
+ * BenchConfig.hpp
+ *
+ * Settings of a Uart<> port matching the switches of config.h the C layer is built with, so
+ * tests/bench_cpp.cpp and tests/size_cpp.cpp compare both front ends on the same settings and
+ * tests/test_interop.cpp connects them.
+ * COM_WAIT/COM_RESUME of FLOW_COMMANDS has no counterpart in Uart<>, its port runs without flow
+ * control then.
+ */
+
+#ifndef BENCHCONFIG_HPP_
+#define BENCHCONFIG_HPP_
+
+#include "../uart/Uart.hpp"
+
+struct BenchConfig : UartConfig {
+	static constexpr uint16_t rxQueueSize = RX_QUEUE_SIZE;
+	static constexpr uint16_t txQueueSize = TX_QUEUE_SIZE;
+#if COMMAND_RESPONSE_MODEL
+	static constexpr UartFraming framing =
+			(FRAMING == FRAMING_COBS) ? UartFraming::Cobs : UartFraming::Escape;
+	static constexpr bool numbering = USE_COMMAND_NUMBERING;
+#endif
+	static constexpr uint8_t commandQueueSize = COMMAND_QUEUE_SIZE;
+	static constexpr UartFlow flow =
+			(FLOW_CONTROL == FLOW_XON_XOFF) ? UartFlow::XonXoff : UartFlow::None;
+};
+
+#endif /* BENCHCONFIG_HPP_ */
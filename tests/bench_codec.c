@@ -0,0 +1,166 @@
+/*
+ * bench_codec.c
+ *
+ * Encodes commands with uniformly random binary data through transmitCommand() and parses the
+ * frames back with parseCommandByte() on the host (UART_HARDWARE_SIM, nothing is transmitted).
+ * Prints the share of the line left to the data by the framing of the build, against the 75% of
+ * base64, and the host time per data byte of encoding and parsing. Every frame parsed is compared
+ * with the data sent. With USE_CRC it times the CRC of CRC_MODE alone as well. tests/run.sh
+ * builds it for both framings and both CRC variants.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../uart/uart.h"
+#include "../utils/crc16.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (!COMMAND_RESPONSE_MODEL) || USE_SLIDING_WINDOW)
+#error 'bench_codec needs UART_HARDWARE_SIM and the command response model without the window'
+#endif
+
+/**
+ * Data bytes of a command and the distinct commands encoded
+ */
+#define BENCH_DATA 64
+#define BENCH_PAYLOADS 64
+
+/**
+ * Commands encoded and parsed per measurement
+ */
+#define BENCH_COMMANDS 200000UL
+
+/**
+ * Room for an encoded command, the framing at most doubles it
+ */
+#define BENCH_FRAME (2 * (BENCH_DATA + 16))
+
+#if ((TX_QUEUE_SIZE < BENCH_FRAME) || (RX_QUEUE_SIZE < 2 * BENCH_DATA))
+#error 'bench_codec needs larger queues, build it with QUEUE_SIZE=256'
+#endif
+
+static uint8_t payloads[BENCH_PAYLOADS][BENCH_DATA];
+static uint8_t frames[BENCH_PAYLOADS][BENCH_FRAME];
+static QueueSize frameLengths[BENCH_PAYLOADS];
+
+static void handler(struct UART* uart, struct Command* command) {
+}
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+/**
+ * Encodes the command with the data into frame, returns its length on the line
+ */
+static QueueSize encode(uint8_t* data, uint8_t* frame) {
+	struct UART* uart = UART_PORT(0);
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = 0x40;
+	setCommandData(&command, data, BENCH_DATA);
+	transmitCommand(uart, &command);
+	return dequeueBlock(&uart->txQueue, frame, BENCH_FRAME);
+}
+
+/**
+ * Parses the frame, returns whether it gave back the data
+ */
+static uint8_t parse(uint8_t* frame, QueueSize length, uint8_t* data) {
+	struct UART* uart = UART_PORT(0);
+	uint8_t result = COMMAND_INCOMPLETE;
+	for (QueueSize i = 0; i < length; i++) {
+		result = parseCommandByte(uart, frame[i]);
+	}
+	//the data is not committed, the next frame takes its place
+	struct Command* command = &uart->commandParser.command;
+	return (result == COMMAND_COMPLETE) && (command->dataSize == BENCH_DATA)
+			&& (memcmp(command->data, data, BENCH_DATA) == 0);
+}
+
+#if USE_CRC
+
+/**
+ * Bytes of the CRC measurement
+ */
+#define BENCH_CRC_BYTES 4096
+#define BENCH_CRC_ROUNDS 5000
+
+/**
+ * Checks the CRC and prints the host time per byte of crc16Block()
+ * Returns 0 if the check value is wrong
+ */
+static uint8_t benchCrc() {
+	static uint8_t check[] = "123456789";
+	if (crc16Block(CRC16_INIT, check, 9) != 0x29B1) {
+		printf("CRC check value 0x%04X instead of 0x29B1\n", crc16Block(CRC16_INIT, check, 9));
+		return 0;
+	}
+	static uint8_t data[BENCH_CRC_BYTES];
+	for (uint16_t i = 0; i < BENCH_CRC_BYTES; i++) {
+		data[i] = (uint8_t) rand();
+	}
+	uint16_t crc = CRC16_INIT;
+	double start = now();
+	for (uint16_t i = 0; i < BENCH_CRC_ROUNDS; i++) {
+		crc = crc16Block(crc, data, BENCH_CRC_BYTES);
+	}
+	double elapsed = now() - start;
+	printf("    CRC %s: %.2f ns/byte (0x%04X)\n", (CRC_MODE == CRC_TABLE) ? "table" : "bitwise",
+			elapsed / BENCH_CRC_ROUNDS / BENCH_CRC_BYTES, crc);
+	return 1;
+}
+
+#endif
+
+int main() {
+	simReset();
+	UARTsetup(UART_PORT(0), handler);
+	//the frames stay in the transmit queue, the data register empty interrupt must not take them
+	cli();
+	srand(1);
+	uint32_t line = 0;
+	for (uint8_t i = 0; i < BENCH_PAYLOADS; i++) {
+		for (uint8_t j = 0; j < BENCH_DATA; j++) {
+			payloads[i][j] = (uint8_t) rand();
+		}
+		frameLengths[i] = encode(payloads[i], frames[i]);
+		line += frameLengths[i];
+		if (!parse(frames[i], frameLengths[i], payloads[i])) {
+			printf("command %u did not parse back\n", i);
+			return 1;
+		}
+	}
+
+	uint8_t scratch[BENCH_FRAME];
+	double start = now();
+	for (uint32_t i = 0; i < BENCH_COMMANDS; i++) {
+		encode(payloads[i % BENCH_PAYLOADS], scratch);
+	}
+	double encoding = (now() - start) / BENCH_COMMANDS / BENCH_DATA;
+	uint32_t parsed = 0;
+	start = now();
+	for (uint32_t i = 0; i < BENCH_COMMANDS; i++) {
+		uint8_t k = i % BENCH_PAYLOADS;
+		parsed += parse(frames[k], frameLengths[k], payloads[k]);
+	}
+	double parsing = (now() - start) / BENCH_COMMANDS / BENCH_DATA;
+	if (parsed != BENCH_COMMANDS) {
+		printf("%lu commands did not parse back\n", (unsigned long) (BENCH_COMMANDS - parsed));
+		return 1;
+	}
+	printf("F%d N%d CRC%d, %u random data bytes: data %5.1f%% of the line (base64 75.0%%), "
+			"%.1f line bytes per command, encode %.2f ns/byte, parse %.2f ns/byte\n", FRAMING,
+			USE_COMMAND_NUMBERING, USE_CRC, BENCH_DATA,
+			100.0 * BENCH_DATA * BENCH_PAYLOADS / line, (double) line / BENCH_PAYLOADS, encoding,
+			parsing);
+#if USE_CRC
+	if (!benchCrc()) {
+		return 1;
+	}
+#endif
+	return 0;
+}
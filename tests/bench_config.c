@@ -0,0 +1,278 @@
+/*
+ * bench_config.c
+ *
+ * Measures the configuration it is built with on the simulated USART (UART_HARDWARE_SIM):
+ * the rate port 0 transmits at against the line rate, the idle time of the line between two
+ * bytes, the host time spent in the interrupts, message handlers included, and, in the command
+ * response model, the round trip of a command echoed by port 1. tests/run.sh builds it for the modes of config.h.
+ * Needs UART_PORTS=2.
+ */
+
+#include <stdio.h>
+#include "../uart/uart.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2))
+#error 'bench_config needs UART_HARDWARE_SIM and UART_PORTS=2'
+#endif
+
+/**
+ * Bytes offered to port 0 and the bytes of a bulk transmission
+ */
+#define BENCH_BYTES 2000
+#define BENCH_CHUNK 16
+
+/**
+ * Data of a command, the frame has to fit into the default queues of 16 bytes
+ */
+#define BENCH_COMMAND_DATA 8
+
+/**
+ * Code of the commands
+ */
+#define BENCH_CODE 0x40
+
+/**
+ * Commands echoed for the round trip
+ */
+#define BENCH_ROUND_TRIPS 50
+
+/**
+ * Cycles the main loop takes between two attempts to transmit
+ */
+#define BENCH_LOOP_CYCLES 50
+
+static uint8_t chunk[BENCH_CHUNK] = { 0x10, 0x20, 0x30, 0x40, 0x50, 0x60, 0x70, 0x80, 0x90, 0xA0,
+		0xB0, 0xC0, 0xD0, 0xE0, 0xF0, 0xFF };
+
+#if COMMAND_RESPONSE_MODEL
+
+/**
+ * The bytes of port 0 reach the line of port 1 and the other way round
+ */
+static void sinkPort0(uint8_t data) {
+	simFeedLine(HDW_PORT(1), &data, 1);
+}
+
+static void sinkPort1(uint8_t data) {
+	simFeedLine(HDW_PORT(0), &data, 1);
+}
+
+/**
+ * Port 1 echoes the commands of port 0, otherwise it only takes them
+ */
+static uint8_t echoing;
+
+/**
+ * Cycle at which port 0 got the echo, 0 while it is outstanding
+ */
+static uint64_t echoed;
+
+static void handlerPort0(struct UART* uart, struct Command* command) {
+	if (command->commandCode == BENCH_CODE) {
+		echoed = simMCU.cycles;
+	}
+}
+
+/**
+ * Port 1 transmits every command back, the acknowledgements of flow control reach the handlers
+ * as well
+ */
+static void handlerPort1(struct UART* uart, struct Command* command) {
+	if ((!echoing) || (command->commandCode != BENCH_CODE)) {
+		return;
+	}
+	struct Command echo;
+	initCommand(&echo);
+	echo.commandCode = command->commandCode;
+	setCommandData(&echo, command->data, command->dataSize);
+	transmitCommand(uart, &echo);
+}
+
+/**
+ * Port 1 is the partner of port 0, it acknowledges and stops port 0 as its commands arrive
+ */
+static void setup() {
+	simSetTransmitSink(HDW_PORT(0), sinkPort0);
+	simSetTransmitSink(HDW_PORT(1), sinkPort1);
+	UARTsetup(UART_PORT(0), handlerPort0);
+	UARTsetup(UART_PORT(1), handlerPort1);
+}
+
+/**
+ * Lets the main loop of both ports run
+ */
+static void mainLoop() {
+#if DEFERRED_DISPATCH
+	UARTprocess(UART_PORT(0));
+	UARTprocess(UART_PORT(1));
+#endif
+#if USE_SLIDING_WINDOW
+	UARTflushWindow(UART_PORT(0));
+	UARTflushWindow(UART_PORT(1));
+#endif
+}
+
+/**
+ * Offers a command to port 0, returns the bytes of data it took
+ */
+static uint16_t offer() {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = BENCH_CODE;
+	setCommandData(&command, chunk, BENCH_COMMAND_DATA);
+	return transmitCommand(UART_PORT(0), &command) ? BENCH_COMMAND_DATA : 0;
+}
+
+#else
+
+static void sinkNowhere(uint8_t data) {
+}
+
+#if (INTERRUPT_DRIVEN && (!USE_QUEUE))
+static void rxcHandler(struct UART* uart, uint8_t data) {
+}
+#elif INTERRUPT_DRIVEN
+static void rxcHandler(struct UART* uart) {
+}
+#endif
+
+#if INTERRUPT_DRIVEN
+static void txcHandler(struct UART* uart) {
+}
+#endif
+
+/**
+ * Port 0 transmits into the void
+ */
+static void setup() {
+	simSetTransmitSink(HDW_PORT(0), sinkNowhere);
+#if INTERRUPT_DRIVEN
+	UARTsetup(UART_PORT(0), rxcHandler, txcHandler);
+#else
+	UARTsetup(UART_PORT(0));
+#endif
+}
+
+/**
+ * A polled queue is only drained by the main loop
+ */
+static void mainLoop() {
+#if (USE_QUEUE && (!INTERRUPT_DRIVEN))
+	UARTbeginTransmit(UART_PORT(0));
+#endif
+}
+
+/**
+ * Offers data to port 0, in blocks when there is a queue to take them
+ */
+static uint16_t offer() {
+#if (USE_QUEUE && INTERRUPT_DRIVEN)
+	return UARTbulkTransmit(UART_PORT(0), chunk, 0, BENCH_CHUNK);
+#else
+	static uint8_t next;
+	return UARTtransmit(UART_PORT(0), chunk[next++ % BENCH_CHUNK]);
+#endif
+}
+
+#endif
+
+/**
+ * Prints the average and worst host time of the USART vectors of the port, the worst case also
+ * catches the host scheduling the benchmark out
+ */
+static void printVectors(const char* name, struct SimStats* stats) {
+	static const uint8_t vectors[] = { SIM_VECTOR_RXC, SIM_VECTOR_UDRE, SIM_VECTOR_TXC };
+	printf("    %s ISR ns average/worst", name);
+	for (uint8_t i = 0; i < sizeof(vectors); i++) {
+		uint8_t vector = vectors[i];
+		uint32_t calls = stats->vectorCalls[vector];
+		printf(" %s %lu/%lu", (i == 0) ? "rxc" : (i == 1) ? "udre" : "txc",
+				(unsigned long) (calls ? stats->vectorNanos[vector] / calls : 0),
+				(unsigned long) stats->vectorMaxNanos[vector]);
+	}
+	printf("\n");
+}
+
+/**
+ * Whether port 0 still has something to transmit
+ */
+static uint8_t transmitting() {
+#if USE_QUEUE
+	if (queueCount(&UART_PORT(0)->txQueue) != 0) {
+		return 1;
+	}
+#endif
+	return simUSARTs[0].shifting;
+}
+
+int main() {
+	simReset();
+	setup();
+	simResetStats();
+
+	//throughput: the main loop keeps offering data to port 0
+	uint32_t offered = 0;
+	while (offered < BENCH_BYTES) {
+		offered += offer();
+		if (simMCU.cycles > 100UL * F_CPU) {
+			printf("port 0 took only %lu bytes\n", (unsigned long) offered);
+			return 1;
+		}
+		mainLoop();
+		simAdvance(BENCH_LOOP_CYCLES);
+	}
+	while (transmitting()) {
+		mainLoop();
+		simAdvance(BENCH_LOOP_CYCLES);
+	}
+	//the partner handles the last commands
+	for (uint16_t i = 0; i < 1000; i++) {
+		mainLoop();
+		simAdvance(BENCH_LOOP_CYCLES);
+	}
+	struct SimStats* stats = &simStats[0];
+	uint32_t frame = simFrameCycles(HDW_PORT(0));
+	double seconds = (double) (stats->lastTransmit - stats->firstTransmit + frame) / F_CPU;
+	double line = (double) F_CPU / frame;
+	printf("Q%d I%d C%d N%d F%d CRC%d W%d D%d %6lu baud queue %5u: "
+			"%7.0f B/s of %7.0f B/s (%5.1f%%), payload %5.1f%%, idle %lu cycles (max gap %lu)\n",
+			USE_QUEUE, INTERRUPT_DRIVEN, COMMAND_RESPONSE_MODEL, USE_COMMAND_NUMBERING, FRAMING,
+			USE_CRC, USE_SLIDING_WINDOW, DEFERRED_DISPATCH, (unsigned long) BAUD_RATE,
+			(unsigned) TX_QUEUE_SIZE, stats->transmitted / seconds, line,
+			100.0 * stats->transmitted / seconds / line, 100.0 * offered / stats->transmitted,
+			(unsigned long) stats->idleCycles, (unsigned long) stats->maxIdleGap);
+	printVectors("transmitting port", stats);
+
+#if COMMAND_RESPONSE_MODEL
+	//round trip: port 1 echoes a command of port 0, one at a time
+	echoing = 1;
+	simResetStats();
+	uint64_t total = 0;
+	uint64_t worst = 0;
+	for (uint16_t i = 0; i < BENCH_ROUND_TRIPS; i++) {
+		echoed = 0;
+		uint64_t start = simMCU.cycles;
+		while (!offer()) {
+			mainLoop();
+			simAdvance(BENCH_LOOP_CYCLES);
+		}
+		while (!echoed) {
+			mainLoop();
+			simAdvance(BENCH_LOOP_CYCLES);
+			if (simMCU.cycles - start > F_CPU) {
+				printf("no echo of command %u\n", i);
+				return 1;
+			}
+		}
+		uint64_t cycles = echoed - start;
+		total += cycles;
+		if (cycles > worst) {
+			worst = cycles;
+		}
+	}
+	printf("    round trip of %u data bytes: average %.0f us, worst %.0f us\n", BENCH_COMMAND_DATA,
+			1e6 * total / BENCH_ROUND_TRIPS / F_CPU, 1e6 * worst / F_CPU);
+	printVectors("echoing port", &simStats[1]);
+#endif
+	return 0;
+}
@@ -0,0 +1,207 @@
+/*
+ * bench_cpp.cpp
+ *
+ * Feeds the same stream to port 0 run by the C layer and to port 1 run by a Uart<> with the same
+ * settings (UART_HARDWARE_SIM, tests/BenchConfig.hpp): random printable bytes for a raw port,
+ * commands of BENCH_DATA random data bytes encoded by the C layer otherwise. The bytes are put
+ * straight into the receive buffer of the simulated USART and the receive vector of the port runs
+ * right away, so only the front end is timed. Prints the host time of the receive interrupt and of
+ * the main loop per byte of both front ends, of the fastest of BENCH_ROUNDS passes over the
+ * stream, and checks that both took everything. tests/run.sh
+ * builds it for the configurations it compares the sizes of.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "BenchConfig.hpp"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2) || (RX_QUEUE_SIZE < 128))
+#error 'bench_cpp needs UART_HARDWARE_SIM, UART_PORTS=2 and QUEUE_SIZE=128'
+#endif
+
+/**
+ * Data bytes of a command and the commands of the stream, a whole round of command numbers
+ */
+#define BENCH_DATA 16
+#define BENCH_COMMANDS 256
+
+/**
+ * Bytes of the stream of a raw port
+ */
+#define BENCH_RAW_BYTES 4096
+
+/**
+ * Bytes received before the main loop runs, and times the stream is fed
+ */
+#define BENCH_CHUNK 32
+#define BENCH_ROUNDS 40
+
+static uint8_t stream[BENCH_COMMANDS * 2 * (BENCH_DATA + 8)];
+static uint32_t streamLength;
+
+static Uart<UartUSART<1>, BenchConfig> cppPort;
+
+/**
+ * Bytes or commands taken by each front end
+ */
+static uint32_t cTaken;
+static uint32_t cppTaken;
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+static void discard(uint8_t data) {
+}
+
+/**
+ * Puts the byte into the receive buffer of the USART, as the end of its frame on the line
+ */
+static void receiveByte(struct SimUSART* usart, uint8_t data) {
+	usart->receiveBuffer = data;
+	usart->ucsra |= 1 << RXC;
+}
+
+#if COMMAND_RESPONSE_MODEL
+
+static void record(uint8_t data) {
+	stream[streamLength++] = data;
+}
+
+static void handler(struct UART* uart, struct Command* command) {
+	if ((command->commandCode == 0x40) && (command->dataSize == BENCH_DATA)) {
+		cTaken++;
+	}
+}
+
+/**
+ * Records the frames of the commands port 0 transmits
+ */
+static void createStream() {
+	simSetTransmitSink(HDW_PORT(0), record);
+	for (uint16_t i = 0; i < BENCH_COMMANDS; i++) {
+		uint8_t data[BENCH_DATA];
+		for (uint8_t j = 0; j < BENCH_DATA; j++) {
+			data[j] = (uint8_t) rand();
+		}
+		struct Command command;
+		initCommand(&command);
+		command.commandCode = 0x40;
+		setCommandData(&command, data, BENCH_DATA);
+		while (!transmitCommand(UART_PORT(0), &command)) {
+			simAdvance(simFrameCycles(HDW_PORT(0)));
+		}
+	}
+	while (queueCount(&UART_PORT(0)->txQueue) || simUSARTs[0].shifting) {
+		simAdvance(simFrameCycles(HDW_PORT(0)));
+	}
+	simAdvance(simFrameCycles(HDW_PORT(0)));
+	simSetTransmitSink(HDW_PORT(0), discard);
+}
+
+#else
+
+static void queueFull(struct UART* uart) {
+}
+
+static void transmitted(struct UART* uart) {
+}
+
+static void createStream() {
+	for (streamLength = 0; streamLength < BENCH_RAW_BYTES; streamLength++) {
+		stream[streamLength] = 0x20 + rand() % 0x5F;
+	}
+}
+
+#endif
+
+int main() {
+	simReset();
+	simSetTransmitSink(HDW_PORT(1), discard);
+#if COMMAND_RESPONSE_MODEL
+	UARTsetup(UART_PORT(0), handler);
+#else
+	UARTsetup(UART_PORT(0), queueFull, transmitted);
+#endif
+	cppPort.setup();
+	srand(1);
+	createStream();
+
+	//the fastest round of each, the others were disturbed by the host
+	double best[4] = { 1e18, 1e18, 1e18, 1e18 };
+	for (uint8_t round = 0; round < BENCH_ROUNDS; round++) {
+		double cInterrupt = 0;
+		double cppInterrupt = 0;
+		double cLoop = 0;
+		double cppLoop = 0;
+		for (uint32_t i = 0; i < streamLength; i += BENCH_CHUNK) {
+			uint16_t length = (streamLength - i < BENCH_CHUNK) ? streamLength - i : BENCH_CHUNK;
+			//the receive vectors run as the hardware would, with the interrupts disabled
+			cli();
+			double start = now();
+			for (uint16_t j = 0; j < length; j++) {
+				receiveByte(&simUSARTs[0], stream[i + j]);
+				hdwInterrupt(UART_PORT(0), HOST_VECTOR_RXC);
+			}
+			double middle = now();
+			for (uint16_t j = 0; j < length; j++) {
+				receiveByte(&simUSARTs[1], stream[i + j]);
+				cppPort.receiveInterrupt();
+			}
+			double end = now();
+			sei();
+			cInterrupt += middle - start;
+			cppInterrupt += end - middle;
+
+			start = now();
+#if COMMAND_RESPONSE_MODEL
+			UARTprocess(UART_PORT(0));
+#else
+			while (queueCount(&UART_PORT(0)->rxQueue)) {
+				UARTreceive(UART_PORT(0));
+				cTaken++;
+			}
+#endif
+			middle = now();
+#if COMMAND_RESPONSE_MODEL
+			cppPort.process([](const UartCommand& command) {
+				if ((command.code == 0x40) && (command.size == BENCH_DATA)) {
+					cppTaken++;
+				}
+			});
+#else
+			uint8_t data;
+			while (cppPort.receive(data)) {
+				cppTaken++;
+			}
+#endif
+			cLoop += middle - start;
+			cppLoop += now() - middle;
+		}
+		double times[4] = { cInterrupt, cppInterrupt, cLoop, cppLoop };
+		for (uint8_t i = 0; i < 4; i++) {
+			if (times[i] < best[i]) {
+				best[i] = times[i];
+			}
+		}
+	}
+
+#if COMMAND_RESPONSE_MODEL
+	uint32_t expected = BENCH_COMMANDS * BENCH_ROUNDS;
+#else
+	uint32_t expected = streamLength * BENCH_ROUNDS;
+#endif
+	printf("C%d F%d N%d X%d, %lu bytes: receive interrupt C %.1f ns, Uart<> %.1f ns, main loop C %.1f ns, "
+			"Uart<> %.1f ns per byte\n", COMMAND_RESPONSE_MODEL, FRAMING, USE_COMMAND_NUMBERING,
+			FLOW_CONTROL == FLOW_XON_XOFF, (unsigned long) streamLength, best[0] / streamLength,
+			best[1] / streamLength, best[2] / streamLength, best[3] / streamLength);
+	if ((cTaken != expected) || (cppTaken != expected)) {
+		printf("C took %lu, Uart<> %lu of %lu\n", (unsigned long) cTaken, (unsigned long) cppTaken,
+				(unsigned long) expected);
+		return 1;
+	}
+	return 0;
+}
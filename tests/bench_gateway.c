@@ -0,0 +1,305 @@
+/*
+ * bench_gateway.c
+ *
+ * Runs the gateway (UART_HARDWARE_POSIX, USE_GATEWAY) on BENCH_PORTS pseudo terminals shared
+ * among BENCH_WORKERS workers, an application thread per worker echoing every command back.
+ * BENCH_PEERS forked processes drive the other side of the lines with the library itself, each
+ * one a share of the ports: they transmit numbered, time stamped commands as fast as the lines
+ * take them and check that every echo comes back in order. Prints the aggregate frames per second
+ * the application received and the p50/p99 of the time from the peer transmitting a command to
+ * the application receiving it, and of the round trip back to the peer. tests/run.sh builds it
+ * for several port and worker counts. On a single core the figures show the cost of the threads,
+ * not their scaling.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include "../uart/uart_gateway.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_POSIX) || (!USE_GATEWAY) || (!USE_SLIDING_WINDOW) \
+		|| (!USE_RETRANSMIT_TIMER))
+#error 'bench_gateway needs UART_HARDWARE_POSIX, USE_GATEWAY and the window with the retransmit timer'
+#endif
+
+#if (!defined(BENCH_PORTS))
+#define BENCH_PORTS 8
+#endif
+#if (!defined(BENCH_WORKERS))
+#define BENCH_WORKERS 1
+#endif
+
+/**
+ * Processes driving the other side of the lines
+ */
+#define BENCH_PEERS 4
+
+/**
+ * Seconds the peers transmit, and wait at most for the last echoes afterwards
+ */
+#define BENCH_SECONDS 2
+#define BENCH_DRAIN_SECONDS 5
+
+/**
+ * Data bytes of a command: its number, the time it was transmitted and filler
+ */
+#define BENCH_DATA 32
+
+/**
+ * Commands a peer transmits on a port per round of its loop
+ */
+#define BENCH_BURST 8
+
+/**
+ * Latencies kept per application thread and per peer
+ */
+#define BENCH_SAMPLES (1UL << 20)
+
+#if ((BENCH_PORTS > UART_PORTS) || (BENCH_WORKERS > GATEWAY_MAX_WORKERS) || (RX_QUEUE_SIZE < BENCH_DATA))
+#error 'bench_gateway needs BENCH_PORTS ports, BENCH_WORKERS workers and room for its commands'
+#endif
+
+static uint64_t now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1000000000ULL + time.tv_nsec;
+}
+
+static int compare(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*) a;
+	uint64_t y = *(const uint64_t*) b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * Sorts the latencies and returns the one at the percentile, in milliseconds
+ */
+static double percentile(uint64_t* samples, size_t count, uint8_t percent) {
+	if (!count) {
+		return 0;
+	}
+	qsort(samples, count, sizeof(uint64_t), compare);
+	return samples[count * percent / 100] / 1e6;
+}
+
+/**
+ * ---------------------------------------
+ * Peer processes
+ * ---------------------------------------
+ */
+
+/**
+ * Number of the next command transmitted and of the next echo expected on each port
+ */
+static uint32_t peerNext[BENCH_PORTS];
+static uint32_t peerExpected[BENCH_PORTS];
+static uint32_t peerErrors;
+static uint64_t* peerRoundTrips;
+static size_t peerSamples;
+
+static void peerHandler(struct UART* uart, struct Command* command) {
+	uint8_t port = uart - uartPorts;
+	uint32_t number;
+	uint64_t sent;
+	memcpy(&number, command->data, sizeof(number));
+	memcpy(&sent, command->data + sizeof(number), sizeof(sent));
+	if ((command->dataSize != BENCH_DATA) || (number != peerExpected[port])) {
+		peerErrors++;
+	}
+	peerExpected[port] = number + 1;
+	if (peerSamples < BENCH_SAMPLES) {
+		peerRoundTrips[peerSamples++] = now() - sent;
+	}
+}
+
+/**
+ * Drives the ports of the peer until its echoes are back
+ * Returns the exit status of the process
+ */
+static int peer(uint8_t index, char** lines) {
+	peerRoundTrips = malloc(BENCH_SAMPLES * sizeof(uint64_t));
+	for (uint8_t i = index; i < BENCH_PORTS; i += BENCH_PEERS) {
+		if (posixOpen(HDW_PORT(i), lines[i])) {
+			perror("peer line");
+			return 2;
+		}
+		UARTsetup(UART_PORT(i), peerHandler);
+	}
+	uint64_t end = now() + BENCH_SECONDS * 1000000000ULL;
+	uint64_t tick = now();
+	uint8_t data[BENCH_DATA];
+	memset(data, 0xA5, sizeof(data));
+	for (;;) {
+		uint64_t time = now();
+		uint8_t sending = (time < end);
+		for (uint8_t i = index; sending && (i < BENCH_PORTS); i += BENCH_PEERS) {
+			for (uint8_t j = 0; j < BENCH_BURST; j++) {
+				struct Command command;
+				initCommand(&command);
+				command.commandCode = 0x40;
+				memcpy(data, &peerNext[i], sizeof(uint32_t));
+				memcpy(data + sizeof(uint32_t), &time, sizeof(time));
+				setCommandData(&command, data, BENCH_DATA);
+				if (!transmitCommand(UART_PORT(i), &command)) {
+					break;
+				}
+				peerNext[i]++;
+			}
+		}
+		posixPoll(sending ? 0 : 5);
+		for (uint8_t i = index; i < BENCH_PORTS; i += BENCH_PEERS) {
+			UARTprocess(UART_PORT(i));
+			UARTflushWindow(UART_PORT(i));
+		}
+		if (time - tick >= TICK_PERIOD_MS * 1000000ULL) {
+			for (uint8_t i = index; i < BENCH_PORTS; i += BENCH_PEERS) {
+				UARTtick(UART_PORT(i));
+			}
+			tick = time;
+		}
+		if (!sending) {
+			uint8_t done = 1;
+			for (uint8_t i = index; i < BENCH_PORTS; i += BENCH_PEERS) {
+				done &= (peerExpected[i] == peerNext[i]);
+			}
+			if (done || (time > end + BENCH_DRAIN_SECONDS * 1000000000ULL)) {
+				break;
+			}
+		}
+	}
+	uint64_t sent = 0;
+	uint64_t echoed = 0;
+	for (uint8_t i = index; i < BENCH_PORTS; i += BENCH_PEERS) {
+		sent += peerNext[i];
+		echoed += peerExpected[i];
+	}
+	size_t samples = peerSamples;
+	double median = percentile(peerRoundTrips, samples, 50);
+	printf("    peer %u: %lu commands, %lu echoed, %u out of order, round trip p50 %.2f ms p99 %.2f ms\n",
+			index, (unsigned long) sent, (unsigned long) echoed, peerErrors, median,
+			percentile(peerRoundTrips, samples, 99));
+	fflush(stdout);
+	return (peerErrors || (sent != echoed)) ? 1 : 0;
+}
+
+/**
+ * ---------------------------------------
+ * Application threads of the gateway
+ * ---------------------------------------
+ */
+
+struct Application {
+	pthread_t thread;
+	uint8_t worker;
+	uint64_t received;
+	uint64_t* latencies;
+	size_t samples;
+};
+
+static struct Application applications[BENCH_WORKERS];
+static volatile uint8_t stopping;
+
+/**
+ * Echoes every command received by the worker back on its port
+ */
+static void* application(void* argument) {
+	struct Application* self = argument;
+	static __thread struct GatewayMessage message;
+	self->latencies = malloc(BENCH_SAMPLES * sizeof(uint64_t));
+	while (!stopping) {
+		if (gatewayWait(self->worker, 10) <= 0) {
+			continue;
+		}
+		while (gatewayReceive(self->worker, &message)) {
+			uint64_t sent;
+			memcpy(&sent, message.data + sizeof(uint32_t), sizeof(sent));
+			if (self->samples < BENCH_SAMPLES) {
+				self->latencies[self->samples++] = now() - sent;
+			}
+			self->received++;
+			while (!gatewaySubmit(message.port, &message.command) && !stopping) {
+				usleep(50);
+			}
+		}
+	}
+	return NULL;
+}
+
+int main() {
+	signal(SIGPIPE, SIG_IGN);
+	int masters[BENCH_PORTS];
+	char* lines[BENCH_PORTS];
+	for (uint8_t i = 0; i < BENCH_PORTS; i++) {
+		masters[i] = posix_openpt(O_RDWR | O_NOCTTY);
+		if ((masters[i] < 0) || grantpt(masters[i]) || unlockpt(masters[i])) {
+			perror("pseudo terminal");
+			return 2;
+		}
+		lines[i] = strdup(ptsname(masters[i]));
+	}
+	//the peers are forked before any thread runs
+	pid_t peers[BENCH_PEERS];
+	for (uint8_t i = 0; i < BENCH_PEERS; i++) {
+		peers[i] = fork();
+		if (peers[i] == 0) {
+			for (uint8_t j = 0; j < BENCH_PORTS; j++) {
+				close(masters[j]);
+			}
+			_exit(peer(i, lines));
+		}
+	}
+	for (uint8_t i = 0; i < BENCH_PORTS; i++) {
+		if (gatewayAttach(i, masters[i])) {
+			perror("attach");
+			return 2;
+		}
+	}
+	uint64_t start = now();
+	if (gatewayStart(BENCH_WORKERS)) {
+		perror("gateway");
+		return 2;
+	}
+	for (uint8_t i = 0; i < BENCH_WORKERS; i++) {
+		applications[i].worker = i;
+		pthread_create(&applications[i].thread, NULL, application, &applications[i]);
+	}
+	int failed = 0;
+	for (uint8_t i = 0; i < BENCH_PEERS; i++) {
+		int status;
+		waitpid(peers[i], &status, 0);
+		failed |= !WIFEXITED(status) || WEXITSTATUS(status);
+	}
+	double elapsed = (now() - start) / 1e9;
+	stopping = 1;
+	for (uint8_t i = 0; i < BENCH_WORKERS; i++) {
+		pthread_join(applications[i].thread, NULL);
+	}
+	gatewayStop();
+
+	uint64_t received = 0;
+	size_t samples = 0;
+	uint32_t dropped = 0;
+	for (uint8_t i = 0; i < BENCH_WORKERS; i++) {
+		received += applications[i].received;
+		samples += applications[i].samples;
+		dropped += gatewayWorkers[i].dropped;
+	}
+	uint64_t* latencies = malloc((samples + 1) * sizeof(uint64_t));
+	samples = 0;
+	for (uint8_t i = 0; i < BENCH_WORKERS; i++) {
+		memcpy(latencies + samples, applications[i].latencies,
+				applications[i].samples * sizeof(uint64_t));
+		samples += applications[i].samples;
+	}
+	double median = percentile(latencies, samples, 50);
+	printf("%2u ports, %u workers: %lu frames in %.2f s = %.0f frames/s, one way p50 %.2f ms "
+			"p99 %.2f ms, %u dropped\n", BENCH_PORTS, BENCH_WORKERS, (unsigned long) received,
+			elapsed, received / elapsed, median, percentile(latencies, samples, 99), dropped);
+	return (failed || dropped) ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+/*
+ * bench_queue.c
+ *
+ * Times the operations of a ring of utils/Queue.h on the host, in nanoseconds per byte: single
+ * bytes as the interrupts move them and blocks as UARTbulkTransmit does. tests/run.sh builds it
+ * with 8 and 16 bit indices (QUEUE_INDEX_BITS), for the same ring and for a ring only 16 bit
+ * indices can address.
+ */
+
+#include <stdio.h>
+#include <time.h>
+#include "../utils/Queue.h"
+
+#if (!defined(BENCH_QUEUE_SIZE))
+#define BENCH_QUEUE_SIZE 128
+#endif
+
+/**
+ * Bytes moved through the ring per measurement
+ */
+#define BENCH_BYTES 50000000UL
+
+/**
+ * Bytes of a block
+ */
+#define BENCH_BLOCK 16
+
+QUEUE_TYPE(BenchQueue, BENCH_QUEUE_SIZE);
+
+static struct BenchQueue queue;
+
+/**
+ * Keeps the compiler from dropping the bytes read
+ */
+static volatile uint8_t sink;
+
+static double now() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return time.tv_sec * 1e9 + time.tv_nsec;
+}
+
+/**
+ * Fills the ring half way and empties it again, a byte at a time
+ */
+static double bytes() {
+	uint8_t sum = 0;
+	double start = now();
+	for (uint32_t moved = 0; moved < BENCH_BYTES; moved += BENCH_QUEUE_SIZE / 2) {
+		for (QueueSize i = 0; i < BENCH_QUEUE_SIZE / 2; i++) {
+			enqueue(&queue, (uint8_t) i);
+		}
+		for (QueueSize i = 0; i < BENCH_QUEUE_SIZE / 2; i++) {
+			sum += dequeue(&queue);
+		}
+	}
+	double elapsed = now() - start;
+	sink = sum;
+	return elapsed / BENCH_BYTES;
+}
+
+/**
+ * The same in blocks
+ */
+static double blocks() {
+	uint8_t block[BENCH_BLOCK] = { 0 };
+	double start = now();
+	for (uint32_t moved = 0; moved < BENCH_BYTES; moved += BENCH_BLOCK) {
+		enqueueBlock(&queue, block, BENCH_BLOCK);
+		dequeueBlock(&queue, block, BENCH_BLOCK);
+	}
+	double elapsed = now() - start;
+	sink = block[0];
+	return elapsed / BENCH_BYTES;
+}
+
+int main() {
+	queueInit(&queue);
+	//the best of three, the first warms up
+	double byte = bytes();
+	double block = blocks();
+	for (uint8_t i = 0; i < 2; i++) {
+		double time = bytes();
+		if (time < byte) {
+			byte = time;
+		}
+		time = blocks();
+		if (time < block) {
+			block = time;
+		}
+	}
+	printf("%2d bit indices, ring of %5u: enqueue+dequeue %.2f ns/byte, blocks of %u %.2f ns/byte\n",
+			QUEUE_INDEX_BITS, (unsigned) BENCH_QUEUE_SIZE, byte, (unsigned) BENCH_BLOCK, block);
+	return 0;
+}
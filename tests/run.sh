@@ -0,0 +1,277 @@
+#!/bin/sh
+#
+# run.sh
+#
+# Builds the library on the host backends and runs the tests and benchmarks of this folder.
+#
+# usage: tests/run.sh [build] [test] [bench] [compare]
+#   build   - compiles every valid combination of the config.h switches, warnings are errors
+#   test    - builds and runs the tests
+#   bench   - builds and runs the benchmarks, printing their tables
+#   compare - compares the size and the receive cost of Uart<> with the C layer
+# Everything runs without arguments. CC, CXX and OUT (the build folder) come from the environment.
+#
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+CC=${CC:-gcc}
+CXX=${CXX:-g++}
+OUT=${OUT:-${TMPDIR:-/tmp}/uart-tests}
+CFLAGS="-std=gnu11 -O2 -pthread -Wall -Wextra -Werror"
+CXXFLAGS="-std=gnu++17 -O2 -pthread -Wall -Wextra -Werror"
+#the handlers and sinks of the tests ignore most of their arguments
+TESTFLAGS="-Wno-unused-parameter"
+
+LIBRARY="uart/uart.c uart/uart_hdw.c uart/uart_sim.c uart/uart_posix.c uart/uart_gateway.c
+	utils/Queue.c utils/commandBuilder.c utils/commandParser.c utils/commandWindow.c
+	utils/commandTimer.c utils/crc16.c"
+
+FAILED=0
+
+#
+# compile <name> "<sources>" [flags...]
+# Compiles the library and the sources (relative to the root) with the flags into $OUT/<name>,
+# linking them into $OUT/<name>/<name> when sources are given
+#
+compile() {
+	name=$1
+	sources=$2
+	shift 2
+	dir=$OUT/$name
+	rm -rf "$dir"
+	mkdir -p "$dir"
+	linker=$CC
+	for source in $LIBRARY $sources; do
+		object=$dir/$(echo "$source" | tr / _).o
+		flags=
+		case $source in
+		tests/*)
+			flags=$TESTFLAGS
+			;;
+		esac
+		case $source in
+		*.cpp)
+			$CXX $CXXFLAGS $flags "$@" -c "$ROOT/$source" -o "$object" || return 1
+			linker=$CXX
+			;;
+		*)
+			$CC $CFLAGS $flags "$@" -c "$ROOT/$source" -o "$object" || return 1
+			;;
+		esac
+	done
+	if [ -n "$sources" ]; then
+		$linker -pthread "$dir"/*.o -o "$dir/$name" || return 1
+	fi
+}
+
+#
+# run <name> "<sources>" [flags...]
+# Compiles the program and runs it, recording a failure of either
+#
+run() {
+	name=$1
+	sources=$2
+	shift 2
+	echo "== $name $*"
+	if ! compile "$name" "$sources" "$@"; then
+		echo "FAILED to build $name"
+		FAILED=1
+	elif ! "$OUT/$name/$name"; then
+		echo "FAILED $name"
+		FAILED=1
+	fi
+}
+
+#
+# check <flags...>
+# Compiles the library alone with the flags
+#
+check() {
+	if compile build "" "$@" 2>"$OUT/build.log"; then
+		echo "ok     $*"
+	else
+		echo "FAILED $*"
+		head -n 5 "$OUT/build.log"
+		FAILED=1
+	fi
+}
+
+#
+# Every combination of the basic switches on both host backends, then the options of the command
+# response model on top of the defaults
+#
+buildStep() {
+	for hardware in UART_HARDWARE_SIM UART_HARDWARE_POSIX; do
+		for queue in 0 1; do
+		for interrupt in 0 1; do
+		for command in 0 1; do
+		for numbering in 0 1; do
+		for symmetric in 0 1; do
+			if [ $command = 1 ] && { [ $queue = 0 ] || [ $interrupt = 0 ]; }; then
+				continue
+			fi
+			check -DUART_HARDWARE=$hardware -DUSE_QUEUE=$queue -DINTERRUPT_DRIVEN=$interrupt \
+					-DCOMMAND_RESPONSE_MODEL=$command -DUSE_COMMAND_NUMBERING=$numbering \
+					-DSYMMETRIC_QUEUE=$symmetric
+		done
+		done
+		done
+		done
+		done
+	done
+	while read -r options; do
+		check $options
+	done <<EOF
+-DFRAMING=FRAMING_COBS
+-DUSE_CRC=1
+-DUSE_CRC=1 -DCRC_MODE=CRC_BITWISE
+-DUSE_SLIDING_WINDOW=1
+-DUSE_SLIDING_WINDOW=1 -DUSE_RETRANSMIT_TIMER=1
+-DUSE_SLIDING_WINDOW=1 -DUSE_RETRANSMIT_TIMER=1 -DTICK_SOURCE=TICK_EXTERNAL -DDEFERRED_DISPATCH=1
+-DUSE_RETRANSMIT_TIMER=1 -DUSE_COMMAND_NUMBERING=0
+-DFLOW_CONTROL=FLOW_XON_XOFF
+-DFLOW_CONTROL=FLOW_RTS_CTS
+-DFLOW_CONTROL=FLOW_XON_XOFF -DCOMMAND_RESPONSE_MODEL=0
+-DFLOW_CONTROL=FLOW_RTS_CTS -DCOMMAND_RESPONSE_MODEL=0
+-DDEFERRED_DISPATCH=0
+-DQUEUE_SIZE=1024
+-DQUEUE_SIZE=1024 -DFRAMING=FRAMING_COBS -DUSE_CRC=1 -DUSE_SLIDING_WINDOW=1
+-DUART_PORTS=3
+-DUART_PORTS=3 -DUSE_SLIDING_WINDOW=1 -DUSE_RETRANSMIT_TIMER=1 -DDEFERRED_DISPATCH=1
+-DUART_HARDWARE=UART_HARDWARE_POSIX -DUART_PORTS=8 -DFLOW_CONTROL=FLOW_XON_XOFF
+-DUART_HARDWARE=UART_HARDWARE_POSIX -DUART_PORTS=8 -DUSE_GATEWAY=1
+EOF
+}
+
+#
+# The tests, each for the configurations it covers
+#
+testStep() {
+	for bits in 8 16; do
+		run test_queue tests/test_queue.c -DQUEUE_INDEX_BITS=$bits
+	done
+	run test_numbering tests/test_numbering.c -DUART_PORTS=2 -DDEFERRED_DISPATCH=1
+	run test_flow tests/test_flow.c -DUART_PORTS=2 -DDEFERRED_DISPATCH=1
+	run test_baud tests/test_baud.c -DUART_PORTS=2 -DQUEUE_SIZE=128
+	#the peer with 8 bit queue indices first, the main side starts it. The command queues take
+	#the COM_WAIT, COM_RESUME and COM_ACK the long command brings about at once on a pseudo terminal.
+	peer=$OUT/test_wire_peer/test_wire_peer
+	for options in "-DFRAMING=FRAMING_ESCAPE" "-DFRAMING=FRAMING_COBS -DUSE_CRC=1"; do
+		if compile test_wire_peer tests/test_wire.c -DUART_HARDWARE=UART_HARDWARE_POSIX -DWIRE_PEER \
+				-DQUEUE_SIZE=128 -DCOMMAND_QUEUE_SIZE=16 $options; then
+			run test_wire tests/test_wire.c -DUART_HARDWARE=UART_HARDWARE_POSIX -DQUEUE_SIZE=1024 \
+					-DCOMMAND_QUEUE_SIZE=16 -DWIRE_PEER_PATH="\"$peer\"" $options
+			#the same through the gateway, the worker runs the line
+			run test_wire_gateway tests/test_wire.c -DUART_HARDWARE=UART_HARDWARE_POSIX -DUSE_GATEWAY=1 \
+					-DTICK_SOURCE=TICK_EXTERNAL -DQUEUE_SIZE=1024 -DCOMMAND_QUEUE_SIZE=16 -DWIRE_PEER_PATH="\"$peer\"" $options
+			#termios has no speed for 250000 baud, the pseudo terminal keeps its own
+			run test_wire_speed tests/test_wire.c -DUART_HARDWARE=UART_HARDWARE_POSIX -DBAUD_RATE=250000 \
+					-DQUEUE_SIZE=1024 -DCOMMAND_QUEUE_SIZE=16 -DWIRE_PEER_PATH="\"$peer\"" $options
+		else
+			echo "FAILED to build test_wire_peer"
+			FAILED=1
+		fi
+	done
+	for options in "-DCOMMAND_RESPONSE_MODEL=0" "-DCOMMAND_RESPONSE_MODEL=0 -DFLOW_CONTROL=FLOW_XON_XOFF" \
+			"-DUSE_COMMAND_NUMBERING=0" "" "-DFLOW_CONTROL=FLOW_XON_XOFF" "-DFRAMING=FRAMING_COBS"; do
+		run test_interop tests/test_interop.cpp -DUART_PORTS=2 -DQUEUE_SIZE=128 $options
+	done
+	for deferred in 0 1; do
+		run test_window tests/test_window.c -DUART_PORTS=2 -DUSE_SLIDING_WINDOW=1 \
+				-DUSE_RETRANSMIT_TIMER=1 -DTICK_SOURCE=TICK_EXTERNAL -DDEFERRED_DISPATCH=$deferred
+	done
+}
+
+#
+# Throughput, idle gaps, interrupt cost and command round trip of the modes on the simulator, then
+# the gateway over pseudo terminals
+#
+benchStep() {
+	run bench_queue tests/bench_queue.c -DQUEUE_INDEX_BITS=8
+	run bench_queue tests/bench_queue.c -DQUEUE_INDEX_BITS=16
+	run bench_queue tests/bench_queue.c -DQUEUE_INDEX_BITS=16 -DBENCH_QUEUE_SIZE=4096
+	for framing in FRAMING_ESCAPE FRAMING_COBS; do
+		run bench_codec tests/bench_codec.c -DQUEUE_SIZE=256 -DFRAMING=$framing
+	done
+	for mode in CRC_TABLE CRC_BITWISE; do
+		run bench_codec tests/bench_codec.c -DQUEUE_SIZE=256 -DUSE_CRC=1 -DCRC_MODE=$mode
+	done
+	for queue in 0 1; do
+	for interrupt in 0 1; do
+		run bench_config tests/bench_config.c -DUART_PORTS=2 -DUSE_QUEUE=$queue \
+				-DINTERRUPT_DRIVEN=$interrupt -DCOMMAND_RESPONSE_MODEL=0
+	done
+	done
+	for options in "" "-DDEFERRED_DISPATCH=0" "-DUSE_COMMAND_NUMBERING=0" "-DFRAMING=FRAMING_COBS" \
+			"-DUSE_CRC=1" "-DUSE_SLIDING_WINDOW=1" "-DQUEUE_SIZE=64" "-DQUEUE_SIZE=64 -DUSE_SLIDING_WINDOW=1" \
+			"-DBAUD_RATE=115200 -DQUEUE_SIZE=64"; do
+		run bench_config tests/bench_config.c -DUART_PORTS=2 $options
+	done
+	for shape in "8 1" "8 8" "32 1" "32 2" "32 8"; do
+		set -- $shape
+		run bench_gateway tests/bench_gateway.c -DUART_HARDWARE=UART_HARDWARE_POSIX -DUSE_GATEWAY=1 \
+				-DUART_PORTS=32 -DQUEUE_SIZE=4096 -DUSE_SLIDING_WINDOW=1 -DUSE_RETRANSMIT_TIMER=1 \
+				-DTICK_SOURCE=TICK_EXTERNAL -DWINDOW_SIZE=32 -DWINDOW_BUFFER_SIZE=2048 -DUSE_CRC=1 \
+				-DCOMMAND_QUEUE_SIZE=64 -DBENCH_PORTS=$1 -DBENCH_WORKERS=$2
+	done
+}
+
+#
+# The C layer against Uart<> with the same settings: the code and data of the C objects (without
+# the simulator) and of a Uart<> using its whole API compiled with -Os, then the host time per
+# received byte on the simulator
+#
+compareStep() {
+	echo "                             C layer text  data+bss | Uart<> text  data+bss"
+	while read -r label options; do
+		if ! compile size "" -Os -DUART_PORTS=1 $options 2>"$OUT/build.log" \
+				|| ! $CXX $CXXFLAGS $TESTFLAGS -Os -DUART_PORTS=1 $options \
+						-c "$ROOT/tests/size_cpp.cpp" -o "$OUT/size/size_cpp.o" 2>>"$OUT/build.log"; then
+			echo "FAILED to build $label"
+			head -n 5 "$OUT/build.log"
+			FAILED=1
+			continue
+		fi
+		c=$(size $(ls "$OUT"/size/*.o | grep -v -e uart_sim -e uart_posix -e uart_gateway -e size_cpp) \
+				| awk 'NR > 1 { text += $1; data += $2 + $3 } END { print text, data }')
+		cpp=$(size "$OUT/size/size_cpp.o" | awk 'NR > 1 { print $1, $2 + $3 }')
+		printf "%-28s %13s %9s | %11s %9s\n" "$label" $c $cpp
+	done <<EOF
+raw -DCOMMAND_RESPONSE_MODEL=0
+raw+XON/XOFF -DCOMMAND_RESPONSE_MODEL=0 -DFLOW_CONTROL=FLOW_XON_XOFF
+escape+XON/XOFF -DFLOW_CONTROL=FLOW_XON_XOFF -DUSE_COMMAND_NUMBERING=0
+escape+numbering+XON/XOFF -DFLOW_CONTROL=FLOW_XON_XOFF
+COBS+numbering -DFRAMING=FRAMING_COBS
+EOF
+	for options in "-DCOMMAND_RESPONSE_MODEL=0" "-DCOMMAND_RESPONSE_MODEL=0 -DFLOW_CONTROL=FLOW_XON_XOFF" \
+			"-DFLOW_CONTROL=FLOW_XON_XOFF -DUSE_COMMAND_NUMBERING=0" "-DFLOW_CONTROL=FLOW_XON_XOFF" \
+			"-DFRAMING=FRAMING_COBS"; do
+		run bench_cpp tests/bench_cpp.cpp -DUART_PORTS=2 -DQUEUE_SIZE=128 $options
+	done
+}
+
+mkdir -p "$OUT"
+for step in ${*:-build test bench compare}; do
+	case $step in
+	build)
+		buildStep
+		;;
+	test)
+		testStep
+		;;
+	bench)
+		benchStep
+		;;
+	compare)
+		compareStep
+		;;
+	*)
+		echo "unknown step $step"
+		exit 2
+		;;
+	esac
+done
+if [ $FAILED != 0 ]; then
+	echo "FAILED"
+	exit 1
+fi
+echo "PASSED"
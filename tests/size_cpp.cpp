@@ -0,0 +1,38 @@
+/*
+ * size_cpp.cpp
+ *
+ * A Uart<> port with the settings of tests/BenchConfig.hpp and every function of its API in use.
+ * tests/run.sh compiles it alone and compares its code and data with the objects of the C layer
+ * built with the same switches.
+ */
+
+#include "BenchConfig.hpp"
+
+Uart<UartUSART<0>, BenchConfig> port;
+
+volatile uint8_t sink;
+
+void useUart() {
+	port.setup();
+	sink = port.idle();
+	sink = port.available();
+#if COMMAND_RESPONSE_MODEL
+	static const uint8_t data[4] = { 1, 2, 3, 4 };
+	port.transmitCommand(0x40, data, sizeof(data));
+	port.process([](const UartCommand& command) {
+		sink = command.code;
+	});
+#else
+	static const uint8_t data[4] = { 1, 2, 3, 4 };
+	port.transmit(0x55);
+	port.transmit(data, sizeof(data));
+	uint8_t received;
+	if (port.receive(received)) {
+		sink = received;
+	}
+#endif
+	//the vectors, UART_VECTORS() on the AVR
+	port.receiveInterrupt();
+	port.dataEmptyInterrupt();
+	port.transmitCompleteInterrupt();
+}
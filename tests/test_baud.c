@@ -0,0 +1,144 @@
+/*
+ * test_baud.c
+ *
+ * Sets the ports up with advancedUARTsetup() (UART_HARDWARE_SIM, the command response model with
+ * flow control): the settings the port can not run, a baud rate error above MAX_BAUD_ERROR and a
+ * headroom the receive queue can not hold leave the running port untouched, the watermarks follow
+ * the baud rate, and two ports switched to a new format exchange commands on it.
+ */
+
+#include <stdio.h>
+#include "../uart/uart.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2) || (!COMMAND_RESPONSE_MODEL) \
+		|| (F_CPU != 16000000UL) || (MAX_BAUD_ERROR != 200) || (RX_QUEUE_SIZE != 128))
+#error 'test_baud needs UART_HARDWARE_SIM, UART_PORTS=2, the command response model, F_CPU 16 MHz, MAX_BAUD_ERROR 200 and QUEUE_SIZE=128'
+#endif
+
+/**
+ * Code of the commands
+ */
+#define TEST_CODE 0x40
+
+static void sinkPort0(uint8_t data) {
+	simFeedLine(HDW_PORT(1), &data, 1);
+}
+
+static void sinkPort1(uint8_t data) {
+	simFeedLine(HDW_PORT(0), &data, 1);
+}
+
+/**
+ * Commands each port handled
+ */
+static uint16_t handled[UART_PORTS];
+
+static void handler(struct UART* uart, struct Command* command) {
+	if (command->commandCode == TEST_CODE) {
+		handled[uart - uartPorts]++;
+	}
+}
+
+static int16_t setup(uint8_t port, uint32_t baudRate, uint8_t parity, uint8_t stopBits,
+		uint8_t frameSize) {
+	return advancedUARTsetup(UART_PORT(port), baudRate, parity, stopBits, frameSize,
+			UART_SPEED_AUTO, handler);
+}
+
+/**
+ * Checks the error of a setup, the port runs afterwards unless it was rejected
+ */
+static uint8_t expect(const char* name, int16_t error, int16_t expected) {
+	if (error != expected) {
+		printf("%s returned %d, expected %d\n", name, error, expected);
+		return 0;
+	}
+	return 1;
+}
+
+/**
+ * Checks the watermarks of port 0 against the headroom at the baud rate
+ */
+static uint8_t expectWatermarks(uint32_t baudRate) {
+	int32_t high = RX_QUEUE_SIZE - FLOW_HEADROOM(baudRate);
+	int32_t low = high * RX_LOW_WATERMARK / RX_HIGH_WATERMARK;
+	if ((UART_PORT(0)->rxHighWatermark != high) || (UART_PORT(0)->rxLowWatermark != low)) {
+		printf("watermarks at %lu baud are %u and %u, expected %ld and %ld\n",
+				(unsigned long) baudRate, UART_PORT(0)->rxHighWatermark,
+				UART_PORT(0)->rxLowWatermark, (long) high, (long) low);
+		return 0;
+	}
+	return 1;
+}
+
+int main() {
+	simReset();
+	simSetTransmitSink(HDW_PORT(0), sinkPort0);
+	simSetTransmitSink(HDW_PORT(1), sinkPort1);
+	UARTsetup(UART_PORT(0), handler);
+	UARTsetup(UART_PORT(1), handler);
+	uint32_t frameCycles = simFrameCycles(HDW_PORT(0));
+	uint8_t ucsrb = simUSARTs[0].ucsrb;
+	uint8_t ok = expectWatermarks(BAUD_RATE);
+
+	//rejected before the running port is touched
+	ok &= expect("7 bit characters", setup(0, 9600, UART_PARITY_NONE, 1, 7), UART_SETUP_INVALID);
+	ok &= expect("3 stop bits", setup(0, 9600, UART_PARITY_NONE, 3, 8), UART_SETUP_INVALID);
+	ok &= expect("parity 1", setup(0, 9600, 1, 1, 8), UART_SETUP_INVALID);
+	ok &= expect("0 baud", setup(0, 0, UART_PARITY_NONE, 1, 8), UART_SETUP_INVALID);
+	ok &= expect("100 baud", setup(0, 100, UART_PARITY_NONE, 1, 8), UART_SETUP_INVALID);
+	//the closest rate to 115200 at 16 MHz is 117647 with U2X, 2.12% off
+	ok &= expect("115200 baud", setup(0, 115200, UART_PARITY_NONE, 1, 8), UART_SETUP_INVALID);
+	//the partner sends 200 bytes in PARTNER_REACTION_US at 2 Mbaud
+	ok &= expect("2000000 baud", setup(0, 2000000, UART_PARITY_NONE, 1, 8), UART_SETUP_INVALID);
+	//F_CPU / 8 is the fastest rate, the error of a rate above it would not fit 32 bits
+	uint16_t setting;
+	ok &= expect("setting of 2000000 baud", hdwBaudSetting(F_CPU / 8, UART_SPEED_AUTO, &setting), 0);
+	ok &= expect("setting of 2000001 baud", hdwBaudSetting(F_CPU / 8 + 1, UART_SPEED_AUTO, &setting),
+			UART_SETUP_INVALID);
+	ok &= expect("setting of 4000000000 baud",
+			hdwBaudSetting(4000000000UL, UART_SPEED_AUTO, &setting), UART_SETUP_INVALID);
+	ok &= expect("4000000000 baud", setup(0, 4000000000UL, UART_PARITY_NONE, 1, 8),
+			UART_SETUP_INVALID);
+	if ((simFrameCycles(HDW_PORT(0)) != frameCycles) || (simUSARTs[0].ucsrb != ucsrb)) {
+		printf("a rejected setup changed the port\n");
+		ok = 0;
+	}
+	ok &= expectWatermarks(BAUD_RATE);
+
+	//above BAUD_RATE the headroom grows
+	ok &= expect("1000000 baud", setup(0, 1000000, UART_PARITY_NONE, 1, 8), 0);
+	ok &= expectWatermarks(1000000);
+
+	//57142 baud with U2X, 8 data bits, even parity and 2 stop bits on both ports
+	ok &= expect("57600 baud 8E2", setup(0, 57600, UART_PARITY_EVEN, 2, 8), -79);
+	ok &= expect("57600 baud 8E2", setup(1, 57600, UART_PARITY_EVEN, 2, 8), -79);
+	ok &= expectWatermarks(57600);
+	if ((simFrameCycles(HDW_PORT(0)) != 12 * 35 * 8)
+			|| !(simUSARTs[0].ucsrb & (1 << RXEN | 1 << TXEN))) {
+		printf("port 0 does not run 57600 baud 8E2\n");
+		ok = 0;
+	}
+
+	for (uint8_t i = 0; i < 4; i++) {
+		struct Command command;
+		initCommand(&command);
+		command.commandCode = TEST_CODE;
+		addCommandData(&command, i);
+		transmitCommand(UART_PORT(i & 1), &command);
+	}
+	for (uint16_t i = 0; i < 200; i++) {
+		UARTprocess(UART_PORT(0));
+		UARTprocess(UART_PORT(1));
+		simAdvance(simFrameCycles(HDW_PORT(0)));
+	}
+	if ((handled[0] != 2) || (handled[1] != 2)) {
+		printf("the ports handled %u and %u of 2 commands each\n", handled[0], handled[1]);
+		ok = 0;
+	}
+	if (!ok) {
+		return 1;
+	}
+	printf("rejected settings left the port untouched, the watermarks followed the baud rate\n");
+	return 0;
+}
@@ -0,0 +1,119 @@
+/*
+ * test_flow.c
+ *
+ * Stops port 0 with COM_WAIT once the command queue of port 1 fills up (UART_HARDWARE_SIM,
+ * deferred dispatch, FLOW_COMMANDS), then lets port 1 drain it while its control lane is full:
+ * the COM_RESUME that found no room has to go out once the lane empties, port 0 transmits nothing
+ * that would make port 1 try it again on receive.
+ */
+
+#include <stdio.h>
+#include "../uart/uart.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2) || (!DEFERRED_DISPATCH) \
+		|| (FLOW_CONTROL != FLOW_COMMANDS) || USE_SLIDING_WINDOW || USE_RETRANSMIT_TIMER)
+#error 'test_flow needs UART_HARDWARE_SIM, UART_PORTS=2, DEFERRED_DISPATCH and FLOW_COMMANDS without the window and the timer'
+#endif
+
+/**
+ * Code of the commands
+ */
+#define TEST_CODE 0x40
+
+static void sinkPort0(uint8_t data) {
+	simFeedLine(HDW_PORT(1), &data, 1);
+}
+
+static void sinkPort1(uint8_t data) {
+	simFeedLine(HDW_PORT(0), &data, 1);
+}
+
+static void handlerPort0(struct UART* uart, struct Command* command) {
+}
+
+/**
+ * Commands port 1 handled
+ */
+static uint16_t handled;
+
+static void handlerPort1(struct UART* uart, struct Command* command) {
+	if (command->commandCode == TEST_CODE) {
+		handled++;
+	}
+}
+
+/**
+ * Lets the line carry the bytes for the frames, handling the commands of port 0 only
+ */
+static void run(uint16_t frames) {
+	for (uint16_t i = 0; i < frames; i++) {
+		UARTprocess(UART_PORT(0));
+		simAdvance(simFrameCycles(HDW_PORT(0)));
+	}
+}
+
+/**
+ * Transmits a command from port 0
+ */
+static uint8_t transmit(uint8_t data) {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = TEST_CODE;
+	addCommandData(&command, data);
+	return transmitCommand(UART_PORT(0), &command);
+}
+
+int main() {
+	simReset();
+	simSetTransmitSink(HDW_PORT(0), sinkPort0);
+	simSetTransmitSink(HDW_PORT(1), sinkPort1);
+	UARTsetup(UART_PORT(0), handlerPort0);
+	UARTsetup(UART_PORT(1), handlerPort1);
+
+	//port 1 handles nothing until it stopped port 0
+	uint16_t sent = 0;
+	for (uint16_t i = 0; (i < 4 * COMMAND_QUEUE_SIZE)
+			&& !(UART_PORT(1)->status & COM_STATUS_FLOW_STOPPED); i++) {
+		sent += transmit((uint8_t) i);
+		run(20);
+	}
+	run(100);
+	if (!(UART_PORT(1)->status & COM_STATUS_FLOW_STOPPED)
+			|| !(UART_PORT(0)->status & COM_STATUS_SELF_WAITING)) {
+		printf("port 1 did not stop port 0\n");
+		return 1;
+	}
+
+	//fill the control lane of port 1 so its COM_RESUME finds no room
+	struct Command filler;
+	initCommand(&filler);
+	filler.commandCode = COM_ACK;
+	addCommandData(&filler, 0);
+	while (transmitCommand(UART_PORT(1), &filler)) {
+	}
+	UARTprocess(UART_PORT(1));
+	if (!(UART_PORT(1)->status & COM_STATUS_FLOW_STOPPED)) {
+		printf("the control lane of port 1 had room for COM_RESUME\n");
+		return 1;
+	}
+
+	run(CONTROL_QUEUE_SIZE + 100);
+	if (UART_PORT(0)->status & COM_STATUS_SELF_WAITING) {
+		printf("port 1 never resumed port 0\n");
+		return 1;
+	}
+	//the commands port 0 held back arrive
+	UARTprocess(UART_PORT(1));
+	if (!transmit(0xFF)) {
+		printf("port 0 could not queue a command\n");
+		return 1;
+	}
+	run(100);
+	UARTprocess(UART_PORT(1));
+	if (handled != sent + 1) {
+		printf("port 1 handled %u of %u commands\n", handled, sent + 1);
+		return 1;
+	}
+	printf("port 1 resumed port 0 once its control lane emptied, %u commands handled\n", handled);
+	return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * test_interop.cpp
+ *
+ * Connects port 0 run by the C layer and port 1 run by a Uart<> with the same settings
+ * (UART_HARDWARE_SIM, tests/BenchConfig.hpp) and lets both transmit at once: numbered commands
+ * with a data pattern on a framed port, a byte pattern on a raw one. Each side has to take
+ * everything the other one sent, in order and unchanged.
+ */
+
+#include <stdio.h>
+#include "BenchConfig.hpp"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2))
+#error 'test_interop needs UART_HARDWARE_SIM and UART_PORTS=2'
+#endif
+
+/**
+ * Code and data bytes of the commands, and the commands or bytes each side transmits
+ */
+#define TEST_CODE 0x40
+#define TEST_DATA 12
+#define TEST_COUNT 300
+
+static Uart<UartUSART<1>, BenchConfig> cppPort;
+
+static void sinkPort0(uint8_t data) {
+	simFeedLine(HDW_PORT(1), &data, 1);
+}
+
+static void sinkPort1(uint8_t data) {
+	simFeedLine(HDW_PORT(0), &data, 1);
+}
+
+/**
+ * Commands or bytes taken by each side, and those that did not match the pattern
+ */
+static uint16_t cTaken;
+static uint16_t cppTaken;
+static uint16_t errors;
+
+/**
+ * Byte i of the data of command n, every value on a framed port, printable ones on a raw port as
+ * it can not carry XON and XOFF
+ */
+static uint8_t pattern(uint16_t n, uint8_t i) {
+#if COMMAND_RESPONSE_MODEL
+	return (uint8_t) (n * 7 + i);
+#else
+	return 0x20 + (n * 7 + i) % 0x5F;
+#endif
+}
+
+#if COMMAND_RESPONSE_MODEL
+
+static void handler(struct UART* uart, struct Command* command) {
+	if (command->commandCode != TEST_CODE) {
+		return;
+	}
+	uint8_t matches = (command->dataSize == TEST_DATA);
+	for (uint8_t i = 0; matches && (i < TEST_DATA); i++) {
+		matches = (command->data[i] == pattern(cTaken, i));
+	}
+	errors += !matches;
+	cTaken++;
+}
+
+static void cppHandler(const UartCommand& command) {
+	if (command.code != TEST_CODE) {
+		return;
+	}
+	uint8_t matches = (command.size == TEST_DATA);
+#if USE_COMMAND_NUMBERING
+	matches &= (command.number == (uint8_t) cppTaken);
+#endif
+	for (uint8_t i = 0; matches && (i < TEST_DATA); i++) {
+		matches = (command.data[i] == pattern(cppTaken, i));
+	}
+	errors += !matches;
+	cppTaken++;
+}
+
+static bool transmitC(uint16_t n) {
+	uint8_t data[TEST_DATA];
+	for (uint8_t i = 0; i < TEST_DATA; i++) {
+		data[i] = pattern(n, i);
+	}
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = TEST_CODE;
+	setCommandData(&command, data, TEST_DATA);
+	return transmitCommand(UART_PORT(0), &command);
+}
+
+static bool transmitCpp(uint16_t n) {
+	uint8_t data[TEST_DATA];
+	for (uint8_t i = 0; i < TEST_DATA; i++) {
+		data[i] = pattern(n, i);
+	}
+	return cppPort.transmitCommand(TEST_CODE, data, TEST_DATA);
+}
+
+static void receive() {
+	UARTprocess(UART_PORT(0));
+	cppPort.process(cppHandler);
+}
+
+#else
+
+static void queueFull(struct UART* uart) {
+}
+
+static void transmitted(struct UART* uart) {
+}
+
+static bool transmitC(uint16_t n) {
+	return UARTtransmit(UART_PORT(0), pattern(n, 0));
+}
+
+static bool transmitCpp(uint16_t n) {
+	return cppPort.transmit(pattern(n, 0));
+}
+
+static void receive() {
+	while (queueCount(&UART_PORT(0)->rxQueue)) {
+		errors += (UARTreceive(UART_PORT(0)) != pattern(cTaken, 0));
+		cTaken++;
+	}
+	uint8_t data;
+	while (cppPort.receive(data)) {
+		errors += (data != pattern(cppTaken, 0));
+		cppTaken++;
+	}
+}
+
+#endif
+
+int main() {
+	simReset();
+	simSetTransmitSink(HDW_PORT(0), sinkPort0);
+	simSetTransmitSink(HDW_PORT(1), sinkPort1);
+#if COMMAND_RESPONSE_MODEL
+	UARTsetup(UART_PORT(0), handler);
+#else
+	UARTsetup(UART_PORT(0), queueFull, transmitted);
+#endif
+	cppPort.setup();
+
+	uint16_t cSent = 0;
+	uint16_t cppSent = 0;
+	for (uint32_t frame = 0; (frame < 100000UL)
+			&& ((cTaken < TEST_COUNT) || (cppTaken < TEST_COUNT)); frame++) {
+		if ((cSent < TEST_COUNT) && transmitC(cSent)) {
+			cSent++;
+		}
+		if ((cppSent < TEST_COUNT) && transmitCpp(cppSent)) {
+			cppSent++;
+		}
+		receive();
+		simAdvance(simFrameCycles(HDW_PORT(0)));
+	}
+	if ((cTaken != TEST_COUNT) || (cppTaken != TEST_COUNT) || errors) {
+		printf("the C layer took %u, Uart<> %u of %u, %u did not match\n", cTaken, cppTaken,
+				TEST_COUNT, errors);
+		return 1;
+	}
+	printf("C%d F%d N%d X%d: both sides took the %u %s of the other one\n", COMMAND_RESPONSE_MODEL,
+			FRAMING, USE_COMMAND_NUMBERING, FLOW_CONTROL == FLOW_XON_XOFF, TEST_COUNT,
+			COMMAND_RESPONSE_MODEL ? "commands" : "bytes");
+	return 0;
+}
@@ -0,0 +1,91 @@
+/*
+ * test_numbering.c
+ *
+ * Loses a numbered command on a full command queue of port 1 (UART_HARDWARE_SIM, deferred
+ * dispatch) while older commands still wait in it: the waiting commands have to keep their
+ * numbers and the one after the loss has to be taken without a resync. Port 1 never stops port 0,
+ * its bytes go nowhere.
+ */
+
+#include <stdio.h>
+#include "../uart/uart.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2) || (!DEFERRED_DISPATCH) \
+		|| (!USE_COMMAND_NUMBERING) || USE_SLIDING_WINDOW)
+#error 'test_numbering needs UART_HARDWARE_SIM, UART_PORTS=2, DEFERRED_DISPATCH and numbering without the window'
+#endif
+
+/**
+ * Code of the commands
+ */
+#define TEST_CODE 0x40
+
+static void sinkPort0(uint8_t data) {
+	simFeedLine(HDW_PORT(1), &data, 1);
+}
+
+static void sinkNowhere(uint8_t data) {
+}
+
+static void handlerPort0(struct UART* uart, struct Command* command) {
+}
+
+/**
+ * Data of the commands port 1 handled, in order
+ */
+static uint8_t handled[2 * COMMAND_QUEUE_SIZE];
+static uint8_t handledCount;
+
+static void handlerPort1(struct UART* uart, struct Command* command) {
+	if ((command->commandCode == TEST_CODE) && (handledCount < sizeof(handled))) {
+		handled[handledCount++] = command->data[0];
+	}
+}
+
+/**
+ * Transmits a command from port 0 and lets the line carry it to port 1
+ */
+static void transmit(uint8_t data) {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = TEST_CODE;
+	addCommandData(&command, data);
+	while (!transmitCommand(UART_PORT(0), &command)) {
+		simAdvance(100);
+	}
+	while (queueCount(&UART_PORT(0)->txQueue) || simUSARTs[0].shifting) {
+		simAdvance(100);
+	}
+	simAdvance(simFrameCycles(HDW_PORT(0)));
+}
+
+int main() {
+	simReset();
+	simSetTransmitSink(HDW_PORT(0), sinkPort0);
+	simSetTransmitSink(HDW_PORT(1), sinkNowhere);
+	UARTsetup(UART_PORT(0), handlerPort0);
+	UARTsetup(UART_PORT(1), handlerPort1);
+
+	//fill the command queue of port 1, the one after is lost
+	for (uint8_t i = 0; i <= COMMAND_QUEUE_SIZE; i++) {
+		transmit(i);
+	}
+	UARTprocess(UART_PORT(1));
+	//and the first one after the loss
+	transmit(COMMAND_QUEUE_SIZE + 1);
+	UARTprocess(UART_PORT(1));
+
+	uint8_t failed = (handledCount != COMMAND_QUEUE_SIZE + 1);
+	for (uint8_t i = 0; i < handledCount; i++) {
+		//the lost one is skipped
+		uint8_t expected = (i < COMMAND_QUEUE_SIZE) ? i : i + 1;
+		failed |= (handled[i] != expected);
+	}
+	failed |= (UART_PORT(1)->incCommandNumber != COMMAND_QUEUE_SIZE + 2);
+	printf("port 1 handled");
+	for (uint8_t i = 0; i < handledCount; i++) {
+		printf(" %u", handled[i]);
+	}
+	printf(", expects command number %u\n", UART_PORT(1)->incCommandNumber);
+	return failed;
+}
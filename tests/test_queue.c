@@ -0,0 +1,228 @@
+/*
+ * test_queue.c
+ *
+ * Hammers a ring of utils/Queue.h from two host threads, the producer and the consumer of an
+ * interrupt and the main loop, checking that every byte arrives once and in order. Each side
+ * switches between the single byte, block and span operations. Before that the operations are
+ * checked while the free running indices wrap around, 255 to 0 or 65535 to 0. tests/run.sh builds
+ * it for both index widths.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include "../utils/Queue.h"
+
+/**
+ * Bytes passed through the ring
+ */
+#define TEST_BYTES 5000000UL
+
+/**
+ * Largest block written or read at once
+ */
+#define TEST_BLOCK 13
+
+QUEUE_TYPE(TestQueue, 64);
+
+static struct TestQueue queue;
+
+/**
+ * Writes the byte sequence 0, 1, 2, ... in pieces of changing size
+ */
+static void* producer(void* unused) {
+	uint8_t block[TEST_BLOCK];
+	uint32_t next = 0;
+	uint32_t round = 0;
+	while (next < TEST_BYTES) {
+		if (queueSpace(&queue) == 0) {
+			//let the consumer run on a single core
+			sched_yield();
+		}
+		QueueSize length = 1 + round++ % TEST_BLOCK;
+		if (length > TEST_BYTES - next) {
+			length = TEST_BYTES - next;
+		}
+		switch (round % 3) {
+		case 0:
+			next += enqueue(&queue, (uint8_t) next);
+			break;
+		case 1:
+			for (QueueSize i = 0; i < length; i++) {
+				block[i] = (uint8_t) (next + i);
+			}
+			next += enqueueBlock(&queue, block, length);
+			break;
+		default:
+			//a frame, all or nothing
+			if (queueReserve(&queue, length)) {
+				for (QueueSize i = 0; i < length; i++) {
+					block[i] = (uint8_t) (next + i);
+				}
+				queueWriteReserved(&queue, 0, block, length);
+				queueProduce(&queue, length);
+				next += length;
+			}
+			break;
+		}
+	}
+	return NULL;
+}
+
+/**
+ * Reads the sequence back, returns the first byte out of order
+ */
+static uint32_t consume() {
+	uint8_t block[TEST_BLOCK];
+	uint32_t next = 0;
+	uint32_t round = 0;
+	while (next < TEST_BYTES) {
+		if (queueCount(&queue) == 0) {
+			sched_yield();
+		}
+		QueueSize length = 1 + round++ % TEST_BLOCK;
+		QueueSize count;
+		uint8_t* span;
+		switch (round % 3) {
+		case 0:
+			if (queueCount(&queue) == 0) {
+				continue;
+			}
+			if (dequeue(&queue) != (uint8_t) next) {
+				return next;
+			}
+			next++;
+			break;
+		case 1:
+			count = dequeueBlock(&queue, block, length);
+			for (QueueSize i = 0; i < count; i++, next++) {
+				if (block[i] != (uint8_t) next) {
+					return next;
+				}
+			}
+			break;
+		default:
+			count = queueReadSpan(&queue, &span);
+			for (QueueSize i = 0; i < count; i++, next++) {
+				if (span[i] != (uint8_t) next) {
+					return next;
+				}
+			}
+			queueConsume(&queue, count);
+			break;
+		}
+	}
+	return next;
+}
+
+/**
+ * Checks the count, space and content of the ring
+ */
+static uint8_t holds(const uint8_t* data, QueueSize length) {
+	if ((queueCount(&queue) != length) || (queueSpace(&queue) != sizeof(queue.buffer) - length)) {
+		return 0;
+	}
+	for (QueueSize i = 0; i < length; i++) {
+		if (queue.buffer[(QueueSize) (queue.index.head + i) & QUEUE_MASK(&queue)] != data[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Runs the operations of the ring with both indices just before start, where they wrap to 0.
+ * Returns the name of the first failing check, NULL if all passed.
+ */
+static const char* wrap(QueueSize start) {
+	static const uint8_t data[TEST_BLOCK] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13 };
+	uint8_t read[TEST_BLOCK];
+	uint8_t* span;
+	queue.index.head = start;
+	queue.index.tail = start;
+	//the tail wraps in the middle of the bytes
+	for (QueueSize i = 0; i < 5; i++) {
+		if (!enqueue(&queue, data[i])) {
+			return "enqueue";
+		}
+	}
+	if ((queue.index.tail != (QueueSize) (start + 5)) || !holds(data, 5)) {
+		return "count after enqueue";
+	}
+	//then the head
+	for (QueueSize i = 0; i < 5; i++) {
+		if (dequeue(&queue) != data[i]) {
+			return "dequeue";
+		}
+	}
+	if ((queueCount(&queue) != 0) || (queue.index.head != queue.index.tail)) {
+		return "count after dequeue";
+	}
+	//a block and a reserved frame across the wrap
+	queue.index.head = start;
+	queue.index.tail = start;
+	if ((enqueueBlock(&queue, data, 6) != 6) || !holds(data, 6)) {
+		return "enqueueBlock";
+	}
+	if ((dequeueBlock(&queue, read, TEST_BLOCK) != 6) || (read[5] != data[5])) {
+		return "dequeueBlock";
+	}
+	if (!queueReserve(&queue, TEST_BLOCK)) {
+		return "queueReserve";
+	}
+	queueWriteReserved(&queue, 0, data, TEST_BLOCK);
+	if (queueCount(&queue) != 0) {
+		return "reserved items visible before queueProduce";
+	}
+	queueProduce(&queue, TEST_BLOCK);
+	if (!holds(data, TEST_BLOCK)) {
+		return "queueProduce";
+	}
+	QueueSize count = queueReadSpan(&queue, &span);
+	if ((count == 0) || (span[0] != data[0])) {
+		return "queueReadSpan";
+	}
+	queueConsume(&queue, TEST_BLOCK);
+	if (queueCount(&queue) != 0) {
+		return "queueConsume";
+	}
+	//a full ring whose tail wrapped while its head did not
+	queue.index.head = start;
+	queue.index.tail = start;
+	for (QueueSize i = 0; i < sizeof(queue.buffer); i++) {
+		if (!enqueue(&queue, (uint8_t) i)) {
+			return "enqueue into the ring";
+		}
+	}
+	if (enqueue(&queue, 0) || (queueSpace(&queue) != 0)
+			|| (queueCount(&queue) != sizeof(queue.buffer))) {
+		return "full ring";
+	}
+	return NULL;
+}
+
+int main() {
+	//the indices wrap 255 to 0 with 8 bits and 65535 to 0 with 16 bits
+	QueueSize starts[] = { (QueueSize) -3, (QueueSize) -1, (QueueSize) -TEST_BLOCK, 0 };
+	for (uint8_t i = 0; i < sizeof(starts) / sizeof(starts[0]); i++) {
+		const char* failed = wrap(starts[i]);
+		if (failed) {
+			printf("%s failed with the indices at %lu\n", failed, (unsigned long) starts[i]);
+			return 1;
+		}
+	}
+
+	queueInit(&queue);
+	pthread_t thread;
+	pthread_create(&thread, NULL, producer, NULL);
+	uint32_t received = consume();
+	if (received != TEST_BYTES) {
+		//the producer may be stuck on a full ring, leave it
+		printf("byte %lu arrived out of order\n", (unsigned long) received);
+		return 1;
+	}
+	pthread_join(thread, NULL);
+	printf("%lu bytes in order through a ring of %u with %d bit indices\n",
+			(unsigned long) TEST_BYTES, (unsigned) sizeof(queue.buffer), QUEUE_INDEX_BITS);
+	return 0;
+}
@@ -0,0 +1,183 @@
+/*
+ * test_window.c
+ *
+ * Checks that a frame longer than the transmit queue never enters the window. Then cuts the line
+ * from port 0 to port 1 (UART_HARDWARE_SIM, sliding window with the retransmit timer) until the
+ * window of port 0 fails and drops its commands, then connects it again: the commands transmitted
+ * afterwards have to reach port 1 once the numbering is resynced. Port 1 is also moved to a
+ * command number far from the window of port 0: it answers the next command with a resync, port 0
+ * drops the command (reporting it) and continues at the number port 1 expects.
+ */
+
+#include <stdio.h>
+#include "../uart/uart.h"
+
+#if ((UART_HARDWARE != UART_HARDWARE_SIM) || (UART_PORTS != 2) || (!USE_SLIDING_WINDOW) \
+		|| (!USE_RETRANSMIT_TIMER) || (TICK_SOURCE != TICK_EXTERNAL))
+#error 'test_window needs UART_HARDWARE_SIM, UART_PORTS=2, the window and the retransmit timer with TICK_EXTERNAL'
+#endif
+
+/**
+ * Code of the commands
+ */
+#define TEST_CODE 0x40
+
+/**
+ * Cycles of a tick
+ */
+#define TEST_TICK_CYCLES (F_CPU / 1000UL * TICK_PERIOD_MS)
+
+/**
+ * The line from port 0 to port 1 carries the bytes
+ */
+static uint8_t connected = 1;
+
+static void sinkPort0(uint8_t data) {
+	if (connected) {
+		simFeedLine(HDW_PORT(1), &data, 1);
+	}
+}
+
+static void sinkPort1(uint8_t data) {
+	simFeedLine(HDW_PORT(0), &data, 1);
+}
+
+static void handlerPort0(struct UART* uart, struct Command* command) {
+}
+
+/**
+ * Data of the last command port 1 handled and the number handled
+ */
+static uint8_t last;
+static uint16_t handled;
+
+static void handlerPort1(struct UART* uart, struct Command* command) {
+	if (command->commandCode == TEST_CODE) {
+		last = command->data[0];
+		handled++;
+	}
+}
+
+static uint8_t failures;
+
+static void failurePort0(struct UART* uart, uint8_t reason) {
+	if (reason == COM_FAILURE_WINDOW) {
+		failures++;
+	}
+}
+
+/**
+ * Runs the main loop of both ports for the ticks
+ */
+static void run(uint16_t ticks) {
+	for (uint16_t i = 0; i < ticks; i++) {
+		for (uint8_t j = 0; j < 10; j++) {
+#if DEFERRED_DISPATCH
+			UARTprocess(UART_PORT(0));
+			UARTprocess(UART_PORT(1));
+#else
+			UARTflushWindow(UART_PORT(0));
+			UARTflushWindow(UART_PORT(1));
+#endif
+			simAdvance(TEST_TICK_CYCLES / 10);
+		}
+		UARTtick(UART_PORT(0));
+		UARTtick(UART_PORT(1));
+	}
+}
+
+/**
+ * Transmits a command from port 0 with the data
+ */
+static uint8_t transmit(uint8_t data) {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = TEST_CODE;
+	addCommandData(&command, data);
+	return transmitCommand(UART_PORT(0), &command);
+}
+
+/**
+ * Transmits the command and waits until port 1 handled it
+ * Returns 0 if it did not within the ticks
+ */
+static uint8_t deliver(uint8_t data, uint16_t ticks) {
+	uint16_t before = handled;
+	if (!transmit(data)) {
+		printf("the window of port 0 is full\n");
+		return 0;
+	}
+	for (uint16_t i = 0; (i < ticks) && (handled == before); i++) {
+		run(1);
+	}
+	if ((handled != before + 1) || (last != data)) {
+		printf("command %u did not reach port 1, %u handled\n", data, handled - before);
+		return 0;
+	}
+	return 1;
+}
+
+int main() {
+	simReset();
+	simSetTransmitSink(HDW_PORT(0), sinkPort0);
+	simSetTransmitSink(HDW_PORT(1), sinkPort1);
+	UARTsetup(UART_PORT(0), handlerPort0);
+	UARTsetup(UART_PORT(1), handlerPort1);
+	UARTsetFailureHandler(UART_PORT(0), failurePort0);
+
+	//a frame longer than the transmit queue is rejected before it enters the window
+	static uint8_t data[TX_QUEUE_SIZE];
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = TEST_CODE;
+	setCommandData(&command, data, TX_QUEUE_SIZE);
+	if (transmitCommand(UART_PORT(0), &command)
+			|| (queueCount(&UART_PORT(0)->commandWindow.frames) != 0)) {
+		printf("port 0 took a frame longer than its transmit queue\n");
+		return 1;
+	}
+
+	for (uint8_t i = 0; i < 3; i++) {
+		if (!deliver(i, 10)) {
+			return 1;
+		}
+	}
+
+	//the window fails while the line is cut and drops the commands
+	connected = 0;
+	transmit(10);
+	transmit(11);
+	for (uint16_t i = 0; (i < 4000) && (!failures); i++) {
+		run(1);
+	}
+	if (!failures) {
+		printf("the window of port 0 did not fail\n");
+		return 1;
+	}
+	connected = 1;
+	//a timeout may pass before the resync reaches port 1
+	for (uint8_t i = 20; i < 24; i++) {
+		if (!deliver(i, 4 * RETRANSMIT_MAX_TIMEOUT_TICKS)) {
+			return 1;
+		}
+	}
+
+	//port 1 expects a number far outside the window
+	UART_PORT(1)->incCommandNumber += 100;
+	uint8_t failed = failures;
+	transmit(30);
+	for (uint16_t i = 0; (i < 100) && (failures == failed); i++) {
+		run(1);
+	}
+	if (failures == failed) {
+		printf("port 0 did not drop the command port 1 could not take\n");
+		return 1;
+	}
+	for (uint8_t i = 31; i < 34; i++) {
+		if (!deliver(i, 4 * RETRANSMIT_MAX_TIMEOUT_TICKS)) {
+			return 1;
+		}
+	}
+	printf("port 1 handled %u commands, port 0 resynced after %u failures\n", handled, failures);
+	return 0;
+}
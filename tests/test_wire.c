@@ -0,0 +1,262 @@
+/*
+ * test_wire.c
+ *
+ * Connects two builds of the library with different queue index widths over a pseudo terminal
+ * (UART_HARDWARE_POSIX). Built with WIRE_PEER it is the peer: small queues and 8 bit indices, it
+ * answers every command with its size, the sum of its data and its first bytes. Otherwise it
+ * is the main side: large queues and 16 bit indices, directly or through the gateway
+ * (USE_GATEWAY), it starts the peer (WIRE_PEER_PATH) on the other side of the line and transmits
+ * commands of lengths on both sides of 128, one at a time, checking every answer. tests/run.sh
+ * builds both.
+ */
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#if USE_GATEWAY
+#include "../uart/uart_gateway.h"
+#else
+#include "../uart/uart.h"
+#endif
+
+#if ((UART_HARDWARE != UART_HARDWARE_POSIX) || (!COMMAND_RESPONSE_MODEL))
+#error 'test_wire needs UART_HARDWARE_POSIX and the command response model'
+#endif
+#if (defined(WIRE_PEER) && (QUEUE_INDEX_BITS != 8))
+#error 'the peer of test_wire needs 8 bit queue indices'
+#endif
+#if ((!defined(WIRE_PEER)) && ((QUEUE_INDEX_BITS != 16) || (!defined(WIRE_PEER_PATH))))
+#error 'test_wire needs 16 bit queue indices and WIRE_PEER_PATH'
+#endif
+
+/**
+ * Codes of the commands: the peer is ready, a command to answer and its answer
+ */
+#define WIRE_READY 0x40
+#define WIRE_COMMAND 0x41
+#define WIRE_ANSWER 0x42
+
+/**
+ * Data bytes an answer repeats at most
+ */
+#define WIRE_ECHO 32
+
+/**
+ * Seconds the sides wait for each other at most
+ */
+#define WIRE_TIMEOUT 5
+
+static time_t deadline;
+
+/**
+ * The sum of the data and the data an answer repeats
+ */
+static uint8_t summarize(const uint8_t* data, uint16_t size, uint8_t* answer) {
+	uint8_t sum = 0;
+	for (uint16_t i = 0; i < size; i++) {
+		sum += data[i];
+	}
+	uint8_t length = 0;
+	answer[length++] = (uint8_t) size;
+	answer[length++] = size >> 8;
+	answer[length++] = sum;
+	for (uint16_t i = 0; (i < size) && (i < WIRE_ECHO); i++) {
+		answer[length++] = data[i];
+	}
+	return length;
+}
+
+/**
+ * Transmits the command on port 0, through the gateway on a gateway build
+ */
+static void transmit(uint8_t code, uint8_t* data, uint16_t size) {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = code;
+	setCommandData(&command, data, size);
+#if USE_GATEWAY
+	while (!gatewaySubmit(0, &command) && (time(0) < deadline)) {
+		usleep(1000);
+	}
+#else
+	while (!transmitCommand(UART_PORT(0), &command) && (time(0) < deadline)) {
+		posixPoll(10);
+	}
+#endif
+}
+
+#if defined(WIRE_PEER)
+
+static uint8_t done;
+
+static void handler(struct UART* uart, struct Command* command) {
+	if (command->commandCode == WIRE_COMMAND) {
+		uint8_t answer[WIRE_ECHO + 3];
+		uint8_t length = summarize(command->data, command->dataSize, answer);
+		transmit(WIRE_ANSWER, answer, length);
+	} else if (command->commandCode == WIRE_READY) {
+		done = 1;
+	}
+}
+
+int main(int argc, char** argv) {
+	deadline = time(0) + WIRE_TIMEOUT * 4;
+	if ((argc < 2) || posixOpen(HDW_PORT(0), argv[1])) {
+		perror("peer line");
+		return 2;
+	}
+	UARTsetup(UART_PORT(0), handler);
+	transmit(WIRE_READY, 0, 0);
+	//the main side ends with WIRE_READY as well
+	while (!done && (time(0) < deadline)) {
+		posixPoll(10);
+		UARTprocess(UART_PORT(0));
+	}
+	//let the last answer leave
+	for (uint8_t i = 0; i < 20; i++) {
+		posixPoll(10);
+	}
+	return done ? 0 : 1;
+}
+
+#else
+
+/**
+ * Lengths of the commands, 128 and above take two length bytes. The data of a command is kept
+ * contiguous in the receive queue of 128 bytes of the peer, so the longest comes while the queue
+ * is at the start of its buffer and the others fit wherever the flow control left it.
+ */
+static const uint16_t lengths[] = { 128, 0, 1, 5, 60 };
+
+/**
+ * Byte i of the data of the commands
+ */
+static uint8_t pattern(uint16_t i) {
+	return (uint8_t) (i * 13 + 1);
+}
+
+static uint8_t ready;
+static uint8_t answered;
+static uint8_t answer[WIRE_ECHO + 3];
+static uint8_t answerLength;
+
+static void take(struct Command* command) {
+	if (command->commandCode == WIRE_READY) {
+		ready = 1;
+	} else if ((command->commandCode == WIRE_ANSWER) && (command->dataSize <= sizeof(answer))) {
+		memcpy(answer, command->data, command->dataSize);
+		answerLength = command->dataSize;
+		answered = 1;
+	}
+}
+
+#if USE_GATEWAY
+
+static struct GatewayMessage message;
+
+/**
+ * Takes the commands the worker of port 0 received
+ */
+static void run() {
+	if (gatewayWait(0, 10) > 0) {
+		while (gatewayReceive(0, &message)) {
+			take(&message.command);
+		}
+	}
+}
+
+#else
+
+static void handler(struct UART* uart, struct Command* command) {
+	take(command);
+}
+
+static void run() {
+	posixPoll(10);
+	UARTprocess(UART_PORT(0));
+}
+
+#endif
+
+/**
+ * Runs the line until the flag is set or the time is up
+ */
+static uint8_t await(uint8_t* flag) {
+	deadline = time(0) + WIRE_TIMEOUT;
+	while (!*flag && (time(0) < deadline)) {
+		run();
+	}
+	return *flag;
+}
+
+int main() {
+	int master = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((master < 0) || grantpt(master) || unlockpt(master)) {
+		perror("pseudo terminal");
+		return 2;
+	}
+	char* line = strdup(ptsname(master));
+	pid_t peer = fork();
+	if (peer == 0) {
+		close(master);
+		execl(WIRE_PEER_PATH, WIRE_PEER_PATH, line, (char*) 0);
+		_exit(2);
+	}
+#if USE_GATEWAY
+	if (gatewayAttach(0, master) || gatewayStart(1)) {
+		perror("gateway");
+		return 2;
+	}
+#else
+	if (posixAttach(HDW_PORT(0), master)) {
+		perror("line");
+		return 2;
+	}
+	UARTsetup(UART_PORT(0), handler);
+#endif
+
+	uint8_t failed = !await(&ready);
+	if (failed) {
+		printf("the peer did not start\n");
+	}
+	for (uint8_t i = 0; !failed && (i < sizeof(lengths) / sizeof(lengths[0])); i++) {
+		uint8_t data[128];
+		for (uint16_t j = 0; j < lengths[i]; j++) {
+			data[j] = pattern(j);
+		}
+		uint8_t expected[WIRE_ECHO + 3];
+		uint8_t expectedLength = summarize(data, lengths[i], expected);
+		answered = 0;
+		transmit(WIRE_COMMAND, data, lengths[i]);
+		if (!await(&answered) || (answerLength != expectedLength)
+				|| memcmp(answer, expected, expectedLength)) {
+			printf("the peer answered a command of %u bytes with %u bytes: size %u, sum %u\n",
+					lengths[i], answered ? answerLength : 0, answer[0] | answer[1] << 8, answer[2]);
+			failed = 1;
+		}
+	}
+	transmit(WIRE_READY, 0, 0);
+	for (uint8_t i = 0; i < 20; i++) {
+		run();
+	}
+	int status;
+	waitpid(peer, &status, 0);
+#if USE_GATEWAY
+	gatewayStop();
+#endif
+	if (failed || !WIFEXITED(status) || WEXITSTATUS(status)) {
+		printf("FAILED, the peer exited with %d\n", WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+		return 1;
+	}
+	printf("%u commands of up to 128 bytes between %u%s and 8 bit queue indices\n",
+			(unsigned) (sizeof(lengths) / sizeof(lengths[0])), QUEUE_INDEX_BITS,
+			USE_GATEWAY ? " (gateway)" : "");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,1076 @@
+/*
+ * Uart.hpp
+ */
+
+#ifndef UART_HPP_
+#define UART_HPP_
+
+/**
+ * C++ front end of the UART layer, header only (C++17, -std=gnu++17 with avr-gcc 7 or later).
+ * A Uart<UartUSART<n>, Config> drives USARTn with the settings of its Config instead of the
+ * global switches of config.h, so one image can mix ports of different kinds, e.g. a raw byte
+ * console next to a port in the command response model. Every setting is a compile time
+ * constant, the handlers of a port only contain the code of its own settings.
+ *
+ * Give the USARTs driven by Uart<> to it alone:
+ * - on the AVR, the C layer defines the vectors of the ports below UART_PORTS, a Uart<> takes a
+ *   USART above them and UART_VECTORS(n, port) defines its vectors
+ * - on the host backends the emulated ports are the ports below UART_PORTS, setup() takes the
+ *   vectors of the port over from the C layer, which leaves the port alone
+ *
+ * The C API of uart.h stays as it is. The commands of a framed port are wire compatible with the
+ * C layer built with the same FRAMING and USE_COMMAND_NUMBERING, whatever the queue sizes of
+ * either side. CRC, the sliding window, the retransmissions, the priority classes and the
+ * COM_WAIT/COM_RESUME flow control stay with the C layer.
+ */
+
+extern "C" {
+#include "uart_hdw.h"
+#include "../commands.h"
+}
+
+#if defined(__AVR__)
+#include <util/atomic.h>
+#endif
+
+#if ((UART_HARDWARE != UART_HARDWARE_AVR) && (!INTERRUPT_DRIVEN))
+#error 'Uart.hpp requires INTERRUPT_DRIVEN with the host backends, they dispatch the vectors'
+#endif
+
+/**
+ * ------------------------------------------
+ * Settings of a port
+ * ------------------------------------------
+ */
+
+/**
+ * Framing of the port
+ * Raw - plain bytes, transmit() and receive() move single bytes or blocks
+ * Escape - commands (transmitCommand() and process()) ending with COM_END, as FRAMING_ESCAPE
+ * Cobs - commands encoded with COBS ending with 0x00, as FRAMING_COBS
+ */
+enum class UartFraming : uint8_t {
+	Raw, Escape, Cobs
+};
+
+/**
+ * Flow control of the receive queue of the port
+ * None - the data received while the receive queue is full is lost
+ * XonXoff - FLOW_XOFF and FLOW_XON stop the partner at the watermarks, as FLOW_XON_XOFF
+ */
+enum class UartFlow : uint8_t {
+	None, XonXoff
+};
+
+/**
+ * Default settings of a port. Derive the settings of a port from it and hide the ones to change:
+ *
+ *   struct ConsoleConfig : UartConfig {
+ *       static constexpr uint16_t txQueueSize = 64;
+ *   };
+ *   Uart<UartUSART<1>, ConsoleConfig> console;
+ *   UART_VECTORS(1, console)
+ */
+struct UartConfig {
+	/**
+	 * Baud rate, 8 data bits, no parity and 1 stop bit
+	 */
+	static constexpr uint32_t baudRate = BAUD_RATE;
+
+	/**
+	 * Bytes of the receive and the transmit queue, powers of two not greater than 32768.
+	 * A framed port keeps the data of the received commands in the receive queue.
+	 */
+	static constexpr uint16_t rxQueueSize = 16;
+	static constexpr uint16_t txQueueSize = 16;
+
+	static constexpr UartFraming framing = UartFraming::Raw;
+
+	/**
+	 * The commands carry a command number, a framed port only
+	 */
+	static constexpr bool numbering = false;
+
+	static constexpr UartFlow flow = UartFlow::None;
+
+	/**
+	 * Number of received commands waiting for process(), a power of two not greater than 128
+	 */
+	static constexpr uint8_t commandQueueSize = 4;
+
+	/**
+	 * Time the partner takes to stop transmitting once it sees XOFF, in microseconds
+	 */
+	static constexpr uint32_t partnerReactionUs = PARTNER_REACTION_US;
+};
+
+/**
+ * A command received on a framed port, its data points into the receive queue and is only valid
+ * until the handler returns
+ */
+struct UartCommand {
+	uint8_t code;
+	/**
+	 * The command number, 0 without numbering
+	 */
+	uint8_t number;
+	uint16_t size;
+	const uint8_t* data;
+};
+
+/**
+ * ------------------------------------------
+ * Hardware of a port
+ * ------------------------------------------
+ */
+
+/**
+ * The registers of USARTn: ucsra(), ucsrb(), ucsrc(), ubrrh(), ubrrl(), write() and read() of UDR
+ */
+template<uint8_t n>
+struct UartUSART;
+
+#if (UART_HARDWARE == UART_HARDWARE_AVR)
+
+/**
+ * The registers of a USART are at fixed addresses, every access is a single instruction
+ */
+#define UART_USART(n) \
+	template<> \
+	struct UartUSART<n> { \
+		static constexpr uint8_t index = n; \
+		static volatile uint8_t& ucsra() { return HDW_UCSRA(n); } \
+		static volatile uint8_t& ucsrb() { return HDW_UCSRB(n); } \
+		static volatile uint8_t& ucsrc() { return HDW_UCSRC(n); } \
+		static volatile uint8_t& ubrrh() { return HDW_UBRRH(n); } \
+		static volatile uint8_t& ubrrl() { return HDW_UBRRL(n); } \
+		static void write(uint8_t data) { HDW_UDR(n) = data; } \
+		static uint8_t read() { return HDW_UDR(n); } \
+	};
+
+UART_USART(0)
+#if defined(UDR1)
+UART_USART(1)
+#endif
+#if defined(UDR2)
+UART_USART(2)
+#endif
+#if defined(UDR3)
+UART_USART(3)
+#endif
+
+/**
+ * Vectors of USARTn running the handlers of the port
+ */
+#define UART_VECTORS(n, port) \
+	ISR(UART##n##_RXC_vect) { \
+		(port).receiveInterrupt(); \
+	} \
+	ISR(UART##n##_UDRE_vect) { \
+		(port).dataEmptyInterrupt(); \
+	} \
+	ISR(UART##n##_TXC_vect) { \
+		(port).transmitCompleteInterrupt(); \
+	}
+
+#else
+
+/**
+ * The emulated USART of port n of the host backend
+ */
+template<uint8_t n>
+struct UartUSART {
+	static_assert(n < UART_PORTS, "the host backends emulate the ports below UART_PORTS");
+	static constexpr uint8_t index = n;
+	static HdwPort* port() { return HDW_PORT(n); }
+	static uint8_t& ucsra() { return UART_UCSRA(port()); }
+	static uint8_t& ucsrb() { return UART_UCSRB(port()); }
+	static uint8_t& ucsrc() { return UART_UCSRC(port()); }
+	static uint8_t& ubrrh() { return UART_UBRRH(port()); }
+	static uint8_t& ubrrl() { return UART_UBRRL(port()); }
+	static void write(uint8_t data) { UART_WRITE_UDR(port(), data); }
+	static uint8_t read() { return UART_READ_UDR(port()); }
+};
+
+/**
+ * The host backends hand the vectors to the port in setup()
+ */
+#define UART_VECTORS(n, port)
+
+#endif
+
+/**
+ * ------------------------------------------
+ * Queues
+ * ------------------------------------------
+ */
+
+/**
+ * Loads and stores of the indices shared between the interrupts and the main program,
+ * as QUEUE_LOAD() and QUEUE_STORE() of Queue.h
+ */
+template<typename Index>
+static inline Index uartLoad(Index& index) {
+#if defined(__AVR__)
+	if constexpr (sizeof(Index) != 1) {
+		//the AVR accesses 16 bit indices in two instructions, so an interrupt must not split them
+		Index value;
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			value = *(volatile Index*) &index;
+		}
+		return value;
+	}
+#endif
+	return __atomic_load_n(&index, __ATOMIC_ACQUIRE);
+}
+
+template<typename Index>
+static inline void uartStore(Index& index, Index value) {
+#if defined(__AVR__)
+	if constexpr (sizeof(Index) != 1) {
+		ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+			*(volatile Index*) &index = value;
+		}
+		return;
+	}
+#endif
+	__atomic_store_n(&index, value, __ATOMIC_RELEASE);
+}
+
+/**
+ * Index of a queue of up to 128 bytes (narrow) or of up to 32768 bytes
+ */
+template<bool narrow>
+struct UartIndexOf {
+	typedef uint16_t Type;
+};
+
+template<>
+struct UartIndexOf<true> {
+	typedef uint8_t Type;
+};
+
+/**
+ * Single producer, single consumer ring of size bytes with free running indices masked on
+ * access, as the queues of Queue.h
+ */
+template<uint16_t size>
+struct UartRing {
+	static_assert(size && (!(size & (size - 1))) && (size <= 32768U),
+			"the queue size should be a power of two not greater than 32768");
+
+	typedef typename UartIndexOf<(size <= 128)>::Type Index;
+
+	static constexpr Index mask = size - 1;
+
+	Index head;
+	Index tail;
+	uint8_t buffer[size];
+
+	void init() {
+		head = 0;
+		tail = 0;
+	}
+
+	Index count() {
+		return (Index) (uartLoad(tail) - uartLoad(head));
+	}
+
+	Index space() {
+		return (Index) (size - count());
+	}
+
+	/**
+	 * Enqueues the byte, returns false if the ring is full
+	 */
+	bool push(uint8_t data) {
+		//only the producer writes the tail so it can be read without ordering
+		Index current = tail;
+		if ((Index) (current - uartLoad(head)) == size) {
+			return false;
+		}
+		buffer[current & mask] = data;
+		uartStore(tail, (Index) (current + 1));
+		return true;
+	}
+
+	/**
+	 * Dequeues the oldest byte, the ring must not be empty
+	 */
+	uint8_t pop() {
+		Index current = head;
+		uint8_t data = buffer[current & mask];
+		uartStore(head, (Index) (current + 1));
+		return data;
+	}
+
+	/**
+	 * Writes the byte at offset past the tail, published with produce()
+	 */
+	void put(Index offset, uint8_t data) {
+		buffer[(Index) (tail + offset) & mask] = data;
+	}
+
+	void produce(Index length) {
+		uartStore(tail, (Index) (tail + length));
+	}
+
+	void consume(Index length) {
+		uartStore(head, (Index) (head + length));
+	}
+
+	/**
+	 * Points span at the next free byte and returns how many can be written from there
+	 * without wrapping around
+	 */
+	Index writeSpan(uint8_t*& span) {
+		Index current = tail;
+		Index room = (Index) (size - (Index) (current - uartLoad(head)));
+		Index offset = current & mask;
+		span = buffer + offset;
+		if (room > (Index) (size - offset)) {
+			room = size - offset;
+		}
+		return room;
+	}
+};
+
+/**
+ * ------------------------------------------
+ * Command response model of a port
+ * ------------------------------------------
+ */
+
+/**
+ * A received command waiting in the command queue
+ */
+struct UartQueuedCommand {
+	UartCommand command;
+	/**
+	 * Numbered commands lost right before this one, the numbering skips them
+	 */
+	uint8_t lost;
+};
+
+/**
+ * State of the framing, a raw port keeps none
+ */
+template<class Config, bool framed = (Config::framing != UartFraming::Raw)>
+struct UartFrames {
+};
+
+template<class Config>
+struct UartFrames<Config, true> {
+	typedef typename UartRing<Config::rxQueueSize>::Index RxIndex;
+
+	/**
+	 * The next byte of the frame expected
+	 */
+	uint8_t parseState;
+	/**
+	 * FRAMING_ESCAPE: the previous byte was COM_ESCAPE_CHAR.
+	 * FRAMING_COBS: bytes left in the current run and whether a zero follows it.
+	 */
+	uint8_t escaped;
+	uint8_t remaining;
+	uint8_t zero;
+	/**
+	 * Numbered commands lost since the last one queued
+	 */
+	uint8_t lost;
+	/**
+	 * The command numbers, only used by the main program
+	 */
+	uint8_t incNumber;
+	uint8_t outNumber;
+	/**
+	 * Data bytes of the command in flight written so far, and the bytes of the receive queue
+	 * reserved for them (including the skipped end of the buffer)
+	 */
+	RxIndex received;
+	RxIndex reserved;
+	uint8_t* target;
+	/**
+	 * The command in flight
+	 */
+	UartCommand command;
+	/**
+	 * Commands received completely, waiting for process()
+	 */
+	uint8_t commandHead;
+	uint8_t commandTail;
+	UartQueuedCommand commands[Config::commandQueueSize];
+};
+
+/**
+ * ------------------------------------------
+ * The port
+ * ------------------------------------------
+ */
+
+/**
+ * A port driving the USART with the settings of Config. The handlers run from the vectors of
+ * the USART, everything else from the main program.
+ */
+template<class USART, class Config = UartConfig>
+class Uart: private UartFrames<Config> {
+public:
+	static constexpr bool framed = (Config::framing != UartFraming::Raw);
+	static constexpr bool xonXoff = (Config::flow == UartFlow::XonXoff);
+
+	static_assert(framed || (!Config::numbering), "command numbering requires a framed port");
+	static_assert((!xonXoff) || (Config::framing != UartFraming::Cobs),
+			"UartFlow::XonXoff requires UartFraming::Escape, COBS frames can contain XON and XOFF");
+	static_assert(Config::commandQueueSize && (!(Config::commandQueueSize & (Config::commandQueueSize - 1)))
+			&& (Config::commandQueueSize <= 128),
+			"commandQueueSize should be a power of two not greater than 128");
+
+private:
+	typedef UartRing<Config::rxQueueSize> RxRing;
+	typedef UartRing<Config::txQueueSize> TxRing;
+	typedef typename RxRing::Index RxIndex;
+	typedef typename TxRing::Index TxIndex;
+
+	/**
+	 * UBRR of baudRate rounded to the closest rate, in double speed mode (U2X) only if that
+	 * comes closer, as UARTsetup()
+	 */
+	static constexpr uint32_t ubrrNormal = (F_CPU + 8UL * Config::baudRate) / (16UL * Config::baudRate) - 1;
+	static constexpr uint32_t ubrrDouble = (F_CPU + 4UL * Config::baudRate) / (8UL * Config::baudRate) - 1;
+	static constexpr uint32_t rateError(uint32_t ubrr, uint32_t divisor) {
+		return (F_CPU / (divisor * (ubrr + 1)) > Config::baudRate)
+				? (F_CPU / (divisor * (ubrr + 1)) - Config::baudRate)
+				: (Config::baudRate - F_CPU / (divisor * (ubrr + 1)));
+	}
+	static_assert(Config::baudRate <= F_CPU / 8, "baudRate is above F_CPU / 8, the highest rate of the USART");
+	static constexpr bool doubleSpeed = rateError(ubrrDouble, 8) < rateError(ubrrNormal, 16);
+	static constexpr uint32_t ubrr = doubleSpeed ? ubrrDouble : ubrrNormal;
+	static_assert(ubrr <= HDW_UBRR_MAX, "baudRate is too low for UBRR at this F_CPU");
+
+#if defined(URSEL)
+	static constexpr uint8_t frameFormat = 1 << URSEL | 1 << UCSZ1 | 1 << UCSZ0;
+#else
+	static constexpr uint8_t frameFormat = 1 << UCSZ1 | 1 << UCSZ0;
+#endif
+
+	/**
+	 * Watermarks of the receive queue, as RX_HIGH_WATERMARK and RX_LOW_WATERMARK with the
+	 * FLOW_HEADROOM of FLOW_XON_XOFF
+	 */
+	static constexpr int32_t headroom = (int32_t) ((((uint64_t) Config::baudRate / 10)
+			* Config::partnerReactionUs + 999999UL) / 1000000UL) + 2 + 2;
+	static constexpr int32_t highWatermark = (int32_t) Config::rxQueueSize - headroom;
+	static constexpr int32_t lowWatermark = highWatermark / 2;
+	static_assert((!xonXoff) || ((highWatermark > 0) && (lowWatermark < highWatermark)),
+			"rxQueueSize is too small for the headroom of XON/XOFF at this baudRate and partnerReactionUs");
+
+	/**
+	 * The byte following COM_ESCAPE_CHAR is flipped with XON/XOFF, as FRAME_ESCAPE_FLIP
+	 */
+	static constexpr uint8_t escapeFlip = xonXoff ? 0x20 : 0x00;
+
+	static constexpr uint8_t cobsMaxRun = 254;
+
+	static constexpr uint8_t commandMask = Config::commandQueueSize - 1;
+
+	/**
+	 * Parser states, the next byte expected on the line
+	 */
+	enum : uint8_t {
+		parseCode, parseNumber, parseLength, parseLengthHigh, parseData, parseEnd, parseNoRoom,
+		parseDrop
+	};
+
+	RxRing rx;
+	TxRing tx;
+
+	/**
+	 * COM_STATUS_TRANSMITTING, COM_STATUS_FLOW_STOPPED and COM_STATUS_PARTNER_STOPPED
+	 */
+	volatile uint8_t status;
+
+	/**
+	 * XON or XOFF waiting to be transmitted ahead of the transmit queue, 0 if none
+	 */
+	volatile uint8_t flowByte;
+
+public:
+	/**
+	 * Sets the USART up and starts receiving. Parity is disabled, 1 stop bit and 8 data bits.
+	 */
+	void setup() {
+		rx.init();
+		tx.init();
+		status = 0;
+		flowByte = 0;
+		if constexpr (framed) {
+			this->parseState = parseCode;
+			this->escaped = 0;
+			this->remaining = 0;
+			this->zero = 0;
+			this->lost = 0;
+			this->incNumber = 0;
+			this->outNumber = 0;
+			this->reserved = 0;
+			this->commandHead = 0;
+			this->commandTail = 0;
+		}
+#if (UART_HARDWARE != UART_HARDWARE_AVR)
+		hdwSetVectors(USART::index, &Uart::hostInterrupt, this);
+#endif
+		USART::ubrrh() = (uint8_t) (ubrr >> 8);
+		USART::ubrrl() = (uint8_t) ubrr;
+		if constexpr (doubleSpeed) {
+			USART::ucsra() |= 1 << U2X;
+		} else {
+			USART::ucsra() &= ~(1 << U2X);
+		}
+		USART::ucsrc() = frameFormat;
+		USART::ucsrb() = 1 << RXEN | 1 << TXEN | 1 << RXCIE | 1 << TXCIE;
+	}
+
+	/**
+	 * Whether everything queued has left the line
+	 */
+	bool idle() {
+		return (tx.count() == 0) && (!(status & COM_STATUS_TRANSMITTING));
+	}
+
+	/**
+	 * Bytes received (raw port) or commands received (framed port)
+	 */
+	uint16_t available() {
+		if constexpr (framed) {
+			return (uint8_t) (uartLoad(this->commandTail) - this->commandHead);
+		} else {
+			return rx.count();
+		}
+	}
+
+	/**
+	 * Queues the byte for transmission, raw port only
+	 * Returns false if the transmit queue is full
+	 */
+	bool transmit(uint8_t data) {
+		static_assert(!framed, "a framed port transmits commands");
+		if (!tx.push(data)) {
+			return false;
+		}
+		beginTransmit();
+		return true;
+	}
+
+	/**
+	 * Queues as much of the data as the transmit queue holds, raw port only
+	 * Returns the number of bytes queued
+	 */
+	uint16_t transmit(const uint8_t* data, uint16_t length) {
+		static_assert(!framed, "a framed port transmits commands");
+		TxIndex room = tx.space();
+		if (length > room) {
+			length = room;
+		}
+		for (TxIndex i = 0; i < length; i++) {
+			tx.put(i, data[i]);
+		}
+		if (length) {
+			tx.produce(length);
+			beginTransmit();
+		}
+		return length;
+	}
+
+	/**
+	 * Takes the oldest byte received, raw port only
+	 * Returns false if nothing was received
+	 */
+	bool receive(uint8_t& data) {
+		static_assert(!framed, "a framed port receives commands with process()");
+		if (rx.count() == 0) {
+			return false;
+		}
+		data = rx.pop();
+		if constexpr (xonXoff) {
+			updateFlow();
+		}
+		return true;
+	}
+
+	/**
+	 * Queues the command for transmission as a whole, stamped with the outgoing command number
+	 * if it is numbered (COMMAND_IS_NUMBERED), framed port only
+	 * Returns false if the frame does not fit into the transmit queue, nothing was queued then
+	 */
+	bool transmitCommand(uint8_t code, const uint8_t* data = nullptr, uint16_t size = 0) {
+		static_assert(framed, "a raw port transmits bytes");
+		uint8_t header[4];
+		uint8_t headerSize = 0;
+		header[headerSize++] = code;
+		if constexpr (Config::numbering) {
+			header[headerSize++] = this->outNumber;
+		}
+		if (size < COM_LENGTH_EXTENDED) {
+			header[headerSize++] = (uint8_t) size;
+		} else if (size <= 0x7FFF) {
+			header[headerSize++] = COM_LENGTH_EXTENDED | (size & 0x7F);
+			header[headerSize++] = (uint8_t) (size >> 7);
+		} else {
+			return false;
+		}
+		//measure the frame first, it is only written if it fits
+		FrameMeasure measure = { 0 };
+		encodeFrame(measure, header, headerSize, data, size);
+		if (measure.length > tx.space()) {
+			return false;
+		}
+		FrameWriter writer = { &tx, 0 };
+		encodeFrame(writer, header, headerSize, data, size);
+		tx.produce(writer.length);
+		if constexpr (Config::numbering) {
+			if (numbered(code)) {
+				this->outNumber++;
+			}
+		}
+		beginTransmit();
+		return true;
+	}
+
+	/**
+	 * Hands every command received since the last call to handler(const UartCommand&), framed
+	 * port only. With numbering, a numbered command out of sequence is dropped and answered
+	 * with COM_RESYNC_COMMAND_NUMBER, and COM_RESYNC_COMMAND_NUMBER is taken here. The other
+	 * control commands reach the handler. Call it from the main loop.
+	 * Returns the number of commands taken
+	 */
+	template<class Handler>
+	uint8_t process(Handler handler) {
+		static_assert(framed, "a raw port receives bytes with receive()");
+		uint8_t processed = 0;
+		uint8_t head = this->commandHead;
+		while (head != uartLoad(this->commandTail)) {
+			UartQueuedCommand& queued = this->commands[head & commandMask];
+			handle(queued, handler);
+			release(queued.command);
+			head++;
+			uartStore(this->commandHead, head);
+			processed++;
+		}
+		if constexpr (xonXoff) {
+			if (processed) {
+				updateFlow();
+			}
+		}
+		return processed;
+	}
+
+	/**
+	 * Handler of the receive complete vector
+	 */
+	void receiveInterrupt() {
+		uint8_t data = USART::read();
+		if constexpr (xonXoff) {
+			//flow control bytes never reach the queue
+			if (data == FLOW_XOFF) {
+				status |= COM_STATUS_PARTNER_STOPPED;
+				return;
+			}
+			if (data == FLOW_XON) {
+				status &= ~COM_STATUS_PARTNER_STOPPED;
+				USART::ucsrb() |= 1 << UDRIE;
+				return;
+			}
+		}
+		if constexpr (framed) {
+			parse(data);
+		} else {
+			//lost if the queue is full
+			rx.push(data);
+		}
+		if constexpr (xonXoff) {
+			checkFlow();
+		}
+	}
+
+	/**
+	 * Handler of the data register empty vector, refills the transmit buffer while a byte is
+	 * shifted out
+	 */
+	void dataEmptyInterrupt() {
+		if constexpr (xonXoff) {
+			uint8_t flow = flowByte;
+			if (flow) {
+				//flow control goes ahead of the queued data, even while the partner stopped this device
+				flowByte = 0;
+				status |= COM_STATUS_TRANSMITTING;
+				USART::write(flow);
+				return;
+			}
+			if (status & COM_STATUS_PARTNER_STOPPED) {
+				//transmission continues with XON
+				USART::ucsrb() &= ~(1 << UDRIE);
+				return;
+			}
+		}
+		if (tx.count() == 0) {
+			//nothing to transmit now, queuing data enables the interrupt again
+			USART::ucsrb() &= ~(1 << UDRIE);
+			return;
+		}
+		status |= COM_STATUS_TRANSMITTING;
+		USART::write(tx.pop());
+	}
+
+	/**
+	 * Handler of the transmit complete vector, the line went idle
+	 */
+	void transmitCompleteInterrupt() {
+		status &= ~COM_STATUS_TRANSMITTING;
+	}
+
+private:
+#if (UART_HARDWARE != UART_HARDWARE_AVR)
+	/**
+	 * Runs the vectors the host backend dispatches to the port
+	 */
+	static void hostInterrupt(void* context, uint8_t vector) {
+		Uart* port = static_cast<Uart*>(context);
+		switch (vector) {
+		case HOST_VECTOR_RXC:
+			port->receiveInterrupt();
+			break;
+		case HOST_VECTOR_UDRE:
+			port->dataEmptyInterrupt();
+			break;
+		case HOST_VECTOR_TXC:
+			port->transmitCompleteInterrupt();
+			break;
+		}
+	}
+#endif
+
+	void beginTransmit() {
+		USART::ucsrb() |= 1 << UDRIE;
+	}
+
+	/**
+	 * Stops the partner at the high watermark and lets it continue at the low one, as
+	 * UARTcheckFlow(). Runs in the receive interrupt after every byte.
+	 */
+	void checkFlow() {
+		RxIndex count = rx.count();
+		uint16_t occupied = count;
+		uint8_t commands = 0;
+		if constexpr (framed) {
+			//the data of the command being received occupies the queue as well
+			if (this->reserved) {
+				occupied += this->received;
+			}
+			commands = (uint8_t) (uartLoad(this->commandTail) - uartLoad(this->commandHead));
+		}
+		if (status & COM_STATUS_FLOW_STOPPED) {
+			if ((count <= lowWatermark) && ((!framed) || (commands <= Config::commandQueueSize / 2))) {
+				status &= ~COM_STATUS_FLOW_STOPPED;
+				sendFlow(FLOW_XON);
+			}
+		} else if ((occupied >= highWatermark)
+				|| (framed && (commands >= Config::commandQueueSize - 1))) {
+			status |= COM_STATUS_FLOW_STOPPED;
+			sendFlow(FLOW_XOFF);
+		}
+	}
+
+	/**
+	 * Checks the watermarks from the main program once the queues drained. It only drains them,
+	 * so there is nothing to check before the partner was stopped.
+	 */
+	void updateFlow() {
+		if (status & COM_STATUS_FLOW_STOPPED) {
+			UART_CRITICAL_BEGIN();
+			checkFlow();
+			UART_CRITICAL_END();
+		}
+	}
+
+	void sendFlow(uint8_t data) {
+		flowByte = data;
+		USART::ucsrb() |= 1 << UDRIE;
+	}
+
+	static bool numbered(uint8_t code) {
+		return !COM_IS_CONTROL(code) && !COM_IS_URGENT(code);
+	}
+
+	/**
+	 * Counts the encoded bytes of a frame
+	 */
+	struct FrameMeasure {
+		uint32_t length;
+
+		void put(uint8_t) {
+			length++;
+		}
+
+		void patch(uint32_t, uint8_t) {
+		}
+	};
+
+	/**
+	 * Writes the encoded frame past the tail of the transmit queue
+	 */
+	struct FrameWriter {
+		TxRing* ring;
+		TxIndex length;
+
+		void put(uint8_t data) {
+			ring->put(length++, data);
+		}
+
+		void patch(TxIndex offset, uint8_t data) {
+			ring->put(offset, data);
+		}
+	};
+
+	/**
+	 * Encodes the frame byte by byte into the sink: escaped and ended with COM_END, or COBS
+	 * encoded and ended with 0x00. The encoding is the same as writeFrame() of the C layer.
+	 */
+	template<class Sink>
+	static void encodeFrame(Sink& sink, const uint8_t* header, uint8_t headerSize,
+			const uint8_t* data, uint16_t size) {
+		if constexpr (Config::framing == UartFraming::Cobs) {
+			//every run of up to cobsMaxRun non zero bytes is preceded by its length + 1, the
+			//zero following it is implied. The code byte is written once the run ended.
+			decltype(sink.length) code = sink.length;
+			uint8_t run = 0;
+			sink.put(0);
+			for (uint32_t i = 0; i < (uint32_t) headerSize + size; i++) {
+				uint8_t byte = (i < headerSize) ? header[i] : data[i - headerSize];
+				if (run == cobsMaxRun) {
+					//a full run has no implied zero
+					sink.patch(code, cobsMaxRun + 1);
+					code = sink.length;
+					run = 0;
+					sink.put(0);
+				}
+				if (byte == 0) {
+					sink.patch(code, run + 1);
+					code = sink.length;
+					run = 0;
+					sink.put(0);
+				} else {
+					sink.put(byte);
+					run++;
+				}
+			}
+			sink.patch(code, run + 1);
+			sink.put(0x00);
+		} else {
+			for (uint8_t i = 0; i < headerSize; i++) {
+				encodeEscaped(sink, header[i]);
+			}
+			for (uint16_t i = 0; i < size; i++) {
+				encodeEscaped(sink, data[i]);
+			}
+			sink.put(COM_END);
+		}
+	}
+
+	template<class Sink>
+	static void encodeEscaped(Sink& sink, uint8_t data) {
+		if (COM_NEEDS_ESCAPE(data) || (xonXoff && ((data == FLOW_XON) || (data == FLOW_XOFF)))) {
+			sink.put(COM_ESCAPE_CHAR);
+			sink.put(data ^ escapeFlip);
+		} else {
+			sink.put(data);
+		}
+	}
+
+	/**
+	 * Advances the parser with a received byte, as parseCommandByte()
+	 */
+	void parse(uint8_t data) {
+		if constexpr (Config::framing == UartFraming::Cobs) {
+			if (data == 0x00) {
+				uint8_t remaining = this->remaining;
+				this->remaining = 0;
+				this->zero = 0;
+				if (remaining != 0) {
+					//the frame ended within a run
+					this->parseState = parseDrop;
+				}
+				endFrame();
+				return;
+			}
+			if (this->remaining == 0) {
+				//code byte, the previous run ended in a zero if it was not full
+				if (this->zero) {
+					parseFrameByte(0);
+				}
+				this->remaining = data - 1;
+				this->zero = (data != cobsMaxRun + 1);
+				return;
+			}
+			this->remaining--;
+		} else {
+			if (this->escaped) {
+				//literal byte
+				this->escaped = 0;
+				data ^= escapeFlip;
+			} else if (data == COM_ESCAPE_CHAR) {
+				this->escaped = 1;
+				return;
+			} else if (data == COM_END) {
+				endFrame();
+				return;
+			}
+		}
+		parseFrameByte(data);
+	}
+
+	/**
+	 * Advances the parser with a decoded byte of the frame: code, command number (with
+	 * numbering), data length (see COM_LENGTH_EXTENDED) and data
+	 */
+	void parseFrameByte(uint8_t data) {
+		UartCommand& command = this->command;
+		switch (this->parseState) {
+		case parseCode:
+			command.code = data;
+			command.number = 0;
+			this->reserved = 0;
+			this->parseState = Config::numbering ? parseNumber : parseLength;
+			break;
+		case parseNumber:
+			command.number = data;
+			this->parseState = parseLength;
+			break;
+		case parseLength:
+			if (data & COM_LENGTH_EXTENDED) {
+				command.size = data & 0x7F;
+				this->parseState = parseLengthHigh;
+			} else {
+				command.size = data;
+				reserveData();
+			}
+			break;
+		case parseLengthHigh:
+			command.size |= (uint16_t) data << 7;
+			reserveData();
+			break;
+		case parseData:
+			this->target[this->received++] = data;
+			if (this->received == command.size) {
+				this->parseState = parseEnd;
+			}
+			break;
+		case parseEnd:
+			//more data than announced
+			this->parseState = parseDrop;
+			break;
+		default:
+			//the rest of the frame is ignored
+			break;
+		}
+	}
+
+	/**
+	 * Reserves room for the announced data in the receive queue, contiguous so the handler can
+	 * use it in place. If it would wrap the end of the buffer is skipped.
+	 */
+	void reserveData() {
+		uint16_t size = this->command.size;
+		uint8_t* span;
+		RxIndex contiguous = rx.writeSpan(span);
+		this->received = 0;
+		if (size <= contiguous) {
+			this->reserved = size;
+		} else if (size <= (RxIndex) (rx.space() - contiguous)) {
+			//continue at the start of the buffer
+			span = rx.buffer;
+			this->reserved = contiguous + size;
+		} else {
+			this->parseState = parseNoRoom;
+			return;
+		}
+		this->target = span;
+		this->command.data = span;
+		this->parseState = (size == 0) ? parseEnd : parseData;
+	}
+
+	/**
+	 * Ends the frame, a complete command is queued with its data
+	 */
+	void endFrame() {
+		uint8_t state = this->parseState;
+		this->parseState = parseCode;
+		if ((state == parseEnd) && queueCommand()) {
+			//keep the data in the receive queue until the command is processed
+			rx.produce(this->reserved);
+			this->reserved = 0;
+			return;
+		}
+		if constexpr (Config::numbering) {
+			if (((state == parseEnd) || (state == parseNoRoom)) && numbered(this->command.code)) {
+				//the partner counted it, so does the numbering
+				this->lost++;
+			}
+		}
+	}
+
+	bool queueCommand() {
+		uint8_t tail = this->commandTail;
+		if ((uint8_t) (tail - uartLoad(this->commandHead)) == Config::commandQueueSize) {
+			//no room for the command
+			return false;
+		}
+		UartQueuedCommand& queued = this->commands[tail & commandMask];
+		queued.command = this->command;
+		queued.lost = this->lost;
+		this->lost = 0;
+		uartStore(this->commandTail, (uint8_t) (tail + 1));
+		return true;
+	}
+
+	template<class Handler>
+	void handle(UartQueuedCommand& queued, Handler& handler) {
+		const UartCommand& command = queued.command;
+		if constexpr (Config::numbering) {
+			this->incNumber += queued.lost;
+			if (command.code == COM_RESYNC_COMMAND_NUMBER) {
+				//the partner sent its outgoing and incoming command numbers
+				if (command.size > 1) {
+					this->incNumber = command.number;
+					this->outNumber = command.data[1];
+				}
+				return;
+			}
+			if (numbered(command.code) && (command.number != this->incNumber)) {
+				//out of sequence, reply with the numbers of this device
+				uint8_t numbers[2] = { this->outNumber, this->incNumber };
+				transmitCommand(COM_RESYNC_COMMAND_NUMBER, numbers, 2);
+				return;
+			}
+		}
+		handler(command);
+		if constexpr (Config::numbering) {
+			if (numbered(command.code)) {
+				this->incNumber++;
+			}
+		}
+	}
+
+	/**
+	 * Releases the data of the oldest command from the receive queue
+	 */
+	void release(const UartCommand& command) {
+		RxIndex offset = rx.head & RxRing::mask;
+		RxIndex length = command.size;
+		if (command.data != rx.buffer + offset) {
+			//the end of the buffer was skipped
+			length += Config::rxQueueSize - offset;
+		}
+		rx.consume(length);
+	}
+};
+
+#endif /* UART_HPP_ */
@@ -19,13 +19,77 @@
  * 0 - Queues have different length
  * 1 - Queues have same length
  */
+#if (!defined(SYMMETRIC_QUEUE))
 #define SYMMETRIC_QUEUE 1
+#endif
 
 /**
  * If the queue is supposed to be equal for every type, then define the queue size.
+ * Otherwise define the size of the receive and the transmit queue separately.
+ * The sizes should be powers of two, not greater than 128 with 8 bit queue indices
+ * and not greater than 32768 with 16 bit queue indices.
  */
 #if(SYMMETRIC_QUEUE)
-#define QUEUE_SIZE 10
+#if (!defined(QUEUE_SIZE))
+#define QUEUE_SIZE 16
+#endif
+#define RX_QUEUE_SIZE QUEUE_SIZE
+#define TX_QUEUE_SIZE QUEUE_SIZE
+#else
+#if (!defined(RX_QUEUE_SIZE))
+#define RX_QUEUE_SIZE 16
+#endif
+#if (!defined(TX_QUEUE_SIZE))
+#define TX_QUEUE_SIZE 64
+#endif
+#endif
+
+/**
+ * Define the width of the queue indices and of the lengths taken by the bulk functions
+ * 8 - Queues of up to 128 bytes, cheapest on 8 bit parts
+ * 16 - Queues of up to 32768 bytes
+ * Defaults to the narrowest width holding every queue of the build: the receive and transmit
+ * queues, the control and high priority lanes, the window and the gateway queues. It is derived
+ * below, once all of their sizes are known. It does not change the frames on the line, see
+ * COM_LENGTH_EXTENDED.
+ */
+
+/**
+ * ------------------------------------------
+ * Hardware backend settings
+ * ------------------------------------------
+ */
+
+/**
+ * Available hardware backends
+ * UART_HARDWARE_AVR - the on chip USART of the AVR, accessed through <avr/io.h>
+ * UART_HARDWARE_SIM - a cycle approximate simulation of the USART registers for host builds
+ * UART_HARDWARE_POSIX - a tty or pseudo terminal of a POSIX host (Linux), driven by posixPoll()
+ */
+#define UART_HARDWARE_AVR 0
+#define UART_HARDWARE_SIM 1
+#define UART_HARDWARE_POSIX 2
+
+/**
+ * Define the hardware backend the UART layer talks to.
+ * Defaults to the AVR USART when built with avr-gcc and to the simulator otherwise.
+ */
+#if (!defined(UART_HARDWARE))
+#if defined(__AVR__)
+#define UART_HARDWARE UART_HARDWARE_AVR
+#else
+#define UART_HARDWARE UART_HARDWARE_SIM
+#endif
+#endif
+
+/**
+ * Number of USARTs driven at once, up to 4 on the AVR (USART0 to USART3 of the ATmega2560) and
+ * up to 255 on the host backends. Every port has its own context in uartPorts, with its own
+ * queues and state. Port n is USARTn of the part, the only USART on parts with a single one,
+ * or the emulated port n of the host backends.
+ */
+#if (!defined(UART_PORTS))
+#define UART_PORTS 1
 #endif
 
 /**
@@ -34,32 +98,287 @@
  * ------------------------------------
  */
 
-//Constant Values
+/**
+ * Baud rate of UARTsetup()
+ */
+#if (!defined(BAUD_RATE))
 #define BAUD_RATE 9600U
+#endif
+
+/**
+ * Largest error of the baud rate advancedUARTsetup() accepts, in hundredths of a percent.
+ * Both ends together should stay within about 2% for 8 bit characters.
+ */
+#if (!defined(MAX_BAUD_ERROR))
+#define MAX_BAUD_ERROR 200
+#endif
+/**
+ * Room for the data appended to a command byte by byte with addCommandData().
+ * Larger data is given in place with setCommandData(), received data is held in the
+ * receive queue, so RX_QUEUE_SIZE limits the size of the received commands.
+ */
+#if (!defined(COMMAND_DATA_LENGTH))
 #define COMMAND_DATA_LENGTH 4
+#endif
 
 /**
  * Use Command Numbering Scheme
  */
+#if (!defined(USE_COMMAND_NUMBERING))
 #define USE_COMMAND_NUMBERING 1
+#endif
 
 /**
  * Define whether the queuing system should be used or not for communication
  */
+#if (!defined(USE_QUEUE))
 #define USE_QUEUE 1
+#endif
 
 /**
  * Define whether the uart system should be interrupt driven
  * Note: Useful only when Queuing is implemented
  */
+#if (!defined(INTERRUPT_DRIVEN))
 #define INTERRUPT_DRIVEN 1
+#endif
 
 /**
  * Define whether the UART system should be follow a command response model as a slave.
  * The commands are specified in "commands.h" in the root folder and must specify some
  * specific constants.
  */
+#if (!defined(COMMAND_RESPONSE_MODEL))
 #define COMMAND_RESPONSE_MODEL 1
+#endif
+
+/**
+ * Available framings of the commands on the line
+ * FRAMING_ESCAPE - frames end with COM_END, colliding bytes are preceded by COM_ESCAPE_CHAR.
+ *                  Cheap for text like payloads but expands up to 2x for control bytes.
+ * FRAMING_COBS - Consistent Overhead Byte Stuffing, frames end with 0x00 and cost one byte
+ *                per 254 regardless of the payload.
+ */
+#define FRAMING_ESCAPE 0
+#define FRAMING_COBS 1
+
+/**
+ * Define the framing of the commands in the command response model
+ */
+#if (!defined(FRAMING))
+#define FRAMING FRAMING_ESCAPE
+#endif
+
+/**
+ * Define whether the commands carry a CRC-16 CCITT trailer, verified as the bytes arrive.
+ * Frames failing the check are dropped.
+ */
+#if (!defined(USE_CRC))
+#define USE_CRC 0
+#endif
+
+/**
+ * Available CRC implementations
+ * CRC_TABLE - one lookup per byte in a 512 byte table, kept in flash on the AVR
+ * CRC_BITWISE - computed with shifts and xors, no table, for parts short on flash
+ */
+#define CRC_TABLE 0
+#define CRC_BITWISE 1
+
+/**
+ * Define the CRC implementation
+ */
+#if (!defined(CRC_MODE))
+#define CRC_MODE CRC_TABLE
+#endif
+
+/**
+ * Define whether the transmitted commands are kept until the partner acknowledges them, so
+ * several commands are in flight and only the unacknowledged ones are transmitted again.
+ * The partner acknowledges with COM_ACK carrying the next command number it expects.
+ * Requires USE_COMMAND_NUMBERING.
+ */
+#if (!defined(USE_SLIDING_WINDOW))
+#define USE_SLIDING_WINDOW 0
+#endif
+
+/**
+ * Number of commands in flight, a power of two not greater than 128
+ */
+#if (!defined(WINDOW_SIZE))
+#define WINDOW_SIZE 4
+#endif
+
+/**
+ * Bytes kept for the encoded commands in flight, a power of two not greater than QUEUE_MAX_SIZE
+ */
+#if (!defined(WINDOW_BUFFER_SIZE))
+#define WINDOW_BUFFER_SIZE 64
+#endif
+
+/**
+ * Define whether the commands requiring an acknowledgement are transmitted again when it does
+ * not arrive in time: the commands of the sliding window and COM_RESUME. Driven by UARTtick().
+ */
+#if (!defined(USE_RETRANSMIT_TIMER))
+#define USE_RETRANSMIT_TIMER 0
+#endif
+
+/**
+ * Available sources of UARTtick()
+ * TICK_TIMER0 - Timer0 in CTC mode calls UARTtick() of every port from its compare interrupt
+ * TICK_EXTERNAL - the user program calls UARTtick() of each port from a timer of its own
+ */
+#define TICK_TIMER0 0
+#define TICK_EXTERNAL 1
+
+/**
+ * Define the source of UARTtick()
+ */
+#if (!defined(TICK_SOURCE))
+#define TICK_SOURCE TICK_TIMER0
+#endif
+
+/**
+ * Period of UARTtick() in milliseconds
+ */
+#if (!defined(TICK_PERIOD_MS))
+#define TICK_PERIOD_MS 10
+#endif
+
+/**
+ * Ticks until the first retransmission, it should cover the longest frame in both directions
+ * and the time the partner takes to handle it. Doubled after every retransmission up to
+ * RETRANSMIT_MAX_TIMEOUT_TICKS, not greater than 255.
+ */
+#if (!defined(RETRANSMIT_TIMEOUT_TICKS))
+#define RETRANSMIT_TIMEOUT_TICKS 50
+#endif
+#if (!defined(RETRANSMIT_MAX_TIMEOUT_TICKS))
+#define RETRANSMIT_MAX_TIMEOUT_TICKS 200
+#endif
+
+/**
+ * Retransmissions before giving up and calling the failure handler
+ */
+#if (!defined(RETRANSMIT_ATTEMPTS))
+#define RETRANSMIT_ATTEMPTS 5
+#endif
+
+/**
+ * Define where received commands are handled in the command response model
+ * 0 - The receive interrupt runs the message handlers as soon as the command ends. The handlers
+ *     transmit from the interrupt, so every transmission of the main loop keeps the interrupts
+ *     disabled while it encodes its frame (UART_PRODUCER_BEGIN()), delaying the receive
+ *     interrupt by up to a frame of encoding.
+ * 1 - The receive interrupt only enqueues the bytes, UARTprocess() runs the message
+ *     handlers from the main loop, keeping the interrupt short regardless of handler cost.
+ *     The main loop is then the only producer of the transmit queue and the window.
+ */
+#if (!defined(DEFERRED_DISPATCH))
+#define DEFERRED_DISPATCH 1
+#endif
+
+/**
+ * Number of received commands that can wait for their message handler, a power of two
+ */
+#if (!defined(COMMAND_QUEUE_SIZE))
+#define COMMAND_QUEUE_SIZE 4
+#endif
+
+/**
+ * Bytes kept for the encoded control commands (COM_ACK, COM_WAIT, COM_RESUME and
+ * COM_RESYNC_COMMAND_NUMBER). They are transmitted ahead of the transmit queue, between two
+ * frames. A power of two not greater than QUEUE_MAX_SIZE.
+ */
+#if (!defined(CONTROL_QUEUE_SIZE))
+#define CONTROL_QUEUE_SIZE 32
+#endif
+
+/**
+ * Bytes kept for the encoded urgent commands (COM_IS_URGENT), the high priority class.
+ * They are transmitted after the control commands and ahead of the transmit queue, between two
+ * frames. A power of two not greater than QUEUE_MAX_SIZE.
+ */
+#if (!defined(HIGH_QUEUE_SIZE))
+#define HIGH_QUEUE_SIZE 32
+#endif
+
+/**
+ * ------------------------------------------
+ * Flow control settings
+ * ------------------------------------------
+ */
+
+/**
+ * Available flow control of the receive queue
+ * FLOW_COMMANDS - COM_WAIT and COM_RESUME queued like any other command.
+ *                 Command response model only, nothing stops the partner otherwise.
+ * FLOW_RTS_CTS - RTS is raised to stop the partner, the transmitter pauses while the
+ *                partner raises CTS. CTS has to be wired to INT1.
+ * FLOW_XON_XOFF - FLOW_XOFF and FLOW_XON single bytes. In the command response model they
+ *                 are escaped inside frames, otherwise the data must not contain them.
+ * Every mode stops the partner at RX_HIGH_WATERMARK, before anything is lost.
+ */
+#define FLOW_COMMANDS 0
+#define FLOW_RTS_CTS 1
+#define FLOW_XON_XOFF 2
+
+/**
+ * Define the flow control
+ */
+#if (!defined(FLOW_CONTROL))
+#define FLOW_CONTROL FLOW_COMMANDS
+#endif
+
+/**
+ * Time the partner takes to stop transmitting once it sees RTS, XOFF or COM_WAIT, in microseconds
+ */
+#if (!defined(PARTNER_REACTION_US))
+#define PARTNER_REACTION_US 1000UL
+#endif
+
+/**
+ * Bytes of a frame of this device that COM_WAIT may have to wait for, it goes out at the next
+ * frame boundary. Raise it to the longest frame transmitted while receiving with FLOW_COMMANDS.
+ */
+#if (!defined(TX_FRAME_BYTES))
+#define TX_FRAME_BYTES 1
+#endif
+
+/**
+ * Bytes in the receive queue at which the partner is stopped (including the data of the command
+ * being received) and at which it may continue, at BAUD_RATE. By default the room above the high
+ * watermark holds what the partner sends until it has stopped, FLOW_HEADROOM(BAUD_RATE).
+ * advancedUARTsetup() moves the high watermark by the change of the headroom at its baud rate
+ * and keeps the ratio of the low one.
+ */
+#if (!defined(RX_HIGH_WATERMARK))
+#define RX_HIGH_WATERMARK (RX_QUEUE_SIZE - FLOW_HEADROOM(BAUD_RATE))
+#endif
+#if (!defined(RX_LOW_WATERMARK))
+#define RX_LOW_WATERMARK (RX_HIGH_WATERMARK / 2)
+#endif
+
+/**
+ * Pins of RTS/CTS, both active low. CTS has to be the INT1 pin (PD3 on the ATmega16/32 and the
+ * ATmega164/324/644/1284).
+ */
+#if (!defined(FLOW_RTS_PORT))
+#define FLOW_RTS_PORT PORTD
+#define FLOW_RTS_DDR DDRD
+#define FLOW_RTS_BIT 4
+#endif
+#if (!defined(FLOW_CTS_PIN))
+#define FLOW_CTS_PIN PIND
+#define FLOW_CTS_BIT 3
+#endif
+
+/**
+ * Bytes of XON/XOFF
+ */
+#define FLOW_XON 0x11
+#define FLOW_XOFF 0x13
 
 /**
  * ONLY SLAVE SUPPORTED TILL NOW
@@ -67,16 +386,195 @@
  */
 #define MODE_SLAVE 1
 
+/**
+ * ------------------------------------------
+ * Host gateway settings (UART_HARDWARE_POSIX)
+ * ------------------------------------------
+ */
+
+/**
+ * Share the ports out among worker threads, each running the event loop of its own ports and
+ * exchanging the commands with the application through lock free queues (uart_gateway.h)
+ */
+#if (!defined(USE_GATEWAY))
+#define USE_GATEWAY 0
+#endif
+
+/**
+ * Maximum number of worker threads
+ */
+#if (!defined(GATEWAY_MAX_WORKERS))
+#define GATEWAY_MAX_WORKERS 16
+#endif
+
+/**
+ * Bytes of the queues between a worker and the application, one per direction, each command
+ * takes its data and a header of 4 bytes. A power of two not greater than QUEUE_MAX_SIZE.
+ */
+#if (!defined(GATEWAY_QUEUE_SIZE))
+#define GATEWAY_QUEUE_SIZE 16384
+#endif
+
 /**
  * -------------------------------------------------------------------------
  * DO NOT MODIFY ANYTHING BELOW THIS IF YOU ARE UNCERTAIN ABOUT THE RESULTS.
  * -------------------------------------------------------------------------
  */
 
+#if (!defined(QUEUE_INDEX_BITS))
+#if ((RX_QUEUE_SIZE > 128) || (TX_QUEUE_SIZE > 128) \
+		|| (COMMAND_RESPONSE_MODEL && ((CONTROL_QUEUE_SIZE > 128) || (HIGH_QUEUE_SIZE > 128))) \
+		|| (USE_SLIDING_WINDOW && (WINDOW_BUFFER_SIZE > 128)) \
+		|| (USE_GATEWAY && (GATEWAY_QUEUE_SIZE > 128)))
+#define QUEUE_INDEX_BITS 16
+#else
+#define QUEUE_INDEX_BITS 8
+#endif
+#endif
+
+#if (QUEUE_INDEX_BITS == 8)
+#define QUEUE_MAX_SIZE 128
+#elif (QUEUE_INDEX_BITS == 16)
+#define QUEUE_MAX_SIZE 32768U
+#else
+#error 'QUEUE_INDEX_BITS should be 8 or 16'
+#endif
+#if ((RX_QUEUE_SIZE & (RX_QUEUE_SIZE - 1)) || (RX_QUEUE_SIZE > QUEUE_MAX_SIZE))
+#error 'RX_QUEUE_SIZE should be a power of two not greater than QUEUE_MAX_SIZE'
+#endif
+#if ((TX_QUEUE_SIZE & (TX_QUEUE_SIZE - 1)) || (TX_QUEUE_SIZE > QUEUE_MAX_SIZE))
+#error 'TX_QUEUE_SIZE should be a power of two not greater than QUEUE_MAX_SIZE'
+#endif
+
+#if ((UART_PORTS < 1) || (UART_PORTS > 255))
+#error 'UART_PORTS should be 1 to 255'
+#endif
+#if ((UART_HARDWARE == UART_HARDWARE_AVR) && (UART_PORTS > 4))
+#error 'UART_PORTS should be 1 to 4 on the AVR'
+#endif
+
+#if ((FRAMING != FRAMING_ESCAPE) && (FRAMING != FRAMING_COBS))
+#error 'FRAMING should be FRAMING_ESCAPE or FRAMING_COBS'
+#endif
+
+#if ((CRC_MODE != CRC_TABLE) && (CRC_MODE != CRC_BITWISE))
+#error 'CRC_MODE should be CRC_TABLE or CRC_BITWISE'
+#endif
+
+#if (COMMAND_RESPONSE_MODEL && USE_SLIDING_WINDOW)
+#if (!USE_COMMAND_NUMBERING)
+#error 'USE_SLIDING_WINDOW requires USE_COMMAND_NUMBERING'
+#endif
+#if ((WINDOW_SIZE & (WINDOW_SIZE - 1)) || (WINDOW_SIZE > 128))
+#error 'WINDOW_SIZE should be a power of two not greater than 128'
+#endif
+#if ((WINDOW_BUFFER_SIZE & (WINDOW_BUFFER_SIZE - 1)) || (WINDOW_BUFFER_SIZE > QUEUE_MAX_SIZE))
+#error 'WINDOW_BUFFER_SIZE should be a power of two not greater than QUEUE_MAX_SIZE'
+#endif
+#endif
+
+#if (COMMAND_RESPONSE_MODEL && USE_RETRANSMIT_TIMER)
+#if ((RETRANSMIT_TIMEOUT_TICKS < 1) || (RETRANSMIT_TIMEOUT_TICKS > RETRANSMIT_MAX_TIMEOUT_TICKS) \
+		|| (RETRANSMIT_MAX_TIMEOUT_TICKS > 255))
+#error 'RETRANSMIT_TIMEOUT_TICKS should be in 1 to RETRANSMIT_MAX_TIMEOUT_TICKS, not greater than 255'
+#endif
+#if ((TICK_SOURCE != TICK_TIMER0) && (TICK_SOURCE != TICK_EXTERNAL))
+#error 'TICK_SOURCE should be TICK_TIMER0 or TICK_EXTERNAL'
+#endif
+#endif
+
+/**
+ * Timer0 generates the ticks, with a prescaler of 1024
+ */
+#define USE_TICK_TIMER0 (COMMAND_RESPONSE_MODEL && USE_RETRANSMIT_TIMER && (TICK_SOURCE == TICK_TIMER0))
+#if USE_TICK_TIMER0
+#define TIMER0_COMPARE_VAL ((F_CPU / 1024UL) * TICK_PERIOD_MS / 1000UL - 1)
+#endif
+
+/**
+ * The flow control stops the partner at the watermarks, with RTS or XOFF (USE_FLOW_SIGNALS)
+ * or with COM_WAIT in the command response model
+ */
+#define USE_FLOW_SIGNALS (FLOW_CONTROL != FLOW_COMMANDS)
+#define USE_FLOW_WATERMARKS (USE_FLOW_SIGNALS || COMMAND_RESPONSE_MODEL)
+
+/**
+ * Bytes the partner transmits between the decision to stop it and its stop: the partner
+ * reaction at the baud rate (10 bits per byte) and the bytes already in its transmitter (2),
+ * plus the byte in this transmitter and XOFF or COM_WAIT (without escapes) ahead of it.
+ * COM_WAIT also waits for the rest of the frame in progress (TX_FRAME_BYTES).
+ */
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+#define FLOW_SIGNAL_BYTES 2
+#elif (FLOW_CONTROL == FLOW_XON_XOFF)
+#define FLOW_SIGNAL_BYTES (2 + 2)
+#else
+#define FLOW_SIGNAL_BYTES (2 + 1 + 1 + (USE_COMMAND_NUMBERING * 3) + 1 + (USE_CRC * 2) \
+		+ TX_FRAME_BYTES)
+#endif
+#define FLOW_HEADROOM(baudRate) (((((baudRate) / 10UL) * PARTNER_REACTION_US + 999999UL) \
+		/ 1000000UL) + FLOW_SIGNAL_BYTES)
+
+#if ((FLOW_CONTROL != FLOW_COMMANDS) && (FLOW_CONTROL != FLOW_RTS_CTS) \
+		&& (FLOW_CONTROL != FLOW_XON_XOFF))
+#error 'FLOW_CONTROL should be FLOW_COMMANDS, FLOW_RTS_CTS or FLOW_XON_XOFF'
+#endif
+#if ((FLOW_CONTROL == FLOW_RTS_CTS) && (UART_PORTS != 1))
+#error 'FLOW_RTS_CTS supports a single port, CTS has to be wired to INT1'
+#endif
+#if ((UART_HARDWARE == UART_HARDWARE_POSIX) && (FLOW_CONTROL == FLOW_RTS_CTS))
+#error 'FLOW_RTS_CTS is not available with UART_HARDWARE_POSIX, use FLOW_XON_XOFF or FLOW_COMMANDS'
+#endif
+#if (USE_FLOW_SIGNALS && (!(USE_QUEUE && INTERRUPT_DRIVEN)))
+#error 'FLOW_RTS_CTS and FLOW_XON_XOFF require USE_QUEUE and INTERRUPT_DRIVEN'
+#endif
+#if (USE_FLOW_WATERMARKS && USE_QUEUE)
+#if ((RX_LOW_WATERMARK >= RX_HIGH_WATERMARK) || (RX_HIGH_WATERMARK > RX_QUEUE_SIZE) \
+		|| (RX_HIGH_WATERMARK <= 0))
+#error 'Watermarks out of order, RX_QUEUE_SIZE may be too small for FLOW_HEADROOM at this BAUD_RATE and PARTNER_REACTION_US'
+#endif
+#endif
+#if (COMMAND_RESPONSE_MODEL && (FLOW_CONTROL == FLOW_XON_XOFF) && (FRAMING != FRAMING_ESCAPE))
+#error 'FLOW_XON_XOFF requires FRAMING_ESCAPE, COBS frames can contain XON and XOFF'
+#endif
+
+#if (COMMAND_QUEUE_SIZE & (COMMAND_QUEUE_SIZE - 1))
+#error 'COMMAND_QUEUE_SIZE should be a power of two'
+#endif
+#if ((CONTROL_QUEUE_SIZE & (CONTROL_QUEUE_SIZE - 1)) || (CONTROL_QUEUE_SIZE > QUEUE_MAX_SIZE))
+#error 'CONTROL_QUEUE_SIZE should be a power of two not greater than QUEUE_MAX_SIZE'
+#endif
+#if ((HIGH_QUEUE_SIZE & (HIGH_QUEUE_SIZE - 1)) || (HIGH_QUEUE_SIZE > QUEUE_MAX_SIZE))
+#error 'HIGH_QUEUE_SIZE should be a power of two not greater than QUEUE_MAX_SIZE'
+#endif
+
+#if USE_GATEWAY
+#if (UART_HARDWARE != UART_HARDWARE_POSIX)
+#error 'USE_GATEWAY requires UART_HARDWARE_POSIX'
+#endif
+#if (!(COMMAND_RESPONSE_MODEL && DEFERRED_DISPATCH))
+#error 'USE_GATEWAY requires COMMAND_RESPONSE_MODEL and DEFERRED_DISPATCH'
+#endif
+#if (USE_RETRANSMIT_TIMER && (TICK_SOURCE != TICK_EXTERNAL))
+#error 'USE_GATEWAY requires TICK_EXTERNAL, every worker ticks its own ports'
+#endif
+#if ((GATEWAY_QUEUE_SIZE & (GATEWAY_QUEUE_SIZE - 1)) || (GATEWAY_QUEUE_SIZE > QUEUE_MAX_SIZE) \
+		|| (GATEWAY_QUEUE_SIZE < RX_QUEUE_SIZE + 4))
+#error 'GATEWAY_QUEUE_SIZE should be a power of two not greater than QUEUE_MAX_SIZE, holding a command of RX_QUEUE_SIZE'
+#endif
+#if ((GATEWAY_MAX_WORKERS < 1) || (GATEWAY_MAX_WORKERS > 255))
+#error 'GATEWAY_MAX_WORKERS should be 1 to 255'
+#endif
+#endif
+
 #if (!defined(BAUD_RATE))
 #error 'BAUD Rate should be defined'
 #else
-#define UBRR_VAL (uint16_t)((F_CPU/16)/BAUD_RATE-1)
+/**
+ * UBRR of BAUD_RATE in normal and double speed mode (U2X), rounded to the closest rate
+ */
+#define UBRR_VAL ((F_CPU + 8UL * BAUD_RATE) / (16UL * BAUD_RATE) - 1)
+#define UBRR_VAL_U2X ((F_CPU + 4UL * BAUD_RATE) / (8UL * BAUD_RATE) - 1)
 #endif
 
 /**
@@ -118,6 +616,16 @@
  */
 #define COM_STATUS_TRANSMITTING 0x10
 
+/**
+ * The partner was stopped by RTS or XOFF because the receive queue reached RX_HIGH_WATERMARK
+ */
+#define COM_STATUS_FLOW_STOPPED 0x20
+
+/**
+ * The partner sent XOFF, nothing but XON and XOFF is transmitted until it sends XON
+ */
+#define COM_STATUS_PARTNER_STOPPED 0x40
+
 #if USE_QUEUE
 
 /**
@@ -159,6 +667,20 @@
  */
 #define PROC_STATUS_COMPLETED 0x04
 
+/**
+ * The message handler has completed a control command, which takes no command number
+ */
+#define PROC_STATUS_CONTROL_COMPLETED 0x05
+
+/**
+ * Reasons passed to the failure handler
+ * COM_FAILURE_WINDOW - the commands in flight were never acknowledged, or the partner resynced
+ *     past them, and are dropped
+ * COM_FAILURE_RESUME - the partner never acknowledged COM_RESUME
+ */
+#define COM_FAILURE_WINDOW 0x01
+#define COM_FAILURE_RESUME 0x02
+
 #endif
 
 #endif /* CONFIG_H_ */
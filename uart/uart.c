@@ -10,24 +10,76 @@
 #include "../commands.h"
 #endif
 
-#if COMMAND_RESPONSE_MODEL
+struct UART uartPorts[UART_PORTS];
+
 /**
- * A custom message handler
+ * Sets the port up at BAUD_RATE, 8N1, leaving the USART disabled
  */
-void (*handler)(struct Command*);
+static void setupPort(struct UART* uart
+#if COMMAND_RESPONSE_MODEL
+		, void (*messageHandler)(struct UART*, struct Command*)
+#endif
+#if (INTERRUPT_DRIVEN && (!USE_QUEUE))
+		, void (*rxcCompleteHandler)(struct UART*, uint8_t),
+		void (*txcCompleteHandler)(struct UART*)
+#endif
+#if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
+		, void (*rxcQueueFullHandler)(struct UART*),
+		void (*txcCompleteHandler)(struct UART*)
+#endif
+		) {
+	//setup hardware first, the USART is enabled once the format is final
+	hdwUARTSetup(uart);
+
+#if INTERRUPT_DRIVEN
+	uart->status = 0;
 #endif
 
-/**
- * Required callbacks if not using queues
- */
+	//setup queue if queue is to be used
+#if USE_QUEUE
+	queueInit(&uart->rxQueue);
+	queueInit(&uart->txQueue);
+
+	//set the message handler if required
+#if COMMAND_RESPONSE_MODEL
+	uart->handler = messageHandler;
+	queueIndexInit(&uart->commandQueue.index);
+#if (USE_COMMAND_NUMBERING && (!USE_SLIDING_WINDOW))
+	uart->commandQueue.pendingLost = 0;
+#endif
+	initCommandParser(&uart->commandParser);
+	queueInit(&uart->controlQueue);
+	queueInit(&uart->highQueue);
+#if USE_SLIDING_WINDOW
+	initCommandWindow(&uart->commandWindow);
+	uart->acknowledgePending = 0;
+#endif
+#if USE_RETRANSMIT_TIMER
+	initCommandTimer(&uart->resumeTimer);
+	uart->failureHandler = 0;
+#endif
+#if USE_TICK_TIMER0
+	hdwTimerSetup();
+#endif
+
+#if USE_COMMAND_NUMBERING
+	uart->incCommandNumber = 0;
+	uart->outCommandNumber = 0;
+#endif
+#endif
+#endif
+
+	//enable callback methods if there is interrupt enabled but not queuing is used
+	//or if queue is used but not command response model
 #if (INTERRUPT_DRIVEN && (!USE_QUEUE))
-void (*rxcHandler)(uint8_t);
-void (*txcHandler)();
+	uart->rxcHandler = rxcCompleteHandler;
+	uart->txcHandler = txcCompleteHandler;
 #endif
 #if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
-void (*rxcHandler)();
-void (*txcHandler)();
+	uart->rxcHandler = rxcQueueFullHandler;
+	uart->txcHandler = txcCompleteHandler;
 #endif
+}
 
 /**
  * Simple UART Setup:
@@ -36,96 +88,143 @@ void (*txcHandler)();
  * Stop bits: 1
  * Frame Size: 8 bits
  */
-void UARTsetup(
+void UARTsetup(struct UART* uart
 #if COMMAND_RESPONSE_MODEL
-		void (*messageHandler)(struct Command*)
+		, void (*messageHandler)(struct UART*, struct Command*)
 #endif
 #if (INTERRUPT_DRIVEN && (!USE_QUEUE))
-		void (*rxcCompleteHandler)(uint8_t),
-		void (*txcCompleteHandler)()
+		, void (*rxcCompleteHandler)(struct UART*, uint8_t),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 #if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
-		void (*rxcQueueFullHandler)(),
-		void (*txcCompleteHandler)()
+		, void (*rxcQueueFullHandler)(struct UART*),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 		) {
-	//setup hardware first
-	hdwUARTSetup();
-
-	//setup queue if queue is to be used
-#if USE_QUEUE
-	queueInit(&rxQueue);
-	queueInit(&txQueue);
-
-	//set the message handler if required
+	setupPort(uart
 #if COMMAND_RESPONSE_MODEL
-	status = 0;
-	handler = messageHandler;
-
-#if USE_COMMAND_NUMBERING
-	incCommandNumber = 0;
-	outCommandNumber = 0;
-#endif
-#endif
+			, messageHandler
 #endif
-
-	//enable callback methods if there is interrupt enabled but not queuing is used
-	//or if queue is used but not command response model
 #if (INTERRUPT_DRIVEN && (!USE_QUEUE))
-	rxcHandler = rxcCompleteHandler;
-	txcHandler = txcCompleteHandler;
+			, rxcCompleteHandler, txcCompleteHandler
 #endif
 #if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
-	rxcHandler = rxcQueueFullHandler;
-	txcHandler = txcCompleteHandler;
+			, rxcQueueFullHandler, txcCompleteHandler
+#endif
+			);
+#if USE_FLOW_WATERMARKS
+	uart->rxHighWatermark = RX_HIGH_WATERMARK;
+	uart->rxLowWatermark = RX_LOW_WATERMARK;
 #endif
+	hdwUARTEnable(uart);
 }
 
 /**
- * Advanced UART setup
+ * Advanced UART setup:
+ * baud rate : baudRate, in the speed modes allowed by speed
+ * Parity: parity
+ * Stop bits: stopBits
+ * Frame Size: frameSize
  */
-void advancedUARTsetup(
+int16_t advancedUARTsetup(struct UART* uart, uint32_t baudRate, uint8_t parity, uint8_t stopBits,
+		uint8_t frameSize, uint8_t speed
 #if COMMAND_RESPONSE_MODEL
-		void (*messageHandler)(struct Command*)
+		, void (*messageHandler)(struct UART*, struct Command*)
 #endif
 #if (INTERRUPT_DRIVEN && (!USE_QUEUE))
-		void (*rxcCompleteHandler)(uint8_t),
-		void (*txcCompleteHandler)()
+		, void (*rxcCompleteHandler)(struct UART*, uint8_t),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 #if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
-		void (*rxcCompleteHandler)(),
-		void (*txcCompleteHandler)()
+		, void (*rxcQueueFullHandler)(struct UART*),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 		) {
-	//TODO implement this
+	//reject what the port can not run before touching it
+	if ((!baudRate) || (parity == 1) || (parity > UART_PARITY_ODD) || (stopBits < 1)
+			|| (stopBits > 2) || (frameSize < 5) || (frameSize > 8) || (speed > UART_SPEED_AUTO)) {
+		return UART_SETUP_INVALID;
+	}
+#if COMMAND_RESPONSE_MODEL
+	//the frames carry 8 bit data
+	if (frameSize != 8) {
+		return UART_SETUP_INVALID;
+	}
+#endif
+	uint16_t baudSetting;
+	int16_t error = hdwBaudSetting(baudRate, speed, &baudSetting);
+	if ((error == UART_SETUP_INVALID) || (error > MAX_BAUD_ERROR) || (error < -MAX_BAUD_ERROR)) {
+		return UART_SETUP_INVALID;
+	}
+#if USE_FLOW_WATERMARKS
+	//the room above the high watermark holds what the partner sends at this baud rate until it
+	//has stopped, the margin over the headroom at BAUD_RATE is kept
+	int32_t highWatermark = (int32_t) RX_HIGH_WATERMARK + (int32_t) FLOW_HEADROOM(BAUD_RATE)
+			- (int32_t) FLOW_HEADROOM(baudRate);
+	int32_t lowWatermark = highWatermark * RX_LOW_WATERMARK / RX_HIGH_WATERMARK;
+	if ((highWatermark <= 0) || (highWatermark > RX_QUEUE_SIZE) || (lowWatermark >= highWatermark)) {
+		return UART_SETUP_INVALID;
+	}
+#endif
+
+	setupPort(uart
+#if COMMAND_RESPONSE_MODEL
+			, messageHandler
+#endif
+#if (INTERRUPT_DRIVEN && (!USE_QUEUE))
+			, rxcCompleteHandler, txcCompleteHandler
+#endif
+#if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
+			, rxcQueueFullHandler, txcCompleteHandler
+#endif
+			);
+#if USE_FLOW_WATERMARKS
+	uart->rxHighWatermark = (QueueSize) highWatermark;
+	uart->rxLowWatermark = (QueueSize) lowWatermark;
+#endif
+
+	//switch the line over before the USART starts, nothing is transmitted or received at BAUD_RATE
+	hdwUARTFormat(uart, baudSetting, parity, stopBits, frameSize);
+	hdwUARTEnable(uart);
+	return error;
 }
 
 /**
  * Check if the UART is busy (Software implementation)
  * returns an uint8_t that determines whether both rx and tx are busy or not
  */
-uint8_t UARTstatus() {
+uint8_t UARTstatus(struct UART* uart) {
 	uint8_t result = 0;
 
 	//check hardware status
-	result = hdwIsBusyUART();
+	result = hdwIsBusyUART(uart);
 
 #if USE_QUEUE
 
 	//now check queue status
 	//check tx queue is empty or full
-	if (txQueue.count == 0) {
+	if (queueCount(&uart->txQueue) == 0) {
 		result |= TX_QUEUE_EMPTY;
-	} else if (txQueue.size == txQueue.count) {
+	} else if (queueSpace(&uart->txQueue) == 0) {
 		result |= TX_QUEUE_FULL;
 	}
 
 	//check rx queue is empty or full
-	if (rxQueue.count == 0) {
+#if COMMAND_RESPONSE_MODEL
+	//the received bytes are parsed straight into the command queue
+	QueueSize commands = queueIndexCount(&uart->commandQueue.index);
+	if (commands == 0) {
+		result |= RX_QUEUE_EMPTY;
+	} else if (commands == COMMAND_QUEUE_SIZE) {
+		result |= RX_QUEUE_FULL;
+	}
+#else
+	if (queueCount(&uart->rxQueue) == 0) {
 		result |= RX_QUEUE_EMPTY;
-	} else if (rxQueue.size == rxQueue.count) {
+	} else if (queueSpace(&uart->rxQueue) == 0) {
 		result |= RX_QUEUE_FULL;
 	}
+#endif
 
 #endif
 
@@ -135,29 +234,27 @@ uint8_t UARTstatus() {
 /**
  * Enqueues a byte of data for transmission into the UART stream
  */
-uint8_t UARTtransmit(uint8_t data) {
+uint8_t UARTtransmit(struct UART* uart, uint8_t data) {
 #if USE_QUEUE
-#if USE_COMMAND_NUMBERING
-	if(status & COM_STATUS_SELF_WAITING){
+#if COMMAND_RESPONSE_MODEL
+	if(uart->status & COM_STATUS_SELF_WAITING){
 		//this device is waiting and not transmitting
 		return 0;
 	}
 #endif
-	uint8_t uartStatus = UARTstatus();
-	if (!(uartStatus & TX_QUEUE_FULL)) {
-		//tx queue is not full
-		enqueue(&txQueue, data);
-		if (!(uartStatus & TX_BUSY)) {
-			//tx is not busy
-			hdwTransmitUART(dequeue(&txQueue));
-		}
+	UART_PRODUCER_BEGIN();
+	uint8_t queued = enqueue(&uart->txQueue, data);
+	UART_PRODUCER_END();
+	if (queued) {
+		//tx queue was not full
+		UARTbeginTransmit(uart);
 		//to denote that 1 byte was enqueued for writing
 		return 1;
 	}
 	//to denote that 0 bytes were enqueued for writing
 	return 0;
 #else
-	hdwTransmitUART(data);
+	hdwTransmitUART(uart, data);
 	return 1;
 #endif
 }
@@ -167,11 +264,18 @@ uint8_t UARTtransmit(uint8_t data) {
  * It is wise to first check whether the Receive Queue is empty or not before gathering data
  * Use: UARTisBusy();
  */
-uint8_t UARTreceive() {
-#if USE_QUEUE
-	return dequeue(&rxQueue);
+uint8_t UARTreceive(struct UART* uart) {
+#if (USE_QUEUE && INTERRUPT_DRIVEN)
+#if USE_FLOW_WATERMARKS
+	uint8_t data = dequeue(&uart->rxQueue);
+	UARTcheckFlow(uart);
+	return data;
+#else
+	return dequeue(&uart->rxQueue);
+#endif
 #else
-	return hdwReceiveUART();
+	//nothing fills the rx queue when polling, read the hardware directly
+	return hdwReceiveUART(uart);
 #endif
 }
 /**
@@ -184,75 +288,362 @@ uint8_t UARTreceive() {
  * If the length is greater than the available queue size the data is not queued up
  * and the number of bytes written is returned
  */
-uint8_t UARTbulkTransmit(uint8_t* data, uint8_t start, uint8_t length) {
-	uint8_t size = txQueue.size - txQueue.count;
-	//check if the queue size is greater or smaller than the length of data
-	if (size > length) {
-		//the size of queue is greater, soo, we limit the size
-		size = length;
-	}
-	//enqueue the data into the buffer from start till size
-	for (uint8_t i = start; i < (start + size); i++) {
-		enqueue(&txQueue, data[i]);
-	}
+QueueSize UARTbulkTransmit(struct UART* uart, uint8_t* data, QueueSize start, QueueSize length) {
+	//enqueue as much of the data as the queue can hold
+	UART_PRODUCER_BEGIN();
+	QueueSize size = enqueueBlock(&uart->txQueue, data + start, length);
+	UART_PRODUCER_END();
 	//check if there is data to be transmitted and whether the data is already being transmitted or not
-	if ((!(UARTstatus() & TX_BUSY)) && (size > 0)) {
-		//tx not initiated and there is data to be transmitted start transmission
-		hdwTransmitUART(dequeue(&txQueue));
+	if (size > 0) {
+		//start transmission if it was not initiated
+		UARTbeginTransmit(uart);
 	}
 	return size;
 }
 
+#if USE_FLOW_WATERMARKS
+
+#if (!USE_FLOW_SIGNALS)
+static uint8_t transmitWait(struct UART* uart);
+static uint8_t transmitResume(struct UART* uart);
+#endif
+
+/**
+ * Compares the receive queue against the watermarks. Runs after every received byte as well,
+ * so a decision overtaken by the receive interrupt is corrected with the next byte, and a
+ * COM_WAIT or COM_RESUME that found the control lane full is tried again.
+ */
+void UARTcheckFlow(struct UART* uart) {
+	QueueSize count = queueCount(&uart->rxQueue);
+	QueueSize occupied = count;
+#if COMMAND_RESPONSE_MODEL
+	//the data of the command being received occupies the queue as well, but it is only released
+	//once the partner finishes it. The command queue fills up too.
+	if (uart->commandParser.reserved) {
+		occupied += uart->commandParser.received;
+	}
+	QueueSize commands = queueIndexCount(&uart->commandQueue.index);
+#endif
+	if (uart->status & COM_STATUS_FLOW_STOPPED) {
+		if ((count <= uart->rxLowWatermark)
+#if COMMAND_RESPONSE_MODEL
+				&& (commands <= COMMAND_QUEUE_SIZE / 2)
+#endif
+				) {
+#if USE_FLOW_SIGNALS
+			hdwFlowStart(uart);
+#else
+			if (!transmitResume(uart)) {
+				return;
+			}
+#endif
+			uart->status &= ~COM_STATUS_FLOW_STOPPED;
+		}
+	} else if ((occupied >= uart->rxHighWatermark)
+#if COMMAND_RESPONSE_MODEL
+			|| (commands >= COMMAND_QUEUE_SIZE - 1)
+#endif
+			) {
+#if USE_FLOW_SIGNALS
+		hdwFlowStop(uart);
+#else
+		if (!transmitWait(uart)) {
+			return;
+		}
+#endif
+		uart->status |= COM_STATUS_FLOW_STOPPED;
+	}
+}
+
+#endif
+
 /**
  * Initiate transmission the data from the queue.
  */
-void UARTbeginTransmit() {
-	uint8_t uartStatus = UARTstatus();
-	if ((!(uartStatus & TX_BUSY)) && (txQueue.count != 0)) {
+void UARTbeginTransmit(struct UART* uart) {
+#if COMMAND_RESPONSE_MODEL
+	if ((queueCount(&uart->txQueue) != 0) || (queueCount(&uart->controlQueue) != 0)
+			|| (queueCount(&uart->highQueue) != 0)) {
+		//the transmit interrupt picks the frame, the highest class goes first
+		hdwBeginTransmit(uart);
+	}
+#elif INTERRUPT_DRIVEN
+	if (queueCount(&uart->txQueue) != 0) {
+		//the UDRE interrupt drains the queue, even while the last byte is still shifted out
+		hdwBeginTransmit(uart);
+	}
+#else
+	uint8_t uartStatus = UARTstatus(uart);
+	if ((!(uartStatus & TX_BUSY)) && (queueCount(&uart->txQueue) != 0)) {
 		//the transmitter is not busy and there is data to be transmitted
-		hdwTransmitUART(dequeue(&txQueue));
+		hdwTransmitUART(uart, dequeue(&uart->txQueue));
 	}
+#endif
 }
 
 /**
  * Builds the queue but does not transmit.
  * Returns whether the data was written or not
  */
-uint8_t UARTbuildTransmitQueue(uint8_t data) {
-	if (txQueue.count != txQueue.size) {
-		//tx queue is not full
-		enqueue(&txQueue, data);
+uint8_t UARTbuildTransmitQueue(struct UART* uart, uint8_t data) {
+	return enqueue(&uart->txQueue, data);
+}
+
+/**
+ * Command Response Model should use a default message handler
+ */
+#if COMMAND_RESPONSE_MODEL
+
+/**
+ * Queues a received command, copying it out of the parser. Its data stays in the receive queue.
+ */
+uint8_t UARTqueueCommand(struct UART* uart, struct Command* command) {
+	QueueSize tail = uart->commandQueue.index.tail;
+	if ((QueueSize) (tail - QUEUE_LOAD(uart->commandQueue.index.head)) == COMMAND_QUEUE_SIZE) {
+		//no room for the command
+		return 0;
+	}
+	uart->commandQueue.commands[tail & (COMMAND_QUEUE_SIZE - 1)] = *command;
+#if (USE_COMMAND_NUMBERING && (!USE_SLIDING_WINDOW))
+	uart->commandQueue.lost[tail & (COMMAND_QUEUE_SIZE - 1)] = uart->commandQueue.pendingLost;
+	uart->commandQueue.pendingLost = 0;
+#endif
+	QUEUE_STORE(uart->commandQueue.index.tail, (QueueSize) (tail + 1));
+	return 1;
+}
+
+#if USE_COMMAND_NUMBERING
+
+/**
+ * Tells the partner the command number this device transmits next and the one it expects.
+ * With the window the commands in flight are transmitted again, so it continues at the oldest one.
+ * Returns 0 if the control lane was full
+ */
+static uint8_t transmitResync(struct UART* uart) {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = COM_RESYNC_COMMAND_NUMBER;
+#if USE_SLIDING_WINDOW
+	addCommandData(&command, uart->commandWindow.base);
+#else
+	addCommandData(&command, uart->outCommandNumber);
+#endif
+	addCommandData(&command, uart->incCommandNumber);
+	return transmitCommand(uart, &command);
+}
+
+#endif
+
+#if USE_SLIDING_WINDOW
+
+/**
+ * Acknowledges the commands received so far with the next command number expected,
+ * if anything was received since the last acknowledgement
+ * Returns 0 if the control lane was full, the acknowledgement stays pending then
+ */
+static uint8_t transmitAcknowledge(struct UART* uart) {
+	if (uart->acknowledgePending) {
+		uart->acknowledgePending = 0;
+		struct Command command;
+		initCommand(&command);
+		command.commandCode = COM_ACK;
+		addCommandData(&command, uart->incCommandNumber);
+		if (!transmitCommand(uart, &command)) {
+			uart->acknowledgePending = 1;
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/**
+ * Transmits the commands of the window that are due, after a pending acknowledgement or resync
+ */
+void UARTflushWindow(struct UART* uart) {
+	transmitAcknowledge(uart);
+	if ((uart->commandWindow.resync == WINDOW_RESYNC_DUE) && transmitResync(uart)) {
+		//the partner acknowledges the number it continues at
+		uart->commandWindow.resync = WINDOW_RESYNC_SENT;
+	}
+	UART_PRODUCER_BEGIN();
+	windowFlush(uart);
+	UART_PRODUCER_END();
+	UARTbeginTransmit(uart);
+}
+
+#endif
+
+#if (USE_RETRANSMIT_TIMER || (!USE_FLOW_SIGNALS))
+
+/**
+ * Builds COM_RESUME with the outgoing and incoming command numbers
+ */
+static void initResume(struct UART* uart, struct Command* command) {
+	initCommand(command);
+	command->commandCode = COM_RESUME;
+#if USE_COMMAND_NUMBERING
+	addCommandData(command, uart->outCommandNumber);
+	addCommandData(command, uart->incCommandNumber);
+#else
+	(void) uart;
+#endif
+}
+
+#endif
+
+#if (!USE_FLOW_SIGNALS)
+
+/**
+ * Asks the partner to wait, transmitted after the frame in progress
+ * Returns 0 if the control lane was full, nothing changed then
+ */
+static uint8_t transmitWait(struct UART* uart) {
+	struct Command command;
+	initCommand(&command);
+	command.commandCode = COM_WAIT;
+#if USE_COMMAND_NUMBERING
+	addCommandData(&command, uart->outCommandNumber);
+	addCommandData(&command, uart->incCommandNumber);
+#endif
+	if (!transmitCommand(uart, &command)) {
+		return 0;
+	}
+	uart->status |= COM_STATUS_PARTNER_WAITING;
+	return 1;
+}
+
+/**
+ * Lets the waiting partner continue
+ * Returns 0 if the control lane was full, the partner keeps waiting then
+ */
+static uint8_t transmitResume(struct UART* uart) {
+#if USE_SLIDING_WINDOW
+	//acknowledge first so only the lost commands are transmitted again
+	if (!transmitAcknowledge(uart)) {
+		return 0;
+	}
+#endif
+	struct Command command;
+	initResume(uart, &command);
+	if (!transmitCommand(uart, &command)) {
+		return 0;
+	}
+#if USE_RETRANSMIT_TIMER
+	//transmitted again by UARTtick() until the partner acknowledges it
+	uart->status |= COM_STATUS_WAITING_ACK;
+	timerStart(&uart->resumeTimer);
+#endif
+	uart->status &= ~COM_STATUS_PARTNER_WAITING;
+	return 1;
+}
+
+#endif
+
+uint8_t acknowledgeReceived(struct UART* uart, struct Command* command) {
+#if USE_RETRANSMIT_TIMER
+	if ((command->dataSize > 1) && (command->data[1] == COM_RESUME)) {
+		//the partner resumed its transmission
+		if (uart->status & COM_STATUS_WAITING_ACK) {
+			timerStop(&uart->resumeTimer);
+			uart->status &= ~COM_STATUS_WAITING_ACK;
+		}
 		return 1;
 	}
+#endif
+#if USE_SLIDING_WINDOW
+	if (command->dataSize > 0) {
+		windowAcknowledge(uart, command->data[0]);
+		return 1;
+	}
+#endif
+#if ((!USE_RETRANSMIT_TIMER) && (!USE_SLIDING_WINDOW))
+	//nothing is waiting for an acknowledgement
+	(void) uart;
+	(void) command;
+#endif
 	return 0;
 }
 
+#if USE_RETRANSMIT_TIMER
+
+void UARTsetFailureHandler(struct UART* uart, void (*handler)(struct UART*, uint8_t)) {
+	uart->failureHandler = handler;
+}
+
 /**
- * Command Response Model should use a default message handler
+ * Advances the retransmission timers
  */
-#if COMMAND_RESPONSE_MODEL
+void UARTtick(struct UART* uart) {
+#if USE_SLIDING_WINDOW
+	if (windowTick(uart) && uart->failureHandler) {
+		(*uart->failureHandler)(uart, COM_FAILURE_WINDOW);
+	}
+#endif
+	struct Command command;
+	switch (timerTick(&uart->resumeTimer)) {
+	case TIMER_EXPIRED:
+		//the partner may have missed COM_RESUME and still be waiting
+		initResume(uart, &command);
+		transmitCommand(uart, &command);
+		break;
+	case TIMER_FAILED:
+		uart->status &= ~COM_STATUS_WAITING_ACK;
+		if (uart->failureHandler) {
+			(*uart->failureHandler)(uart, COM_FAILURE_RESUME);
+		}
+		break;
+	}
+}
+
+#endif
 
 /**
  * First level standard messages handler
- * Do not forget to clear the com_end after every standard command
+ * Handles the oldest command of the command queue and releases it afterwards
  */
-void standardMessageHandler() {
-	uint8_t code = UARTreceive();
+void standardMessageHandler(struct UART* uart) {
+	QueueSize head = uart->commandQueue.index.head;
+	if (head == QUEUE_LOAD(uart->commandQueue.index.tail)) {
+		//nothing received
+		return;
+	}
+	struct Command* received = &uart->commandQueue.commands[head
+			& (COMMAND_QUEUE_SIZE - 1)];
+	uint8_t code = received->commandCode;
 	struct Command command;
 	initCommand(&command);
 
 #if USE_COMMAND_NUMBERING
-	uint8_t messageNumber = UARTreceive();
-
+#if (!USE_SLIDING_WINDOW)
+	//the commands lost in front of this one were numbered by the partner
+	uart->incCommandNumber += uart->commandQueue.lost[head & (COMMAND_QUEUE_SIZE - 1)];
+#endif
 	//verify message number first
-	if ((messageNumber != incCommandNumber)
-			&& (code != COM_RESYNC_COMMAND_NUMBER)) {
+	if ((received->commandNumber != uart->incCommandNumber)
+			&& (code != COM_RESYNC_COMMAND_NUMBER) && COMMAND_IS_NUMBERED(code)) {
+#if USE_SLIDING_WINDOW
+		uint8_t ahead = received->commandNumber - uart->incCommandNumber;
+		if ((ahead < WINDOW_SIZE) || ((uint8_t) -ahead <= WINDOW_SIZE)) {
+			//a command before this one was lost or this one arrived again, drop it and repeat
+			//the number expected
+			uart->acknowledgePending = 1;
+		} else {
+			//the number is outside any window of the partner, the numbering is out of step
+			transmitResync(uart);
+		}
+#else
 		//there was a mismatch in message validation and the message was not fur a resync
 		//reply with resync number
-		command.commandCode = COM_RESYNC_COMMAND_NUMBER;
-		addCommandData(&command, outCommandNumber);
-		addCommandData(&command, incCommandNumber);
-		transmitCommand(&command);
+		transmitResync(uart);
+#endif
+		releaseCommandData(uart, received);
+		QUEUE_STORE(uart->commandQueue.index.head, (QueueSize) (head + 1));
+#if USE_FLOW_WATERMARKS
+		UARTcheckFlow(uart);
+#endif
+#if (USE_SLIDING_WINDOW && (!DEFERRED_DISPATCH))
+		transmitAcknowledge(uart);
+#endif
 		return;
 	}
 #endif
@@ -260,92 +651,130 @@ void standardMessageHandler() {
 	//then start processing data
 	switch (code) {
 	case COM_WAIT:
-		status |= COM_STATUS_REQUEST_SELF_WAIT;
+		uart->status |= COM_STATUS_REQUEST_SELF_WAIT;
+#if (!USE_SLIDING_WINDOW)
 		command.commandCode = COM_ACK;
 #if USE_COMMAND_NUMBERING
-		addCommandData(&command, outCommandNumber);
+		addCommandData(&command, uart->outCommandNumber);
+#endif
+		transmitCommand(uart, &command);
 #endif
-		transmitCommand(&command);
-		//dequeue com_end from receive queue
-		UARTreceive();
 		break;
 	case COM_RESUME:
 		//this device can't handle resume with some number but, we receive whichever number it has sent
-		//and then start our transmission
-		status &= ~COM_STATUS_SELF_WAITING;
-		UARTbeginTransmit();
-		//dequeue com_end from receive queue
-		UARTreceive();
+		//and then start our transmission. A wait still pending behind the frame in progress is
+		//cancelled as well, the partner has already resumed.
+		uart->status &= ~(COM_STATUS_SELF_WAITING | COM_STATUS_REQUEST_SELF_WAIT);
+#if USE_SLIDING_WINDOW
+		//the partner only waits after losing a command, everything not acknowledged goes again
+		windowRetransmit(&uart->commandWindow);
+#endif
+#if USE_RETRANSMIT_TIMER
+		//let the partner stop retransmitting it
+		command.commandCode = COM_ACK;
+#if USE_COMMAND_NUMBERING
+		addCommandData(&command, uart->incCommandNumber);
+#else
+		addCommandData(&command, 0);
+#endif
+		addCommandData(&command, COM_RESUME);
+		transmitCommand(uart, &command);
+#endif
+		UARTbeginTransmit(uart);
 		break;
 	case COM_ACK:
-		if (status & COM_STATUS_WAITING_ACK) {
-			//todo determine what was waiting for an ack and do something
-		} else {
-			// not waiting for an ack so forward it to the custom message handler
-			command.commandCode = code;
-			fillIncomingData(&command);
-			(*handler)(&command);
+#if USE_SLIDING_WINDOW
+		//acknowledgements are taken by the receive interrupt as soon as they arrive
+#else
+		if (!acknowledgeReceived(uart, received)) {
+			// not an ack this device waits for so forward it to the custom message handler
+			(*uart->handler)(uart, received);
 		}
+#endif
 		break;
+#if USE_COMMAND_NUMBERING
 	case COM_RESYNC_COMMAND_NUMBER:
-		incCommandNumber = messageNumber;
-		outCommandNumber = UARTreceive();
-		//clear com_end from the queue
-		UARTreceive();
+		//the partner sent its outgoing and incoming command numbers
+		if (received->dataSize > 1) {
+#if USE_SLIDING_WINDOW
+			//the partner continues at the oldest command of its window, so does this window
+			uart->incCommandNumber = received->data[0];
+			uart->acknowledgePending = 1;
+#if USE_RETRANSMIT_TIMER
+			if (windowResync(uart, received->data[1]) && uart->failureHandler) {
+				(*uart->failureHandler)(uart, COM_FAILURE_WINDOW);
+			}
+#else
+			windowResync(uart, received->data[1]);
+#endif
+#else
+			uart->incCommandNumber = received->commandNumber;
+			uart->outCommandNumber = received->data[1];
+#endif
+		}
 		break;
+#endif
 	default:
-		command.commandCode = code;
-		fillIncomingData(&command);
-		(*handler)(&command);
+		(*uart->handler)(uart, received);
 		break;
 	}
-	notify(PROC_STATUS_COMPLETED);
+	//release the command and its data to the receiver
+	releaseCommandData(uart, received);
+	QUEUE_STORE(uart->commandQueue.index.head, (QueueSize) (head + 1));
+#if USE_FLOW_WATERMARKS
+	UARTcheckFlow(uart);
+#endif
+	notify(uart, COMMAND_IS_NUMBERED(code) ? PROC_STATUS_COMPLETED : PROC_STATUS_CONTROL_COMPLETED);
+#if (USE_SLIDING_WINDOW && (!DEFERRED_DISPATCH))
+	transmitAcknowledge(uart);
+#endif
 }
 
 /**
- * Fills data into the command structure from the rx queue
- * TODO verify data integrity using escape sequencing
+ * Notify the process status of UART.
  */
-void fillIncomingData(struct Command* command) {
-	uint8_t data = UARTreceive();
-	command->dataSize = 0;
-	//TODO use ESCAPE SEQUENCE
-	while ((data != COM_END) && (command->dataSize < COMMAND_DATA_LENGTH)) {
-		command->data[command->dataSize] = data;
-		data = UARTreceive();
-		command->dataSize++;
+void notify(struct UART* uart, uint8_t processStatus) {
+	if ((processStatus == PROC_STATUS_COMPLETED)
+			|| (processStatus == PROC_STATUS_CONTROL_COMPLETED)) {
+		if (processStatus == PROC_STATUS_COMPLETED) {
+			//incoming command number processing complete
+#if USE_COMMAND_NUMBERING
+			uart->incCommandNumber++;
+#endif
+#if USE_SLIDING_WINDOW
+			uart->acknowledgePending = 1;
+#endif
+		}
+#if (!USE_COMMAND_NUMBERING)
+		//nothing of the port follows the handled commands
+		(void) uart;
+#endif
+		//todo what to do at overflow
+		//the partner waiting is resumed by UARTcheckFlow() once the receive queue drained
 	}
 }
 
+#if DEFERRED_DISPATCH
+
 /**
- * Notify the process status of UART.
+ * Handles the received commands outside of the interrupt
  */
-void notify(uint8_t processStatus) {
-	if (processStatus == PROC_STATUS_COMPLETED) {
-		//incoming command number processing complete
-#if USE_COMMAND_NUMBERING
-		incCommandNumber++;
-#endif
-		//todo what to do at overflow
-		//the process status completed successfully
-		if (status & COM_STATUS_PARTNER_WAITING) {
-			struct Command command;
-			initCommand(&command);
-			//if the communication channel is waiting request resume
-			command.commandCode = COM_RESUME;
-#if USE_COMMAND_NUMBERING
-			addCommandData(&command, outCommandNumber);
-			addCommandData(&command, incCommandNumber);
-#endif
-			transmitCommandForced(&command);
-			//TODO how to wait for an ack for this?
-			//using timers??
-			UARTbeginTransmit();
-			status &= ~COM_STATUS_PARTNER_WAITING;
-		}
+uint8_t UARTprocess(struct UART* uart) {
+	uint8_t processed = 0;
+	while (queueIndexCount(&uart->commandQueue.index) != 0) {
+		standardMessageHandler(uart);
+		processed++;
 	}
+#if USE_SLIDING_WINDOW
+	//one acknowledgement for everything handled
+	transmitAcknowledge(uart);
+	UARTflushWindow(uart);
+#endif
+	return processed;
 }
 
+#endif
+
 /**
  * Master mode command controller
  */
@@ -356,12 +785,12 @@ void notify(uint8_t processStatus) {
  */
 uint8_t processStatus;
 
-void UARTholdTransmit() {
-	status = COM_WAIT;
+void UARTholdTransmit(struct UART* uart) {
+	uart->status = COM_WAIT;
 }
 
-void UARTresumeTransmission() {
-	UARTbeginTransmit();
+void UARTresumeTransmission(struct UART* uart) {
+	UARTbeginTransmit(uart);
 }
 
 #endif
@@ -8,16 +8,38 @@
 #ifndef UART_H_
 #define UART_H_
 
-#include <avr/io.h>
 #include <inttypes.h>
 #include "config.h"
 #include "uart_hdw.h"
 
-#if (INTERRUPT_DRIVEN)
+#if (!INTERRUPT_DRIVEN)
+
+//not interrupt driven so nothing invokes the command handlers
+#if COMMAND_RESPONSE_MODEL
+#error 'Invalid Setting (InterruptDriven: 0 and CommandModel: 1)'
+#endif
+
+#endif
+
+#if USE_QUEUE
+#include "../utils/Queue.h"
 
 /**
- * Global Variables required for UART when using interrupt mode
+ * Statically allocated queues, sized per direction
  */
+QUEUE_TYPE(RxQueue, RX_QUEUE_SIZE);
+QUEUE_TYPE(TxQueue, TX_QUEUE_SIZE);
+
+#else
+
+//not using queue so command response model is not valid
+#if COMMAND_RESPONSE_MODEL
+//command response model used without using queue
+#error 'Invalid Setting (Queue: 0 and CommandModel: 1)'
+#endif
+
+#endif
+
 #if COMMAND_RESPONSE_MODEL
 
 #include "../commands.h"
@@ -29,78 +51,227 @@
 #error 'Required Commands not defined for Command Oriented Communication'
 #endif
 
+#include "../utils/commandParser.h"
+
 /**
- * Holds the status of the UART and will be used for determining the next move of the transmission
+ * Commands received completely and waiting for their message handler
  */
-uint8_t status;
-
+struct CommandQueue {
+	struct QueueIndex index;
+	struct Command commands[COMMAND_QUEUE_SIZE];
+#if (USE_COMMAND_NUMBERING && (!USE_SLIDING_WINDOW))
+	/**
+	 * Numbered commands lost right before each queued command, the numbering skips them
+	 */
+	uint8_t lost[COMMAND_QUEUE_SIZE];
+	/**
+	 * Numbered commands lost since the last one queued, only written by the receive interrupt
+	 */
+	uint8_t pendingLost;
 #endif
+};
 
-#if USE_COMMAND_NUMBERING
 /**
- * Holds the incoming command number
+ * Encoded control commands, transmitted ahead of the transmit queue
  */
-uint8_t incCommandNumber;
+QUEUE_TYPE(ControlQueue, CONTROL_QUEUE_SIZE);
 
 /**
- * Holds the outgoing commad number
+ * Encoded urgent commands, transmitted after the control commands and ahead of the transmit queue
  */
-uint8_t outCommandNumber;
+QUEUE_TYPE(HighQueue, HIGH_QUEUE_SIZE);
 
+#if USE_SLIDING_WINDOW
+#include "../utils/commandWindow.h"
 #endif
 
+#if USE_RETRANSMIT_TIMER
+#include "../utils/commandTimer.h"
 #endif
 
-#if USE_QUEUE
-#include "../utils/Queue.h"
-
-typedef struct Queue Queue;
-Queue rxQueue, txQueue;
-
-#if COMMAND_RESPONSE_MODEL
 #endif
-#else
 
-//not using queue so command response model is not valid
+/**
+ * Context of a port: its USART, its queues and the state of the command response model.
+ * The ports are independent of each other, every function takes the port it works on and
+ * every callback is given the port it is called for.
+ * The small fields come first, so they stay in reach of a displacement on the AVR.
+ */
+struct UART {
+	/**
+	 * The hardware USART of the port
+	 */
+	HdwPort* hardware;
+#if INTERRUPT_DRIVEN
+	/**
+	 * Holds the status of the UART and will be used for determining the next move of the transmission
+	 */
+	uint8_t status;
+#endif
+#if (FLOW_CONTROL == FLOW_XON_XOFF)
+	/**
+	 * XON or XOFF waiting to be transmitted ahead of the transmit queue, 0 if none
+	 */
+	volatile uint8_t flowByte;
+#endif
 #if COMMAND_RESPONSE_MODEL
-//command response model used without using queue
-#error 'Invalid Setting (Queue: 0 and CommandModel: 1)'
+	/**
+	 * Priority class of the frame the transmitter is in (TX_FRAME_*), the frames of the classes
+	 * never interleave
+	 */
+	uint8_t txFrame;
+#if (FRAMING == FRAMING_ESCAPE)
+	/**
+	 * The last byte transmitted was COM_ESCAPE_CHAR
+	 */
+	uint8_t txEscaped;
 #endif
+#if USE_COMMAND_NUMBERING
+	/**
+	 * Holds the incoming command number
+	 */
+	uint8_t incCommandNumber;
+
+	/**
+	 * Holds the outgoing commad number
+	 */
+	uint8_t outCommandNumber;
+#endif
+#if USE_SLIDING_WINDOW
+	/**
+	 * The received commands have to be acknowledged
+	 */
+	uint8_t acknowledgePending;
+#endif
+	/**
+	 * A custom message handler
+	 */
+	void (*handler)(struct UART*, struct Command*);
+#if USE_RETRANSMIT_TIMER
+	/**
+	 * Called when the partner stops acknowledging
+	 */
+	void (*failureHandler)(struct UART*, uint8_t);
+
+	/**
+	 * Runs while COM_RESUME waits for its acknowledgement
+	 */
+	struct CommandTimer resumeTimer;
+#endif
+	/**
+	 * Parses the received bytes into commands
+	 */
+	struct CommandParser commandParser;
+
+	struct CommandQueue commandQueue;
+
+	struct ControlQueue controlQueue;
 
+	struct HighQueue highQueue;
+#if USE_SLIDING_WINDOW
+	/**
+	 * The commands transmitted and not acknowledged yet
+	 */
+	struct CommandWindow commandWindow;
 #endif
+#elif (INTERRUPT_DRIVEN && (!USE_QUEUE))
+	/**
+	 * Callbacks of the user program when not using the command response model
+	 */
+	void (*rxcHandler)(struct UART*, uint8_t);
+	void (*txcHandler)(struct UART*);
+#elif INTERRUPT_DRIVEN
+	void (*rxcHandler)(struct UART*);
+	void (*txcHandler)(struct UART*);
+#endif
+#if USE_QUEUE
+	struct RxQueue rxQueue;
+	struct TxQueue txQueue;
+#endif
+#if USE_FLOW_WATERMARKS
+	/**
+	 * Bytes in the receive queue at which the partner is stopped and at which it may continue,
+	 * RX_HIGH_WATERMARK and RX_LOW_WATERMARK moved to the baud rate of the port
+	 */
+	QueueSize rxHighWatermark;
+	QueueSize rxLowWatermark;
+#endif
+};
+
+/**
+ * The ports, port n drives USARTn
+ */
+extern struct UART uartPorts[UART_PORTS];
+
+/**
+ * The context of port n
+ */
+#define UART_PORT(index) (&uartPorts[index])
 
 /**
  * simple UART setup
  * NOTE: the message handler should not dequeue the command end from the device
  */
-void UARTsetup(
+void UARTsetup(struct UART* uart
 #if COMMAND_RESPONSE_MODEL
-		void (*messageHandler)(struct Command*)
+		, void (*messageHandler)(struct UART*, struct Command*)
 #endif
 #if (INTERRUPT_DRIVEN && (!USE_QUEUE))
-		void (*rxcCompleteHandler)(uint8_t),
-		void (*txcCompleteHandler)()
+		, void (*rxcCompleteHandler)(struct UART*, uint8_t),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 #if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
-		void (*rxcQueueFullHandler)(),
-		void (*txcCompleteHandler)()
+		, void (*rxcQueueFullHandler)(struct UART*),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 		);
 
 /**
- * Advanced UART setup
+ * Parity of advancedUARTsetup()
+ */
+#define UART_PARITY_NONE 0
+#define UART_PARITY_EVEN 2
+#define UART_PARITY_ODD 3
+
+/**
+ * Speed mode of advancedUARTsetup()
+ * UART_SPEED_NORMAL - 16 samples per bit, the widest tolerance of the receiver
+ * UART_SPEED_DOUBLE - 8 samples per bit (U2X), twice the highest baud rate and a finer UBRR step
+ * UART_SPEED_AUTO - the mode coming closer to the baud rate, normal speed when both are as close
+ */
+#define UART_SPEED_NORMAL 0
+#define UART_SPEED_DOUBLE 1
+#define UART_SPEED_AUTO 2
+
+/**
+ * Returned by advancedUARTsetup() when the port can not run the settings
  */
-void advancedUARTsetup(
+#define UART_SETUP_INVALID INT16_MIN
+
+/**
+ * Advanced UART setup, as UARTsetup() on a line of
+ * baud rate : baudRate, the closest rate UBRR generates at F_CPU in the modes speed allows
+ * Parity: parity
+ * Stop bits: stopBits (1 or 2)
+ * Frame Size: frameSize (5 to 8 bits, 8 with the command response model)
+ * Returns the error of the achieved baud rate in hundredths of a percent (positive when faster),
+ * or UART_SETUP_INVALID leaving the port untouched when it exceeds MAX_BAUD_ERROR or, with
+ * USE_FLOW_WATERMARKS, the receive queue can not hold the flow control headroom at the baud rate.
+ * The USART is enabled once the format is set. A UART_HARDWARE_POSIX line keeps the termios
+ * settings of posixOpen().
+ */
+int16_t advancedUARTsetup(struct UART* uart, uint32_t baudRate, uint8_t parity, uint8_t stopBits,
+		uint8_t frameSize, uint8_t speed
 #if COMMAND_RESPONSE_MODEL
-		void (*messageHandler)(struct Command*)
+		, void (*messageHandler)(struct UART*, struct Command*)
 #endif
 #if (INTERRUPT_DRIVEN && (!USE_QUEUE))
-		void (*rxcCompleteHandler)(uint8_t),
-		void (*txcCompleteHandler)()
+		, void (*rxcCompleteHandler)(struct UART*, uint8_t),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 #if (INTERRUPT_DRIVEN && (USE_QUEUE && (!COMMAND_RESPONSE_MODEL)))
-		void (*rxcQueueFullHandler)(),
-		void (*txcCompleteHandler)()
+		, void (*rxcQueueFullHandler)(struct UART*),
+		void (*txcCompleteHandler)(struct UART*)
 #endif
 		);
 
@@ -108,31 +279,31 @@ void advancedUARTsetup(
  * Check whether UART is busy or not. a software implementation
  * returns a uint8_t value that represents both transmit and receive business
  */
-uint8_t UARTstatus();
+uint8_t UARTstatus(struct UART* uart);
 
 /**
  * Transmit data (enqueue to buffer or direct) according to use cases
  * Returns the number of bytes written into the stream
  */
-uint8_t UARTtransmit(uint8_t);
+uint8_t UARTtransmit(struct UART* uart, uint8_t data);
 
 /**
  * Receive data (from buffer or direct) according to use cases
  */
-uint8_t UARTreceive();
+uint8_t UARTreceive(struct UART* uart);
 
 #if USE_QUEUE
 
 /**
  * Initiate transmission the data from the queue.
  */
-void UARTbeginTransmit();
+void UARTbeginTransmit(struct UART* uart);
 
 /**
  * Builds the queue but does not transmit.
  * Returns whether the data was written or not
  */
-uint8_t UARTbuildTransmitQueue(uint8_t data);
+uint8_t UARTbuildTransmitQueue(struct UART* uart, uint8_t data);
 
 /**
  * Bulk Transmit data into the stream.
@@ -140,36 +311,89 @@ uint8_t UARTbuildTransmitQueue(uint8_t data);
  * length denotes the number of data bytes to transmit
  * TODO make this common
  */
-uint8_t UARTbulkTransmit(uint8_t* data, uint8_t start, uint8_t length);
+QueueSize UARTbulkTransmit(struct UART* uart, uint8_t* data, QueueSize start, QueueSize length);
+
+#if USE_FLOW_WATERMARKS
+
+/**
+ * Stops the partner once the receive queue reaches the high watermark of the port and lets it
+ * continue at the low one. Called whenever data enters or leaves the receive queue.
+ */
+void UARTcheckFlow(struct UART* uart);
+
+#endif
 
 #endif
 
 #if COMMAND_RESPONSE_MODEL
 
+#if USE_SLIDING_WINDOW
+
+/**
+ * Transmits the commands of the sliding window that did not fit into the transmit queue
+ * before, and the ones the partner asked for again. Call it from the main loop.
+ */
+void UARTflushWindow(struct UART* uart);
+
+#endif
+
+#if USE_RETRANSMIT_TIMER
+
+/**
+ * Advances the retransmission timers of the port, call it every TICK_PERIOD_MS (from a timer
+ * interrupt) unless TICK_SOURCE is TICK_TIMER0, which ticks every port
+ */
+void UARTtick(struct UART* uart);
+
+/**
+ * Sets the function called with COM_FAILURE_WINDOW or COM_FAILURE_RESUME when the partner
+ * did not acknowledge after RETRANSMIT_ATTEMPTS retransmissions
+ */
+void UARTsetFailureHandler(struct UART* uart, void (*handler)(struct UART* uart, uint8_t reason));
+
+#endif
+
+/**
+ * Takes an acknowledgement of COM_RESUME or of the commands in the sliding window.
+ * Returns 0 if it does not acknowledge anything this device is waiting for.
+ */
+uint8_t acknowledgeReceived(struct UART* uart, struct Command* command);
+
+/**
+ * Queues a completely received command for its message handler.
+ * Returns 0 if there was no room and the command was lost.
+ */
+uint8_t UARTqueueCommand(struct UART* uart, struct Command* command);
+
 /**
  * Resumes the current transmission queue
  */
-void UARTresumeTransmission();
+void UARTresumeTransmission(struct UART* uart);
 
 /**
  * Pauses the Current transmission queue
  */
-void UARTholdTransmit();
+void UARTholdTransmit(struct UART* uart);
 
 /**
- * Fills data into the provided command data structure
+ * Defines a Standard message handler, handles the oldest command in the command queue
  */
-void fillIncomingData(struct Command* command);
+void standardMessageHandler(struct UART* uart);
 
 /**
- * Defines a Standard message handler
+ * Notifies the status of the message handling mechanism
  */
-void standardMessageHandler();
+void notify(struct UART* uart, uint8_t processStatus);
+
+#if DEFERRED_DISPATCH
 
 /**
- * Notifies the status of the message handling mechanism
+ * Runs the message handlers for every command received on the port since the last call.
+ * Call it from the main loop. Returns the number of commands handled.
  */
-void notify(uint8_t);
+uint8_t UARTprocess(struct UART* uart);
+
+#endif
 
 #endif
 
@@ -0,0 +1,517 @@
+/*
+ * uart_gateway.c
+ */
+
+#include "uart_gateway.h"
+
+#if USE_GATEWAY
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+struct GatewayWorker gatewayWorkers[GATEWAY_MAX_WORKERS];
+
+/**
+ * Line of a port and the worker it belongs to
+ */
+struct GatewayLine {
+	int fd;
+	uint8_t used;
+	uint8_t worker;
+};
+
+static struct GatewayLine gatewayLines[UART_PORTS];
+
+static uint8_t gatewayWorkerCount;
+
+/**
+ * Guards the start of the workers
+ */
+static pthread_mutex_t gatewayLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gatewayStarted = PTHREAD_COND_INITIALIZER;
+
+/**
+ * Sources of the events a worker waits for
+ */
+#define GATEWAY_EVENT_LOOP 0
+#define GATEWAY_EVENT_WAKE 1
+#define GATEWAY_EVENT_TICK 2
+
+/**
+ * Copies length bytes at offset past the head of the queue, without taking them
+ */
+static void gatewayPeek(struct GatewayQueue* queue, QueueSize offset, uint8_t* data,
+		QueueSize length) {
+	QueueSize start = (QueueSize) (queue->index.head + offset) & QUEUE_MASK(queue);
+	QueueSize size = sizeof(queue->buffer) - start;
+	//the command wraps at most once
+	if (size > length) {
+		size = length;
+	}
+	memcpy(data, queue->buffer + start, size);
+	memcpy(data + size, queue->buffer, length - size);
+}
+
+/**
+ * Writes the command into the queue as a whole
+ * Returns 0 if it does not fit
+ */
+static uint8_t gatewayPut(struct GatewayQueue* queue, uint8_t port, struct Command* command) {
+	uint16_t length = GATEWAY_HEADER_SIZE + command->dataSize;
+	if (!queueReserve(queue, length)) {
+		return 0;
+	}
+	uint8_t header[GATEWAY_HEADER_SIZE] = { port, command->commandCode, command->dataSize,
+			(uint16_t) command->dataSize >> 8 };
+	queueWriteReserved(queue, 0, header, GATEWAY_HEADER_SIZE);
+	queueWriteReserved(queue, GATEWAY_HEADER_SIZE, command->data, command->dataSize);
+	queueProduce(queue, length);
+	return 1;
+}
+
+/**
+ * Reads the oldest command of the queue into data, without taking it
+ * Returns its port
+ */
+static uint8_t gatewayPeekCommand(struct GatewayQueue* queue, struct Command* command,
+		uint8_t* data) {
+	uint8_t header[GATEWAY_HEADER_SIZE];
+	gatewayPeek(queue, 0, header, GATEWAY_HEADER_SIZE);
+	QueueSize size = header[2] | (uint16_t) header[3] << 8;
+	gatewayPeek(queue, GATEWAY_HEADER_SIZE, data, size);
+	initCommand(command);
+	command->commandCode = header[1];
+	setCommandData(command, data, size);
+	return header[0];
+}
+
+/**
+ * Wakes the worker if it sleeps. The fence pairs with the one of the worker going to sleep, so
+ * either the worker sees the change of the queue or this sees the worker sleeping.
+ */
+static void gatewayWake(struct GatewayWorker* worker) {
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&worker->sleeping, __ATOMIC_RELAXED)) {
+		uint64_t one = 1;
+		if (write(worker->wake, &one, sizeof(one)) < 0) {
+			//the counter is already set
+		}
+	}
+}
+
+/**
+ * The message handler of every port, hands the command to the application.
+ * gatewayDeliver() made sure it fits.
+ */
+static void gatewayHandler(struct UART* uart, struct Command* command) {
+	uint8_t port = uart - uartPorts;
+	gatewayPut(&gatewayWorkers[gatewayLines[port].worker].received, port, command);
+}
+
+/**
+ * Nothing is queued on the port that could make room for a command
+ */
+static uint8_t gatewayPortIdle(struct UART* uart) {
+	if (queueCount(&uart->txQueue) || queueCount(&uart->controlQueue)
+			|| queueCount(&uart->highQueue)) {
+		return 0;
+	}
+#if USE_SLIDING_WINDOW
+	if (uart->outCommandNumber != uart->commandWindow.base) {
+		return 0;
+	}
+#endif
+	return 1;
+}
+
+/**
+ * Transmits the commands submitted by the application in order. A command its port has no room
+ * for holds the ones behind it back until the next round.
+ * Returns 0 if it stopped at such a command
+ */
+static uint8_t gatewayTransmit(struct GatewayWorker* worker) {
+	uint8_t data[GATEWAY_QUEUE_SIZE];
+	while (queueCount(&worker->submitted)) {
+		struct Command command;
+		struct UART* uart = UART_PORT(gatewayPeekCommand(&worker->submitted, &command, data));
+		if (!transmitCommand(uart, &command)) {
+			if (!gatewayPortIdle(uart)) {
+				//no room now, the port makes progress
+				return 0;
+			}
+			//it never fits, drop it rather than holding the other ports back forever
+			worker->dropped++;
+		}
+		queueConsume(&worker->submitted, GATEWAY_HEADER_SIZE + command.dataSize);
+	}
+	return 1;
+}
+
+/**
+ * Hands the commands received on the ports of the worker to the application, as long as they fit
+ * into the received queue. The rest waits in the command queue of its port, which holds the
+ * partner back once it is full.
+ * Returns the number of commands handed over
+ */
+static uint16_t gatewayDeliver(struct GatewayWorker* worker) {
+	uint16_t delivered = 0;
+	uint16_t needed = 0;
+	for (uint8_t i = 0; i < worker->portCount; i++) {
+		struct UART* uart = UART_PORT(worker->ports[i]);
+		struct CommandQueue* queue = &uart->commandQueue;
+		while ((!needed) && queueIndexCount(&queue->index)) {
+			struct Command* command = &queue->commands[queue->index.head
+					& (COMMAND_QUEUE_SIZE - 1)];
+			if (queueSpace(&worker->received) < GATEWAY_HEADER_SIZE + command->dataSize) {
+				needed = GATEWAY_HEADER_SIZE + command->dataSize;
+				break;
+			}
+			standardMessageHandler(uart);
+			delivered++;
+		}
+		if (!queueIndexCount(&queue->index)) {
+			//acknowledges what was handled and transmits the window
+			UARTprocess(uart);
+		}
+	}
+	__atomic_store_n(&worker->needed, needed, __ATOMIC_RELAXED);
+	return delivered;
+}
+
+/**
+ * Any command is waiting for the worker
+ */
+static uint8_t gatewayPending(struct GatewayWorker* worker, uint8_t transmitted) {
+	if (transmitted && queueCount(&worker->submitted)) {
+		return 1;
+	}
+	if (worker->needed) {
+		//waits for the application to take commands
+		return queueSpace(&worker->received) >= worker->needed;
+	}
+	for (uint8_t i = 0; i < worker->portCount; i++) {
+		if (queueIndexCount(&UART_PORT(worker->ports[i])->commandQueue.index)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Attaches the lines of the worker to the event loop of its thread and sets the ports up
+ * Returns 0 or the error
+ */
+static int gatewaySetupWorker(struct GatewayWorker* worker) {
+	for (uint8_t i = 0; i < worker->portCount; i++) {
+		uint8_t port = worker->ports[i];
+		if (posixAttach(HDW_PORT(port), gatewayLines[port].fd)) {
+			return errno;
+		}
+		UARTsetup(UART_PORT(port), gatewayHandler);
+	}
+	struct epoll_event loop = { .events = EPOLLIN, .data.u32 = GATEWAY_EVENT_LOOP };
+	if ((worker->portCount != 0)
+			&& epoll_ctl(worker->epoll, EPOLL_CTL_ADD, posixEventFd(), &loop)) {
+		return errno;
+	}
+	return 0;
+}
+
+/**
+ * Closes the lines of the worker, the ones attached to its event loop and the others
+ */
+static void gatewayCloseWorker(struct GatewayWorker* worker) {
+	for (uint8_t i = 0; i < worker->portCount; i++) {
+		uint8_t port = worker->ports[i];
+		if (HDW_PORT(port)->attached) {
+			posixClose(HDW_PORT(port));
+		} else {
+			close(gatewayLines[port].fd);
+		}
+		gatewayLines[port].used = 0;
+	}
+}
+
+#if USE_RETRANSMIT_TIMER
+
+/**
+ * Ticks the ports of the worker for every expiration of its timer
+ */
+static void gatewayTick(struct GatewayWorker* worker) {
+	uint64_t expirations;
+	if (read(worker->tick, &expirations, sizeof(expirations)) != sizeof(expirations)) {
+		return;
+	}
+	while (expirations--) {
+		for (uint8_t i = 0; i < worker->portCount; i++) {
+			UARTtick(UART_PORT(worker->ports[i]));
+		}
+	}
+}
+
+#endif
+
+/**
+ * Thread of a worker, runs the event loop of its ports in rounds: the submitted commands are
+ * transmitted, the received ones handed over, then the lines are serviced. It sleeps once
+ * nothing is left to do.
+ */
+static void* gatewayRun(void* argument) {
+	struct GatewayWorker* worker = argument;
+	int error = gatewaySetupWorker(worker);
+	pthread_mutex_lock(&gatewayLock);
+	worker->error = error;
+	worker->started = 1;
+	pthread_cond_broadcast(&gatewayStarted);
+	pthread_mutex_unlock(&gatewayLock);
+
+	while ((!error) && __atomic_load_n(&worker->running, __ATOMIC_ACQUIRE)) {
+		uint8_t transmitted = gatewayTransmit(worker);
+		uint16_t delivered = gatewayDeliver(worker);
+		//writes what was queued above, reads the lines and runs the vectors
+		posixPoll(0);
+		if (delivered) {
+			uint64_t one = 1;
+			if (write(worker->ready, &one, sizeof(one)) < 0) {
+				//the counter is already set
+			}
+		}
+
+		__atomic_store_n(&worker->sleeping, 1, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		int timeout = gatewayPending(worker, transmitted) ? 0 : -1;
+		struct epoll_event events[3];
+		int count = epoll_wait(worker->epoll, events, 3, timeout);
+		__atomic_store_n(&worker->sleeping, 0, __ATOMIC_RELAXED);
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.u32 == GATEWAY_EVENT_WAKE) {
+				uint64_t counter;
+				if (read(worker->wake, &counter, sizeof(counter)) < 0) {
+					//woken by someone else already
+				}
+			}
+#if USE_RETRANSMIT_TIMER
+			if (events[i].data.u32 == GATEWAY_EVENT_TICK) {
+				gatewayTick(worker);
+			}
+#endif
+		}
+	}
+	gatewayCloseWorker(worker);
+	return 0;
+}
+
+int gatewayAttach(uint8_t port, int fd) {
+	if ((port >= UART_PORTS) || gatewayLines[port].used) {
+		errno = EINVAL;
+		return -1;
+	}
+	gatewayLines[port].fd = fd;
+	gatewayLines[port].used = 1;
+	return 0;
+}
+
+int gatewayOpen(uint8_t port, const char* path) {
+	int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	if (gatewayAttach(port, fd)) {
+		close(fd);
+		errno = EINVAL;
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * Creates the descriptors of the worker
+ * Returns 0, or -1 with errno set
+ */
+static int gatewayOpenWorker(struct GatewayWorker* worker) {
+	worker->epoll = epoll_create1(EPOLL_CLOEXEC);
+	worker->wake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	worker->ready = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((worker->epoll < 0) || (worker->wake < 0) || (worker->ready < 0)) {
+		return -1;
+	}
+	struct epoll_event wake = { .events = EPOLLIN, .data.u32 = GATEWAY_EVENT_WAKE };
+	if (epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->wake, &wake)) {
+		return -1;
+	}
+#if USE_RETRANSMIT_TIMER
+	worker->tick = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = TICK_PERIOD_MS / 1000;
+	spec.it_interval.tv_nsec = (TICK_PERIOD_MS % 1000) * 1000000L;
+	spec.it_value = spec.it_interval;
+	struct epoll_event tick = { .events = EPOLLIN, .data.u32 = GATEWAY_EVENT_TICK };
+	if ((worker->tick < 0) || timerfd_settime(worker->tick, 0, &spec, 0)
+			|| epoll_ctl(worker->epoll, EPOLL_CTL_ADD, worker->tick, &tick)) {
+		return -1;
+	}
+#endif
+	return 0;
+}
+
+/**
+ * Closes the descriptors of the worker
+ */
+static void gatewayReleaseWorker(struct GatewayWorker* worker) {
+	if (worker->epoll >= 0) {
+		close(worker->epoll);
+	}
+	if (worker->wake >= 0) {
+		close(worker->wake);
+	}
+	if (worker->ready >= 0) {
+		close(worker->ready);
+	}
+#if USE_RETRANSMIT_TIMER
+	if (worker->tick >= 0) {
+		close(worker->tick);
+	}
+#endif
+}
+
+int gatewayStart(uint8_t workers) {
+	if ((workers < 1) || (workers > GATEWAY_MAX_WORKERS) || gatewayWorkerCount) {
+		errno = EINVAL;
+		return -1;
+	}
+	for (uint8_t i = 0; i < workers; i++) {
+		struct GatewayWorker* worker = &gatewayWorkers[i];
+		memset(worker, 0, sizeof(*worker));
+		queueInit(&worker->submitted);
+		queueInit(&worker->received);
+		worker->epoll = -1;
+		worker->wake = -1;
+		worker->ready = -1;
+#if USE_RETRANSMIT_TIMER
+		worker->tick = -1;
+#endif
+		worker->running = 1;
+	}
+	//share the ports out, one after the other
+	uint8_t next = 0;
+	for (uint16_t port = 0; port < UART_PORTS; port++) {
+		if (gatewayLines[port].used) {
+			struct GatewayWorker* worker = &gatewayWorkers[next];
+			worker->ports[worker->portCount++] = port;
+			gatewayLines[port].worker = next;
+			next = (next + 1) % workers;
+		}
+	}
+
+	int error = 0;
+	for (uint8_t i = 0; i < workers; i++) {
+		struct GatewayWorker* worker = &gatewayWorkers[i];
+		if (gatewayOpenWorker(worker)) {
+			error = errno;
+			break;
+		}
+		error = pthread_create(&worker->thread, 0, gatewayRun, worker);
+		if (error) {
+			break;
+		}
+		gatewayWorkerCount++;
+	}
+	//wait for the workers to set their ports up
+	pthread_mutex_lock(&gatewayLock);
+	for (uint8_t i = 0; i < gatewayWorkerCount; i++) {
+		while (!gatewayWorkers[i].started) {
+			pthread_cond_wait(&gatewayStarted, &gatewayLock);
+		}
+		if (gatewayWorkers[i].error && !error) {
+			error = gatewayWorkers[i].error;
+		}
+	}
+	pthread_mutex_unlock(&gatewayLock);
+	if (error) {
+		//the workers not started release the descriptors they got
+		for (uint8_t i = gatewayWorkerCount; i < workers; i++) {
+			gatewayCloseWorker(&gatewayWorkers[i]);
+			gatewayReleaseWorker(&gatewayWorkers[i]);
+		}
+		gatewayStop();
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+void gatewayStop() {
+	for (uint8_t i = 0; i < gatewayWorkerCount; i++) {
+		struct GatewayWorker* worker = &gatewayWorkers[i];
+		__atomic_store_n(&worker->running, 0, __ATOMIC_RELEASE);
+		uint64_t one = 1;
+		if (write(worker->wake, &one, sizeof(one)) < 0) {
+			//the counter is already set
+		}
+	}
+	for (uint8_t i = 0; i < gatewayWorkerCount; i++) {
+		pthread_join(gatewayWorkers[i].thread, 0);
+		gatewayReleaseWorker(&gatewayWorkers[i]);
+	}
+	gatewayWorkerCount = 0;
+}
+
+uint8_t gatewayWorkerOf(uint8_t port) {
+	return gatewayLines[port].worker;
+}
+
+uint8_t gatewaySubmit(uint8_t port, struct Command* command) {
+	struct GatewayWorker* worker = &gatewayWorkers[gatewayLines[port].worker];
+	if (!gatewayPut(&worker->submitted, port, command)) {
+		return 0;
+	}
+	gatewayWake(worker);
+	return 1;
+}
+
+uint8_t gatewayReceive(uint8_t index, struct GatewayMessage* message) {
+	struct GatewayWorker* worker = &gatewayWorkers[index];
+	if (!queueCount(&worker->received)) {
+		return 0;
+	}
+	message->port = gatewayPeekCommand(&worker->received, &message->command, message->data);
+	queueConsume(&worker->received, GATEWAY_HEADER_SIZE + message->command.dataSize);
+	//the worker may wait for this room
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	uint16_t needed = __atomic_load_n(&worker->needed, __ATOMIC_RELAXED);
+	if (needed && (queueSpace(&worker->received) >= needed)) {
+		gatewayWake(worker);
+	}
+	return 1;
+}
+
+int gatewayWait(uint8_t index, int timeoutMs) {
+	struct GatewayWorker* worker = &gatewayWorkers[index];
+	if (queueCount(&worker->received)) {
+		return 1;
+	}
+	struct pollfd ready = { .fd = worker->ready, .events = POLLIN };
+	int count = poll(&ready, 1, timeoutMs);
+	if (count < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+	if (count) {
+		uint64_t counter;
+		if (read(worker->ready, &counter, sizeof(counter)) < 0) {
+			//taken by gatewayEventFd() user
+		}
+	}
+	return queueCount(&worker->received) != 0;
+}
+
+int gatewayEventFd(uint8_t index) {
+	return gatewayWorkers[index].ready;
+}
+
+#endif
@@ -0,0 +1,172 @@
+/*
+ * uart_gateway.h
+ */
+
+#ifndef UART_GATEWAY_H_
+#define UART_GATEWAY_H_
+
+#include "config.h"
+
+#if USE_GATEWAY
+
+#include <pthread.h>
+#include "uart.h"
+
+/**
+ * Byte ring carrying whole commands between a worker and the application, lock free as it has
+ * a single producer and a single consumer thread. A command is its port, its code, its data size
+ * (two bytes, low first) and its data.
+ */
+QUEUE_TYPE(GatewayQueue, GATEWAY_QUEUE_SIZE);
+
+/**
+ * Bytes in front of the data of a command in a GatewayQueue
+ */
+#define GATEWAY_HEADER_SIZE 4
+
+/**
+ * A worker thread running the event loop of its ports. Received commands are handed to the
+ * application through the received queue, the commands to transmit come through the submitted
+ * queue. Each queue has one application thread on its side, e.g. one application thread per
+ * worker or a single one for every worker.
+ */
+struct GatewayWorker {
+	/**
+	 * Commands of the application waiting for their port, filled by gatewaySubmit()
+	 */
+	struct GatewayQueue submitted;
+
+	/**
+	 * Commands received on the ports waiting for gatewayReceive()
+	 */
+	struct GatewayQueue received;
+
+	pthread_t thread;
+
+	/**
+	 * epoll instance waiting on the event loop of the ports, wake and tick
+	 */
+	int epoll;
+
+	/**
+	 * eventfd waking the worker for submitted commands, room in the received queue or the stop
+	 */
+	int wake;
+
+	/**
+	 * eventfd signalled once per round of the worker in which commands were received for the
+	 * application
+	 */
+	int ready;
+
+#if USE_RETRANSMIT_TIMER
+	/**
+	 * timerfd generating the ticks of the ports
+	 */
+	int tick;
+#endif
+
+	/**
+	 * The worker keeps running until gatewayStop()
+	 */
+	uint8_t running;
+
+	/**
+	 * The worker waits in epoll and has to be woken
+	 */
+	uint8_t sleeping;
+
+	/**
+	 * Room the oldest command not handed to the application yet needs in the received queue,
+	 * 0 if none waits for room
+	 */
+	uint16_t needed;
+
+	/**
+	 * Submitted commands dropped as they never fit into the transmit queue of their port
+	 */
+	uint32_t dropped;
+
+	/**
+	 * The ports of the worker
+	 */
+	uint8_t ports[UART_PORTS];
+	uint8_t portCount;
+
+	/**
+	 * The worker set its ports up, with error 0 if it runs
+	 */
+	uint8_t started;
+	int error;
+} __attribute__((aligned(64)));
+
+/**
+ * A command received on a port, copied out of the received queue
+ */
+struct GatewayMessage {
+	uint8_t port;
+	struct Command command;
+	uint8_t data[RX_QUEUE_SIZE];
+};
+
+extern struct GatewayWorker gatewayWorkers[GATEWAY_MAX_WORKERS];
+
+/**
+ * Uses an open descriptor (a tty or the side of a pseudo terminal) as the line of the port.
+ * Call it for every port before gatewayStart(), the line is attached by the worker of the port.
+ * Returns 0, or -1 with errno set
+ */
+int gatewayAttach(uint8_t port, int fd);
+
+/**
+ * Opens the tty or pseudo terminal at path as the line of the port, see gatewayAttach()
+ * Returns 0, or -1 with errno set
+ */
+int gatewayOpen(uint8_t port, const char* path);
+
+/**
+ * Starts the worker threads and shares the ports with a line out among them, one after the other.
+ * Every worker sets its ports up with UARTsetup() and runs their event loop until gatewayStop().
+ * Returns 0, or -1 with errno set and no worker running
+ */
+int gatewayStart(uint8_t workers);
+
+/**
+ * Stops the workers and closes the lines
+ */
+void gatewayStop();
+
+/**
+ * The worker running the port
+ */
+uint8_t gatewayWorkerOf(uint8_t port);
+
+/**
+ * Queues the command for transmission on the port, the worker of the port encodes it.
+ * Only one thread submits to a worker.
+ * Returns 0 if the submitted queue of the worker is full
+ */
+uint8_t gatewaySubmit(uint8_t port, struct Command* command);
+
+/**
+ * Takes the oldest command received by the worker, the data of the command points into the
+ * message. Only one thread receives from a worker.
+ * Returns 0 if none was received
+ */
+uint8_t gatewayReceive(uint8_t worker, struct GatewayMessage* message);
+
+/**
+ * Waits up to timeoutMs (-1 forever) until the worker received commands
+ * Returns 1 if there are commands to receive, 0 on timeout or -1 with errno set
+ */
+int gatewayWait(uint8_t worker, int timeoutMs);
+
+/**
+ * Descriptor becoming readable when the worker received commands, for waiting on several
+ * workers at once. Read its 8 byte counter, then take every command with gatewayReceive().
+ */
+int gatewayEventFd(uint8_t worker);
+
+#endif
+
+#endif /* UART_GATEWAY_H_ */
@@ -7,43 +7,282 @@
 
 #include "uart_hdw.h"
 
+#if ((UART_HARDWARE == UART_HARDWARE_AVR) && (UART_PORTS != 1))
+
+#define AVR_USART(n) { &HDW_UCSRA(n), &HDW_UCSRB(n), &HDW_UCSRC(n), &HDW_UBRRH(n), &HDW_UBRRL(n), \
+		&HDW_UDR(n) }
+
+const struct AvrUSART avrUSARTs[UART_PORTS] = {
+	AVR_USART(0),
+	AVR_USART(1),
+#if (UART_PORTS > 2)
+	AVR_USART(2),
+#endif
+#if (UART_PORTS > 3)
+	AVR_USART(3),
+#endif
+};
+
+#endif
+
+#if COMMAND_RESPONSE_MODEL
 /**
- * Setup the UART hardware
+ * Priority class of the frame the transmitter is in, the frames of the classes never interleave
+ * TX_FRAME_NONE - between two frames
+ * TX_FRAME_QUEUED - inside a frame of the transmit queue (bulk)
+ * TX_FRAME_CONTROL - inside a frame of the control lane
+ * TX_FRAME_HIGH - inside a frame of the high priority class
  */
-void hdwUARTSetup() {
-	//setup Baud rate
-	UBRRH = UBRR_VAL >> 8;
-	UBRRL = UBRR_VAL;
+#define TX_FRAME_NONE 0
+#define TX_FRAME_QUEUED 1
+#define TX_FRAME_CONTROL 2
+#define TX_FRAME_HIGH 3
+#endif
 
-	//setup the rx and tx pin
-	UCSRB |= (1 << RXEN | 1 << TXEN);
+#if (BAUD_RATE > F_CPU / 8)
+#error 'BAUD_RATE is above F_CPU / 8, the highest rate of the USART'
+#endif
+
+/**
+ * Error of the rate UBRR generates with the divisor (16, or 8 with U2X) from BAUD_RATE
+ */
+#define HDW_RATE(ubrr, divisor) (F_CPU / ((divisor) * ((ubrr) + 1)))
+#define HDW_RATE_ERROR(ubrr, divisor) ((HDW_RATE(ubrr, divisor) > BAUD_RATE) \
+		? (HDW_RATE(ubrr, divisor) - BAUD_RATE) : (BAUD_RATE - HDW_RATE(ubrr, divisor)))
+
+/**
+ * UARTsetup() runs BAUD_RATE in double speed mode only if that comes closer to it
+ */
+#if (HDW_RATE_ERROR(UBRR_VAL_U2X, 8UL) < HDW_RATE_ERROR(UBRR_VAL, 16UL))
+#define HDW_BAUD_SETTING (UBRR_VAL_U2X | HDW_BAUD_DOUBLE_SPEED)
+#if (UBRR_VAL_U2X > HDW_UBRR_MAX)
+#error 'BAUD_RATE is too low for UBRR at this F_CPU'
+#endif
+#else
+#define HDW_BAUD_SETTING UBRR_VAL
+#if (UBRR_VAL > HDW_UBRR_MAX)
+#error 'BAUD_RATE is too low for UBRR at this F_CPU'
+#endif
+#endif
+
+/**
+ * UCSRC shares its address with UBRRH on some parts, URSEL selects it when written
+ */
+#if defined(URSEL)
+#define HDW_UCSRC_SELECT (1 << URSEL)
+#else
+#define HDW_UCSRC_SELECT 0
+#endif
 
-	//setup parity to disabled and stop bits to 1
-	UCSRC &= ~(1 << UPM1 | 1 << UPM0 | 1 << USBS);
+/**
+ * Setup the UART hardware, the USART stays disabled
+ */
+void hdwUARTSetup(struct UART* uart) {
+	//the port n drives USARTn
+	HdwPort* port = HDW_PORT(uart - uartPorts);
+	uart->hardware = port;
+
+	//setup Baud rate, parity to disabled, stop bits to 1 and frame size to 8 bits
+	hdwUARTFormat(uart, HDW_BAUD_SETTING, UART_PARITY_NONE, 1, 8);
+
+#if (FLOW_CONTROL == FLOW_XON_XOFF)
+	uart->flowByte = 0;
+#endif
+
+#if COMMAND_RESPONSE_MODEL
+	uart->txFrame = TX_FRAME_NONE;
+#if (FRAMING == FRAMING_ESCAPE)
+	uart->txEscaped = 0;
+#endif
+#endif
+}
+
+/**
+ * Enable the receiver and the transmitter of the port with the format set
+ */
+void hdwUARTEnable(struct UART* uart) {
+	HdwPort* port = uart->hardware;
 
-	//setup frame size to 8 bits
-	UCSRB &= ~(1 << UCSZ2);
-	UCSRC |= (1 << UCSZ1 | 1 << UCSZ0);
+	//setup the rx and tx pin
+	UART_UCSRB(port) |= (1 << RXEN | 1 << TXEN);
 
 	//enable interrupt driven architecture if required
 #if INTERRUPT_DRIVEN
 	//enable interrupt
-	UCSRB |= 1 << RXCIE | 1 << TXCIE;
+	UART_UCSRB(port) |= 1 << RXCIE | 1 << TXCIE;
+
+#endif
 
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+	//RTS low, the partner may transmit
+	FLOW_RTS_PORT &= ~(1 << FLOW_RTS_BIT);
+	FLOW_RTS_DDR |= 1 << FLOW_RTS_BIT;
+	//interrupt on any change of CTS
+#if defined(EIMSK)
+	//external interrupts in their own registers
+	EICRA = (EICRA & ~(1 << ISC11)) | 1 << ISC10;
+	EIMSK |= 1 << INT1;
+#else
+	MCUCR = (MCUCR & ~(1 << ISC11)) | 1 << ISC10;
+	GICR |= 1 << INT1;
+#endif
 #endif
 }
 
+/**
+ * Find the closest baud setting, the rates closest to the baud rate are generated by the
+ * divider just below and just above it
+ */
+int16_t hdwBaudSetting(uint32_t baudRate, uint8_t speed, uint16_t* setting) {
+	//above the rate at UBRR 0 with U2X the error would pass 100% and the scaling below 32 bits
+	if (baudRate > F_CPU / 8) {
+		return UART_SETUP_INVALID;
+	}
+	uint32_t bestDifference = UINT32_MAX;
+	uint32_t bestRate = 0;
+	for (uint8_t doubleSpeed = 0; doubleSpeed < 2; doubleSpeed++) {
+		if (speed == (doubleSpeed ? UART_SPEED_NORMAL : UART_SPEED_DOUBLE)) {
+			continue;
+		}
+		//the rate at UBRR 0, normal speed is tried first so U2X has to come strictly closer
+		uint32_t clock = F_CPU / (doubleSpeed ? 8 : 16);
+		uint32_t divider = clock / baudRate;
+		for (uint32_t candidate = divider; candidate <= divider + 1; candidate++) {
+			if ((candidate == 0) || (candidate > HDW_UBRR_MAX + 1)) {
+				continue;
+			}
+			uint32_t rate = clock / candidate;
+			uint32_t difference = (rate > baudRate) ? (rate - baudRate) : (baudRate - rate);
+			if (difference < bestDifference) {
+				bestDifference = difference;
+				bestRate = rate;
+				*setting = (uint16_t) (candidate - 1) | (doubleSpeed ? HDW_BAUD_DOUBLE_SPEED : 0);
+			}
+		}
+	}
+	if (bestDifference == UINT32_MAX) {
+		return UART_SETUP_INVALID;
+	}
+	//hundredths of a percent in two steps to stay within 32 bits, the error is below 100%
+	uint32_t scaled = bestDifference * 100;
+	int16_t error = (int16_t) ((scaled / baudRate) * 100 + ((scaled % baudRate) * 100) / baudRate);
+	return (bestRate > baudRate) ? error : -error;
+}
+
+/**
+ * Set the line of the port, the USART is idle
+ */
+void hdwUARTFormat(struct UART* uart, uint16_t baudSetting, uint8_t parity, uint8_t stopBits,
+		uint8_t frameSize) {
+	HdwPort* port = uart->hardware;
+	uint16_t ubrr = baudSetting & ~HDW_BAUD_DOUBLE_SPEED;
+	UART_UBRRH(port) = ubrr >> 8;
+	UART_UBRRL(port) = ubrr;
+	if (baudSetting & HDW_BAUD_DOUBLE_SPEED) {
+		UART_UCSRA(port) |= 1 << U2X;
+	} else {
+		UART_UCSRA(port) &= ~(1 << U2X);
+	}
+
+	//UCSRC is written whole, the bits of parity, stop bits and frame size follow each other
+	UART_UCSRC(port) = HDW_UCSRC_SELECT | parity << UPM0 | (stopBits - 1) << USBS
+			| (frameSize - 5) << UCSZ0;
+	UART_UCSRB(port) &= ~(1 << UCSZ2);
+}
+
+#if USE_FLOW_SIGNALS
+
+/**
+ * Whether the partner lets this device transmit
+ */
+static uint8_t hdwPartnerReady(struct UART* uart) {
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+	//RTS/CTS is only wired to the single port
+	(void) uart;
+	return !(FLOW_CTS_PIN & (1 << FLOW_CTS_BIT));
+#else
+	return !(uart->status & COM_STATUS_PARTNER_STOPPED);
+#endif
+}
+
+/**
+ * Stop the partner, XOFF goes out ahead of the queued data
+ */
+void hdwFlowStop(struct UART* uart) {
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+	(void) uart;
+	FLOW_RTS_PORT |= 1 << FLOW_RTS_BIT;
+#else
+	uart->flowByte = FLOW_XOFF;
+	UART_UCSRB(uart->hardware) |= 1 << UDRIE;
+#endif
+}
+
+/**
+ * Let the partner continue
+ */
+void hdwFlowStart(struct UART* uart) {
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+	(void) uart;
+	FLOW_RTS_PORT &= ~(1 << FLOW_RTS_BIT);
+#else
+	uart->flowByte = FLOW_XON;
+	UART_UCSRB(uart->hardware) |= 1 << UDRIE;
+#endif
+}
+
+#endif
+
+#if USE_TICK_TIMER0
+
+#if ((TIMER0_COMPARE_VAL < 1) || (TIMER0_COMPARE_VAL > 255))
+#error 'TICK_PERIOD_MS can not be generated by Timer0 at this F_CPU, use TICK_EXTERNAL'
+#endif
+
+/**
+ * Setup Timer0 to raise a compare match every TICK_PERIOD_MS
+ */
+void hdwTimerSetup() {
+	//clear timer on compare match with a prescaler of 1024
+#if defined(TCCR0A)
+	//Timer0 with two compare units
+	TCCR0A = 1 << WGM01;
+	TCCR0B = 1 << CS02 | 1 << CS00;
+	OCR0A = TIMER0_COMPARE_VAL;
+	TIMSK0 |= 1 << OCIE0A;
+#else
+	TCCR0 = 1 << WGM01 | 1 << CS02 | 1 << CS00;
+	OCR0 = TIMER0_COMPARE_VAL;
+	TIMSK |= 1 << OCIE0;
+#endif
+}
+
+#endif
+
 /**
  * Check if the UART hardware is busy
  * returns an uint8_t that determines whether both rx and tx are busy or not
  */
-uint8_t hdwIsBusyUART() {
+uint8_t hdwIsBusyUART(struct UART* uart) {
 	uint8_t result = 0x00;
 	//determine if the TX is busy or not
-	if(status & COM_STATUS_TRANSMITTING){
+#if INTERRUPT_DRIVEN
+	if(uart->status & COM_STATUS_TRANSMITTING){
+		result |= TX_BUSY;
+	}
+#if USE_FLOW_SIGNALS
+	if(!hdwPartnerReady(uart)){
+		//the partner can not take anything now
+		result |= TX_BUSY;
+	}
+#endif
+#else
+	if (!(UART_UCSRA(uart->hardware) & (1 << UDRE))) {
+		//transmit buffer still full
 		result |= TX_BUSY;
 	}
-	if (!(UCSRA & (1 << RXC))) {
+#endif
+	if (!(UART_UCSRA(uart->hardware) & (1 << RXC))) {
 		//data not received yet
 		result |= RX_BUSY;
 	}
@@ -53,160 +292,369 @@ uint8_t hdwIsBusyUART() {
 /**
  * Interrupt driven design does not need to wait
  */
-#if (INTERRUPT_DRIVEN && USE_QUEUE)
+#if INTERRUPT_DRIVEN
 
 /**
- * Transmit data directly on the hardware
+ * Transmit data directly on the hardware, the line stays busy until the TXC interrupt
  */
-inline void hdwTransmitUART(uint8_t data) {
-	if(!(status & COM_STATUS_TRANSMITTING)){
-		status |= COM_STATUS_TRANSMITTING;
-	}
-	if(UCSRA & (1<<UDRE)){
-		UDR = data;
-	}
+void hdwTransmitUART(struct UART* uart, uint8_t data) {
+	HdwPort* port = uart->hardware;
+	//wait for room in the transmit buffer, the UDRE interrupt never waits
+	while (!(UART_UCSRA(port) & (1 << UDRE)))
+	;
+	uart->status |= COM_STATUS_TRANSMITTING;
+	UART_WRITE_UDR(port, data);
+#if (!USE_QUEUE)
+	//ask the user program for the next byte as soon as the buffer is free again
+	UART_UCSRB(port) |= 1 << UDRIE;
+#endif
 }
 
 /**
  * Receive data directly from the hardware
  */
-inline uint8_t hdwReceiveUART(void) {
-	return UDR;
+uint8_t hdwReceiveUART(struct UART* uart) {
+	return UART_READ_UDR(uart->hardware);
 }
 
-ISR(USART_RXC_vect) {
+/**
+ * Interrupt Service Routine for UART Receive Complete of the port
+ */
+static void hdwReceiveInterrupt(struct UART* uart) {
 
 	//read the received data even though it might be lost
-	uint8_t data = hdwReceiveUART();
+	uint8_t data = hdwReceiveUART(uart);
 
-#if USE_QUEUE
-
-	uint8_t uartStatus = UARTstatus();
-
-	//using queue so enqueue into queue
-	if (!(uartStatus & RX_QUEUE_FULL)) {
-
-		//enqueue data in every case
-		enqueue(&rxQueue, data);
-#if (!COMMAND_RESPONSE_MODEL)
-		//command response mode is not implemented  but queue is used
-		//so notify the user program that the queue is full
-		uartStatus = UARTstatus();
-		if(uartStatus & RX_QUEUE_FULL) {
-			(*rxcHandler)();
-		}
+#if (FLOW_CONTROL == FLOW_XON_XOFF)
+	//flow control bytes never reach the queue
+	if (data == FLOW_XOFF) {
+		uart->status |= COM_STATUS_PARTNER_STOPPED;
+		return;
+	}
+	if (data == FLOW_XON) {
+		uart->status &= ~COM_STATUS_PARTNER_STOPPED;
+		UART_UCSRB(uart->hardware) |= 1 << UDRIE;
+		return;
+	}
 #endif
 
-		//if this is command response model check for command endpoints
 #if COMMAND_RESPONSE_MODEL
-		//TODO supposition of no escape sequence key
-		if (data == COM_END) {
+
+	//advance the parser, the command is queued as soon as its end arrives
+	uint8_t result = parseCommandByte(uart, data);
+	struct Command* command = &uart->commandParser.command;
+#if USE_SLIDING_WINDOW
+	if ((result == COMMAND_COMPLETE) && (command->commandCode == COM_ACK)) {
+		//free the window right away, its data is not kept
+		acknowledgeReceived(uart, command);
+	} else
+#endif
+	if (result != COMMAND_INCOMPLETE) {
+		if ((result == COMMAND_COMPLETE) && UARTqueueCommand(uart, command)) {
+			//keep the data in the receive queue until the command is handled
+			commitCommandData(uart);
+#if (!DEFERRED_DISPATCH)
 			//the command ended invoke the standard message handler
-			standardMessageHandler();
-		}
+			standardMessageHandler(uart);
+#endif
+		} else {
+			//command or receive queue is full and the command is lost even though the partner
+			//was stopped at the high watermark
+#if (USE_COMMAND_NUMBERING && (!USE_SLIDING_WINDOW))
+			if (COMMAND_IS_NUMBERED(command->commandCode)) {
+				//the partner counted it, the main loop skips its number before the next command
+				uart->commandQueue.pendingLost++;
+			}
 #endif
-	}
-#if COMMAND_RESPONSE_MODEL
-	else {
-		//RX queue is full transmit WAIT command
-		//try and transmit it until successful
-		//enable interrupt so that transmission can occur as planned
-		//first read data from UDR so as to clear RXC flag
-		status |= COM_STATUS_PARTNER_WAITING;
-
-		struct Command command;
-		initCommand(&command);
-
-		command.commandCode = COM_WAIT;
-#if USE_COMMAND_NUMBERING
-		addCommandData(&command, outCommandNumber);
-		addCommandData(&command, incCommandNumber);
-#endif
-		transmitCommandForced(&command);
-
-		if (data == COM_END) {
-			//The command has ended whatsoever
-			standardMessageHandler();
 		}
-#if USE_COMMAND_NUMBERING
-		else{
-			//a command was sent but nothing was done for it
-			incCommandNumber++;
+	}
+
+#elif USE_QUEUE
+
+	//using queue so enqueue into queue
+	if (enqueue(&uart->rxQueue, data)) {
+		//notify the user program when the queue is full
+		if(queueSpace(&uart->rxQueue) == 0) {
+			(*uart->rxcHandler)(uart);
 		}
-#endif
 	}
-#endif
 #else
 	// not using queue
-	(*rxcHandler)(data);
+	(*uart->rxcHandler)(uart, data);
+#endif
+#if USE_FLOW_WATERMARKS
+	UARTcheckFlow(uart);
+#endif
+}
+
+#if USE_QUEUE
+
+void hdwBeginTransmit(struct UART* uart) {
+	UART_UCSRB(uart->hardware) |= 1 << UDRIE;
+}
+
+#endif
+
+#if COMMAND_RESPONSE_MODEL
+
+/**
+ * Transmits a byte of a frame from the queue, following the frame boundaries
+ */
+static void hdwTransmitFrameByte(struct UART* uart, uint8_t data, uint8_t queue) {
+	uart->txFrame = queue;
+#if (FRAMING == FRAMING_ESCAPE)
+	if (uart->txEscaped) {
+		uart->txEscaped = 0;
+	} else if (data == COM_ESCAPE_CHAR) {
+		uart->txEscaped = 1;
+	} else if (data == COM_END) {
+		uart->txFrame = TX_FRAME_NONE;
+	}
+#else
+	if (data == COM_FRAME_END) {
+		uart->txFrame = TX_FRAME_NONE;
+	}
 #endif
+	hdwTransmitUART(uart, data);
 }
 
 /**
- * Interrupt Service Routine for UART Data transmission complete
+ * Picks the class of the next byte: the frame in progress is completed first, then the control
+ * lane, the high priority class and the transmit queue follow in that order.
+ * Returns TX_FRAME_NONE if nothing can be transmitted now
  */
-ISR(USART_TXC_vect) {
-	//enable interrupt for Data Register Empty
-	status &= ~COM_STATUS_TRANSMITTING;
-#if COMMAND_RESPONSE_MODEL
-	//TODO not wait until this command has been completely transmitted
-	if(status & COM_STATUS_REQUEST_SELF_WAIT){
-		//requested self wait
-		if(peekQueueHead(&txQueue) == COM_END){
-			//the currently waiting byte to be transmitted is COM_END
-			//transmit this data and then stop transmission
-			status &= ~ COM_STATUS_REQUEST_SELF_WAIT;
-			status |= COM_STATUS_SELF_WAITING;
-		}
-		//enable transmission for both cases
-		UCSRB |= 1 << UDRIE;
-	}else if (!(status & COM_STATUS_SELF_WAITING)) {
-		//if the communication stream has not sent wait signal
+static uint8_t hdwNextFrameClass(struct UART* uart) {
+	if ((uart->txFrame == TX_FRAME_QUEUED) && (queueCount(&uart->txQueue) == 0)) {
+		//a frame written byte by byte with UARTtransmit(), wait for the rest of it
+		return TX_FRAME_NONE;
+	}
+	if (uart->txFrame != TX_FRAME_NONE) {
+		//the priority classes are queued whole
+		return uart->txFrame;
+	}
+	if (queueCount(&uart->controlQueue) != 0) {
+		return TX_FRAME_CONTROL;
+	}
+	if (uart->status & COM_STATUS_REQUEST_SELF_WAIT) {
+		//the partner asked to wait, the frame in progress was completed
+		uart->status &= ~COM_STATUS_REQUEST_SELF_WAIT;
+		uart->status |= COM_STATUS_SELF_WAITING;
+	}
+	if (uart->status & COM_STATUS_SELF_WAITING) {
+		//only control commands reach a waiting partner
+		return TX_FRAME_NONE;
+	}
+	if (queueCount(&uart->highQueue) != 0) {
+		return TX_FRAME_HIGH;
+	}
+	if (queueCount(&uart->txQueue) != 0) {
+		return TX_FRAME_QUEUED;
+	}
+	return TX_FRAME_NONE;
+}
+
 #endif
-		UCSRB |= 1 << UDRIE;
+
+/**
+ * Interrupt Service Routine for UART Data transmission complete of the port. The UDRE interrupt
+ * refills the transmit buffer while a byte is shifted out, so this only fires once the line went
+ * idle: at the end of the queued data or when the transmission is held. Data queued after the
+ * UDRE interrupt gave up keeps the line busy and is transmitted.
+ */
+static void hdwTransmitCompleteInterrupt(struct UART* uart) {
 #if COMMAND_RESPONSE_MODEL
+	if (hdwNextFrameClass(uart) != TX_FRAME_NONE) {
+		hdwBeginTransmit(uart);
+		return;
+	}
+#elif USE_QUEUE
+	if (queueCount(&uart->txQueue) != 0) {
+		hdwBeginTransmit(uart);
+		return;
 	}
 #endif
+	uart->status &= ~COM_STATUS_TRANSMITTING;
 }
 
 /**
- * Interrupt Service Routine for UDRE. write data only if the UDR is ready to receive data
+ * Interrupt Service Routine for UDRE of the port. write data only if the UDR is ready to receive data
  */
-ISR(USART_UDRE_vect) {
+static void hdwDataEmptyInterrupt(struct UART* uart) {
 #if USE_QUEUE
-	uint8_t uartStatus = UARTstatus();
+	//the interrupt stays enabled while there is data, refilling the buffer during every byte
+	uint8_t sent = 1;
+#if (FLOW_CONTROL == FLOW_XON_XOFF)
+	if (uart->flowByte) {
+		//flow control goes ahead of the queued data, even while the partner stopped this device
+		hdwTransmitUART(uart, uart->flowByte);
+		uart->flowByte = 0;
+	} else
+#endif
+#if USE_FLOW_SIGNALS
+	if (!hdwPartnerReady(uart)) {
+		//the partner stopped this device, transmission continues once it is ready
+		sent = 0;
+	} else
+#endif
+#if COMMAND_RESPONSE_MODEL
+	{
+		//the highest class with data goes, between two frames
+		switch (hdwNextFrameClass(uart)) {
+		case TX_FRAME_CONTROL:
+			hdwTransmitFrameByte(uart, dequeue(&uart->controlQueue), TX_FRAME_CONTROL);
+#if (USE_FLOW_WATERMARKS && (!USE_FLOW_SIGNALS))
+			if (uart->txFrame == TX_FRAME_NONE) {
+				//a COM_WAIT or COM_RESUME that found the control lane full is tried again, a
+				//stopped partner transmits nothing that would run UARTcheckFlow() on receive
+				UARTcheckFlow(uart);
+			}
+#endif
+			break;
+		case TX_FRAME_HIGH:
+			hdwTransmitFrameByte(uart, dequeue(&uart->highQueue), TX_FRAME_HIGH);
+			break;
+		case TX_FRAME_QUEUED:
+			hdwTransmitFrameByte(uart, dequeue(&uart->txQueue), TX_FRAME_QUEUED);
+			break;
+		default:
+			sent = 0;
+			break;
+		}
+	}
+#else
 	//using queue so dequeue from queue
-	if (!(uartStatus & TX_QUEUE_EMPTY)) {
+	if (queueCount(&uart->txQueue) != 0) {
 		//there is data remaining to be transmitted
-		hdwTransmitUART(dequeue(&txQueue));
+		hdwTransmitUART(uart, dequeue(&uart->txQueue));
+	} else {
+		sent = 0;
+	}
+#endif
+	if (!sent) {
+		//nothing to transmit now, queuing data enables the interrupt again
+		UART_UCSRB(uart->hardware) &= ~(1 << UDRIE);
 	}
 #else
-	//not using queue so notify user that the rxc was completed
-	(*txcHandler)();
+	//not using queue so notify user that the byte left the buffer, it may transmit the next one
+	UART_UCSRB(uart->hardware) &= ~(1 << UDRIE);
+	(*uart->txcHandler)(uart);
 #endif
-	//disable UDR empty interrupt
-	UCSRB &= ~(1 << UDRIE);
 }
 
+#if (UART_HARDWARE == UART_HARDWARE_AVR)
+
+/**
+ * Vectors of the USART of port n, each one hands the context of its port to the handlers
+ */
+#define HDW_PORT_VECTORS(n) \
+	ISR(UART##n##_RXC_vect) { \
+		hdwReceiveInterrupt(&uartPorts[n]); \
+	} \
+	ISR(UART##n##_UDRE_vect) { \
+		hdwDataEmptyInterrupt(&uartPorts[n]); \
+	} \
+	ISR(UART##n##_TXC_vect) { \
+		hdwTransmitCompleteInterrupt(&uartPorts[n]); \
+	}
+
+HDW_PORT_VECTORS(0)
+#if (UART_PORTS > 1)
+HDW_PORT_VECTORS(1)
+#endif
+#if (UART_PORTS > 2)
+HDW_PORT_VECTORS(2)
+#endif
+#if (UART_PORTS > 3)
+HDW_PORT_VECTORS(3)
+#endif
+
+#else
+
+/**
+ * Vectors of the ports handed to another front end with hdwSetVectors()
+ */
+static struct HdwVectors {
+	void (*vectors)(void* context, uint8_t vector);
+	void* context;
+} hdwVectors[UART_PORTS];
+
+void hdwSetVectors(uint8_t port, void (*vectors)(void* context, uint8_t vector), void* context) {
+	hdwVectors[port].context = context;
+	hdwVectors[port].vectors = vectors;
+}
+
+/**
+ * The host backends run the vectors of any number of ports through this single entry
+ */
+void hdwInterrupt(struct UART* uart, uint8_t vector) {
+	struct HdwVectors* handed = &hdwVectors[uart - uartPorts];
+	if (handed->vectors) {
+		//the port is driven by another front end
+		(*handed->vectors)(handed->context, vector);
+		return;
+	}
+	switch (vector) {
+	case HOST_VECTOR_RXC:
+		hdwReceiveInterrupt(uart);
+		break;
+	case HOST_VECTOR_UDRE:
+		hdwDataEmptyInterrupt(uart);
+		break;
+	case HOST_VECTOR_TXC:
+		hdwTransmitCompleteInterrupt(uart);
+		break;
+	}
+}
+
+#endif
+
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+
+/**
+ * Interrupt Service Routine for a change of CTS, restarts the transmission once it is low.
+ * RTS/CTS is only wired to the single port.
+ */
+ISR(INT1_vect) {
+	struct UART* uart = &uartPorts[0];
+	if (hdwPartnerReady(uart)) {
+		UART_UCSRB(uart->hardware) |= 1 << UDRIE;
+	}
+}
+
+#endif
+
+#if USE_TICK_TIMER0
+
+/**
+ * Interrupt Service Routine for the Timer0 compare match, drives the retransmissions of every port
+ */
+ISR(TIMER0_COMP_vect) {
+	for (uint8_t i = 0; i < UART_PORTS; i++) {
+		UARTtick(&uartPorts[i]);
+	}
+}
+
+#endif
+
 #else
 /**
  * Transmit from the hardware
  */
-void hdwTransmitUART(uint8_t data) {
+void hdwTransmitUART(struct UART* uart, uint8_t data) {
 	//wait for the transmitter to be ready
-	while (!(UCSRA & (1 << UDRE)))
+	while (!(UART_UCSRA(uart->hardware) & (1 << UDRE)))
 	;
-	UDR = data;
+	UART_WRITE_UDR(uart->hardware, data);
 }
 
 /**
  * Receive from the hardware
  */
-uint8_t hdwReceiveUART(void) {
+uint8_t hdwReceiveUART(struct UART* uart) {
 	//wait for data to be received
-	while (!(UCSRA & (1 << RXC)))
+	while (!(UART_UCSRA(uart->hardware) & (1 << RXC)))
 	;
-	return UDR;
+	return UART_READ_UDR(uart->hardware);
 }
 
 #endif
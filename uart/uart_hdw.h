@@ -7,14 +7,162 @@
 
 #ifndef UART_HDW_H_
 #define UART_HDW_H_
-#include <avr/io.h>
-#include "uart.h"
 #include "config.h"
 
+/**
+ * Every backend provides the hardware of a port (HdwPort), HDW_PORT(index) finding it, and the
+ * access to its registers: UART_UCSRA(port), UART_UCSRB(port), UART_UCSRC(port), UART_UBRRH(port),
+ * UART_UBRRL(port), UART_WRITE_UDR(port, data) and UART_READ_UDR(port). The vectors of port n
+ * are UARTn_RXC_vect, UARTn_UDRE_vect and UARTn_TXC_vect.
+ */
+#if (UART_HARDWARE == UART_HARDWARE_AVR)
+#include <avr/io.h>
 #if INTERRUPT_DRIVEN
 #include <avr/interrupt.h>
 #endif
 
+#if defined(UDR0)
+//parts numbering their USARTs (ATmega328P, ATmega644P, ATmega2560)
+#define HDW_UCSRA(n) UCSR##n##A
+#define HDW_UCSRB(n) UCSR##n##B
+#define HDW_UCSRC(n) UCSR##n##C
+#define HDW_UBRRH(n) UBRR##n##H
+#define HDW_UBRRL(n) UBRR##n##L
+#define HDW_UDR(n) UDR##n
+
+//the register bits are numbered as well, they are the same for every USART
+#if (!defined(RXC))
+#define RXC RXC0
+#define TXC TXC0
+#define UDRE UDRE0
+#define DOR DOR0
+#define U2X U2X0
+#define RXCIE RXCIE0
+#define TXCIE TXCIE0
+#define UDRIE UDRIE0
+#define RXEN RXEN0
+#define TXEN TXEN0
+#define UCSZ2 UCSZ02
+#define UPM1 UPM01
+#define UPM0 UPM00
+#define USBS USBS0
+#define UCSZ1 UCSZ01
+#define UCSZ0 UCSZ00
+#endif
+
+#if defined(USART0_RX_vect)
+#define UART0_RXC_vect USART0_RX_vect
+#define UART0_UDRE_vect USART0_UDRE_vect
+#define UART0_TXC_vect USART0_TX_vect
+#define UART1_RXC_vect USART1_RX_vect
+#define UART1_UDRE_vect USART1_UDRE_vect
+#define UART1_TXC_vect USART1_TX_vect
+#define UART2_RXC_vect USART2_RX_vect
+#define UART2_UDRE_vect USART2_UDRE_vect
+#define UART2_TXC_vect USART2_TX_vect
+#define UART3_RXC_vect USART3_RX_vect
+#define UART3_UDRE_vect USART3_UDRE_vect
+#define UART3_TXC_vect USART3_TX_vect
+#else
+//a single numbered USART (ATmega328P)
+#define UART0_RXC_vect USART_RX_vect
+#define UART0_UDRE_vect USART_UDRE_vect
+#define UART0_TXC_vect USART_TX_vect
+#endif
+
+#else
+//parts with a single USART (ATmega16/32)
+#define HDW_UCSRA(n) UCSRA
+#define HDW_UCSRB(n) UCSRB
+#define HDW_UCSRC(n) UCSRC
+#define HDW_UBRRH(n) UBRRH
+#define HDW_UBRRL(n) UBRRL
+#define HDW_UDR(n) UDR
+
+#define UART0_RXC_vect USART_RXC_vect
+#define UART0_UDRE_vect USART_UDRE_vect
+#define UART0_TXC_vect USART_TXC_vect
+#endif
+
+#if ((!defined(TIMER0_COMP_vect)) && defined(TIMER0_COMPA_vect))
+//Timer0 with two compare units, unit A generates the ticks
+#define TIMER0_COMP_vect TIMER0_COMPA_vect
+#endif
+
+#if (UART_PORTS == 1)
+
+/**
+ * The registers of a single USART are addressed directly
+ */
+typedef const void HdwPort;
+
+#define HDW_PORT(index) ((HdwPort*) 0)
+#define UART_UCSRA(port) HDW_UCSRA(0)
+#define UART_UCSRB(port) HDW_UCSRB(0)
+#define UART_UCSRC(port) HDW_UCSRC(0)
+#define UART_UBRRH(port) HDW_UBRRH(0)
+#define UART_UBRRL(port) HDW_UBRRL(0)
+#define UART_WRITE_UDR(port, data) (HDW_UDR(0) = (data))
+#define UART_READ_UDR(port) (HDW_UDR(0))
+
+#else
+
+/**
+ * Registers of a USART, the USARTs of a part are addressed through them
+ */
+struct AvrUSART {
+	volatile uint8_t* ucsra;
+	volatile uint8_t* ucsrb;
+	volatile uint8_t* ucsrc;
+	volatile uint8_t* ubrrh;
+	volatile uint8_t* ubrrl;
+	volatile uint8_t* udr;
+};
+
+typedef const struct AvrUSART HdwPort;
+
+extern const struct AvrUSART avrUSARTs[UART_PORTS];
+
+#define HDW_PORT(index) (&avrUSARTs[index])
+#define UART_UCSRA(port) (*(port)->ucsra)
+#define UART_UCSRB(port) (*(port)->ucsrb)
+#define UART_UCSRC(port) (*(port)->ucsrc)
+#define UART_UBRRH(port) (*(port)->ubrrh)
+#define UART_UBRRL(port) (*(port)->ubrrl)
+#define UART_WRITE_UDR(port, data) (*(port)->udr = (data))
+#define UART_READ_UDR(port) (*(port)->udr)
+
+#endif
+
+/**
+ * Keep the interrupts out of a short section, restoring their previous state afterwards
+ */
+#define UART_CRITICAL_BEGIN() uint8_t criticalSreg = SREG; cli()
+#define UART_CRITICAL_END() (SREG = criticalSreg)
+
+#elif (UART_HARDWARE == UART_HARDWARE_SIM)
+#include "uart_sim.h"
+#elif (UART_HARDWARE == UART_HARDWARE_POSIX)
+#include "uart_posix.h"
+#else
+#error 'Unknown UART hardware backend'
+#endif
+
+/**
+ * Surrounds the producers of the transmit queue and the window. With the message handlers running
+ * in the receive interrupt (DEFERRED_DISPATCH 0) they transmit into both as well, so the main loop
+ * keeps the interrupts out from reserving the room to publishing the frame.
+ */
+#if (COMMAND_RESPONSE_MODEL && (!DEFERRED_DISPATCH))
+#define UART_PRODUCER_BEGIN() UART_CRITICAL_BEGIN()
+#define UART_PRODUCER_END() UART_CRITICAL_END()
+#else
+#define UART_PRODUCER_BEGIN()
+#define UART_PRODUCER_END()
+#endif
+
+#include "uart.h"
+
 #if COMMAND_RESPONSE_MODEL
 #include "../commands.h"
 #endif
@@ -23,22 +171,85 @@
 #include "../utils/Queue.h"
 #endif
 
-void hdwUARTSetup();
+struct UART;
+
+/**
+ * Setup the hardware of the port, binding it to its USART at BAUD_RATE, 8N1. The USART stays
+ * disabled until hdwUARTEnable().
+ */
+void hdwUARTSetup(struct UART* uart);
+
+/**
+ * Enables the receiver, the transmitter and their interrupts once the format is set
+ */
+void hdwUARTEnable(struct UART* uart);
+
+/**
+ * The highest value of the 12 bit UBRR, and the flag of a baud setting in double speed mode
+ */
+#define HDW_UBRR_MAX 4095
+#define HDW_BAUD_DOUBLE_SPEED 0x8000
+
+/**
+ * Finds the UBRR (and U2X) coming closest to the baud rate at F_CPU in the modes speed
+ * (UART_SPEED_*) allows. Returns the error in hundredths of a percent with the setting, or
+ * UART_SETUP_INVALID if UBRR can not generate the baud rate
+ */
+int16_t hdwBaudSetting(uint32_t baudRate, uint8_t speed, uint16_t* setting);
+
+/**
+ * Sets the line of the port: the baud setting of hdwBaudSetting(), parity (UART_PARITY_*),
+ * 1 or 2 stop bits and 5 to 8 bit characters
+ */
+void hdwUARTFormat(struct UART* uart, uint16_t baudSetting, uint8_t parity, uint8_t stopBits,
+		uint8_t frameSize);
 
 /**
  * Checks if the hardware is busy or not
  */
-uint8_t hdwIsBusyUART();
+uint8_t hdwIsBusyUART(struct UART* uart);
 
 /**
  * Transmit 8 bit data into the UART hardware stream.
  */
-void hdwTransmitUART(uint8_t);
+void hdwTransmitUART(struct UART* uart, uint8_t data);
 
 /**
  * Read received data from the hardware direct
  */
-uint8_t hdwReceiveUART(void);
+uint8_t hdwReceiveUART(struct UART* uart);
+
+#if (USE_QUEUE && INTERRUPT_DRIVEN)
+
+/**
+ * Lets the UDRE interrupt drain the queued data, from the control lane first
+ */
+void hdwBeginTransmit(struct UART* uart);
+
+#endif
+
+#if USE_FLOW_SIGNALS
+
+/**
+ * Stops the partner with RTS or XOFF
+ */
+void hdwFlowStop(struct UART* uart);
+
+/**
+ * Lets the partner continue with RTS or XON
+ */
+void hdwFlowStart(struct UART* uart);
+
+#endif
+
+#if USE_TICK_TIMER0
+
+/**
+ * Starts Timer0 generating the ticks of UARTtick(), it ticks every port
+ */
+void hdwTimerSetup();
+
+#endif
 
 
 #endif /* UART_HDW_H_ */
@@ -0,0 +1,121 @@
+/*
+ * uart_host.h
+ */
+
+#ifndef UART_HOST_H_
+#define UART_HOST_H_
+
+#include <inttypes.h>
+
+/**
+ * The host backends (UART_HARDWARE_SIM and UART_HARDWARE_POSIX) emulate the registers of the
+ * AVR USART, so uart_hdw.c runs on them unchanged
+ */
+
+/**
+ * Clock of the emulated micro controller, the register values are derived from it
+ */
+#if (!defined(F_CPU))
+#define F_CPU 16000000UL
+#endif
+
+/**
+ * ------------------------------------------
+ * Register bits of the USART (same as ATmega16/32)
+ * ------------------------------------------
+ */
+
+//UCSRA
+#define RXC 7
+#define TXC 6
+#define UDRE 5
+#define FE 4
+#define DOR 3
+#define PE 2
+#define U2X 1
+#define MPCM 0
+
+//UCSRB
+#define RXCIE 7
+#define TXCIE 6
+#define UDRIE 5
+#define RXEN 4
+#define TXEN 3
+#define UCSZ2 2
+#define RXB8 1
+#define TXB8 0
+
+//UCSRC
+#define URSEL 7
+#define UMSEL 6
+#define UPM1 5
+#define UPM0 4
+#define USBS 3
+#define UCSZ1 2
+#define UCSZ0 1
+#define UCPOL 0
+
+/**
+ * ------------------------------------------
+ * Register bits of Timer0 (compare match mode only)
+ * ------------------------------------------
+ */
+
+//TCCR0
+#define WGM01 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+
+//TIMSK
+#define OCIE0 1
+
+//TIFR
+#define OCF0 1
+
+/**
+ * ------------------------------------------
+ * Register bits of port D and INT1 (any change mode only)
+ * ------------------------------------------
+ */
+
+//MCUCR
+#define ISC11 3
+#define ISC10 2
+
+//GICR
+#define INT1 7
+
+//GIFR
+#define INTF1 7
+
+/**
+ * ------------------------------------------
+ * Interrupt vectors
+ * ------------------------------------------
+ */
+
+void TIMER0_COMP_vect(void);
+void INT1_vect(void);
+
+/**
+ * Vectors of a USART
+ */
+#define HOST_VECTOR_RXC 0
+#define HOST_VECTOR_UDRE 1
+#define HOST_VECTOR_TXC 2
+
+struct UART;
+
+/**
+ * Runs a vector of the USART of a port, uart_hdw.c defines it for any number of ports
+ */
+void hdwInterrupt(struct UART* uart, uint8_t vector);
+
+/**
+ * Hands the vectors of the port to another front end (the Uart<> of Uart.hpp), they call
+ * vectors with its context instead of the handlers of uart_hdw.c. Null vectors give it back.
+ */
+void hdwSetVectors(uint8_t port, void (*vectors)(void* context, uint8_t vector), void* context);
+
+#endif /* UART_HOST_H_ */
@@ -0,0 +1,519 @@
+/*
+ * uart_posix.c
+ */
+
+#include "uart_hdw.h"
+
+#if (UART_HARDWARE == UART_HARDWARE_POSIX)
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/timerfd.h>
+
+struct PosixUSART posixUSARTs[UART_PORTS];
+struct PosixMCU posixMCU = { .timer = -1 };
+_Thread_local struct PosixLoop posixLoop = { .epoll = -1 };
+
+/**
+ * Number of event loops running
+ */
+static uint8_t posixLoops;
+
+/**
+ * Events taken from epoll at once
+ */
+#define POSIX_EVENTS 64
+
+/**
+ * termios speed of the baud rate, 0 if the tty does not support it
+ */
+static speed_t posixSpeed(unsigned long baud) {
+	switch (baud) {
+	case 1200:
+		return B1200;
+	case 2400:
+		return B2400;
+	case 4800:
+		return B4800;
+	case 9600:
+		return B9600;
+	case 19200:
+		return B19200;
+	case 38400:
+		return B38400;
+	case 57600:
+		return B57600;
+	case 115200:
+		return B115200;
+#ifdef B230400
+	case 230400:
+		return B230400;
+#endif
+#ifdef B460800
+	case 460800:
+		return B460800;
+#endif
+#ifdef B500000
+	case 500000:
+		return B500000;
+#endif
+#ifdef B921600
+	case 921600:
+		return B921600;
+#endif
+#ifdef B1000000
+	case 1000000:
+		return B1000000;
+#endif
+#ifdef B2000000
+	case 2000000:
+		return B2000000;
+#endif
+#ifdef B3000000
+	case 3000000:
+		return B3000000;
+#endif
+#ifdef B4000000
+	case 4000000:
+		return B4000000;
+#endif
+	}
+	return 0;
+}
+
+/**
+ * Whether the tty is a pseudo terminal by its device number: the master from /dev/ptmx (5, 2),
+ * Unix98 masters and slaves (128 to 143) and BSD style ones (2 and 3)
+ */
+static uint8_t posixPseudoTerminal(int fd) {
+	struct stat status;
+	if (fstat(fd, &status)) {
+		return 0;
+	}
+	unsigned int type = major(status.st_rdev);
+	return ((type == 5) && (minor(status.st_rdev) == 2)) || ((type >= 128) && (type <= 143))
+			|| (type == 2) || (type == 3);
+}
+
+/**
+ * Raw 8N1 mode at BAUD_RATE. A pseudo terminal ignores the speed, it keeps its own if termios
+ * has none for BAUD_RATE.
+ */
+static int posixConfigure(int fd) {
+	struct termios tio;
+	if (tcgetattr(fd, &tio)) {
+		return -1;
+	}
+	speed_t speed = posixSpeed(BAUD_RATE);
+	if (!speed && !posixPseudoTerminal(fd)) {
+		errno = EINVAL;
+		return -1;
+	}
+	cfmakeraw(&tio);
+	if (speed) {
+		cfsetispeed(&tio, speed);
+		cfsetospeed(&tio, speed);
+	}
+	tio.c_cflag |= CLOCAL | CREAD;
+	//the descriptor does not block, with VMIN 1 an empty read is EAGAIN and 0 is a hang up
+	tio.c_cc[VMIN] = 1;
+	tio.c_cc[VTIME] = 0;
+	return tcsetattr(fd, TCSANOW, &tio);
+}
+
+/**
+ * Closes the event loop of the thread once no port is attached to it anymore, and Timer0 with
+ * the loop it runs in
+ */
+static void posixStopLoop() {
+	if (posixLoop.ports || (posixLoop.epoll < 0)) {
+		return;
+	}
+	close(posixLoop.epoll);
+	posixLoop.epoll = -1;
+	if (posixMCU.timerLoop == &posixLoop) {
+		close(posixMCU.timer);
+		posixMCU.timer = -1;
+		posixMCU.timerLoop = 0;
+	}
+	__atomic_sub_fetch(&posixLoops, 1, __ATOMIC_ACQ_REL);
+}
+
+/**
+ * Starts the event loop of the thread with its first port. The micro controller starts from its
+ * power on state with the first loop.
+ */
+static int posixStartLoop() {
+	if (posixLoop.epoll >= 0) {
+		return 0;
+	}
+	posixLoop.epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (posixLoop.epoll < 0) {
+		return -1;
+	}
+	posixLoop.interruptsEnabled = 1;
+	posixLoop.ports = 0;
+	if (__atomic_fetch_add(&posixLoops, 1, __ATOMIC_ACQ_REL) == 0) {
+		memset(&posixMCU, 0, sizeof(posixMCU));
+		posixMCU.timer = -1;
+	}
+	return 0;
+}
+
+int posixAttach(struct PosixUSART* port, int fd) {
+	//power on values of the registers
+	memset(port, 0, sizeof(*port));
+	port->ucsra = 1 << UDRE;
+	port->ucsrc = 1 << URSEL | 1 << UCSZ1 | 1 << UCSZ0;
+
+	if (isatty(fd) && posixConfigure(fd)) {
+		return -1;
+	}
+	int flags = fcntl(fd, F_GETFL);
+	if ((flags < 0) || (fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0)) {
+		return -1;
+	}
+	if (posixStartLoop()) {
+		return -1;
+	}
+	struct epoll_event line = { .events = EPOLLIN, .data.ptr = port };
+	if (epoll_ctl(posixLoop.epoll, EPOLL_CTL_ADD, fd, &line)) {
+		int error = errno;
+		posixStopLoop();
+		errno = error;
+		return -1;
+	}
+	port->fd = fd;
+	port->attached = 1;
+	port->loop = &posixLoop;
+	//keep the ports in the order of their index, it is the order of their vectors
+	struct PosixUSART** link = &posixLoop.ports;
+	while (*link && (*link < port)) {
+		link = &(*link)->next;
+	}
+	port->next = *link;
+	*link = port;
+	return 0;
+}
+
+int posixOpen(struct PosixUSART* port, const char* path) {
+	int fd = open(path, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+	if (posixAttach(port, fd)) {
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+	return 0;
+}
+
+void posixClose(struct PosixUSART* port) {
+	if (port->attached) {
+		//closing the descriptor removes it from the epoll instance
+		close(port->fd);
+		port->attached = 0;
+		struct PosixUSART** link = &posixLoop.ports;
+		while (*link && (*link != port)) {
+			link = &(*link)->next;
+		}
+		if (*link) {
+			*link = port->next;
+		}
+	}
+	posixStopLoop();
+}
+
+int posixEventFd() {
+	return posixLoop.epoll;
+}
+
+/**
+ * Reads the next batch once the previous one was received completely
+ * Returns -1 once the partner hung up
+ */
+static int posixRead(struct PosixUSART* port) {
+	if (port->inputCount) {
+		return 0;
+	}
+	ssize_t count = read(port->fd, port->input, sizeof(port->input));
+	if (count > 0) {
+		port->inputHead = 0;
+		port->inputCount = count;
+		return 0;
+	}
+	if ((count < 0) && ((errno == EAGAIN) || (errno == EINTR))) {
+		//nothing to read
+		return 0;
+	}
+	//end of file, or EIO on a pseudo terminal whose other side was closed
+	errno = EPIPE;
+	return -1;
+}
+
+/**
+ * Moves the next byte read into the receive buffer once the previous one was taken
+ */
+static void posixReceive(struct PosixUSART* port) {
+	if (!(port->ucsra & (1 << RXC)) && port->inputCount && (port->ucsrb & (1 << RXEN))) {
+		port->receiveBuffer = port->input[port->inputHead++];
+		port->inputCount--;
+		port->ucsra |= 1 << RXC;
+	}
+}
+
+/**
+ * Writes as much of the output as the descriptor takes without waiting, and watches it for room
+ * while something remains
+ */
+static void posixFlush(struct PosixUSART* port) {
+	if (port->outputCount) {
+		ssize_t written = write(port->fd, port->output, port->outputCount);
+		if (written > 0) {
+			port->outputCount -= written;
+			memmove(port->output, port->output + written, port->outputCount);
+			port->ucsra |= 1 << UDRE;
+			if (!port->outputCount) {
+				//everything left, the line is idle
+				port->ucsra |= 1 << TXC;
+			}
+		}
+	}
+	uint8_t waiting = (port->outputCount != 0);
+	if (waiting != port->waitingWrite) {
+		struct epoll_event line = { .events = EPOLLIN | (waiting ? EPOLLOUT : 0),
+				.data.ptr = port };
+		epoll_ctl(port->loop->epoll, EPOLL_CTL_MOD, port->fd, &line);
+		port->waitingWrite = waiting;
+	}
+}
+
+/**
+ * Period of the compare match in cycles, the prescaler is selected by the clock select bits
+ */
+static uint32_t posixTimerCycles() {
+	static const uint16_t prescalers[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	uint16_t prescaler = prescalers[posixMCU.tccr0 & (1 << CS02 | 1 << CS01 | 1 << CS00)];
+	if (!(posixMCU.tccr0 & (1 << WGM01))) {
+		//only the clear timer on compare match mode is emulated
+		return 0;
+	}
+	return (uint32_t) (posixMCU.ocr0 + 1) * prescaler;
+}
+
+/**
+ * (Re)arms the timerfd as Timer0 is started, stopped or changed. It is created in the event loop
+ * of the thread starting Timer0.
+ */
+static void posixArmTimer() {
+	uint32_t period = posixTimerCycles();
+	if (period == posixMCU.timerPeriod) {
+		return;
+	}
+	if (posixMCU.timer < 0) {
+		int timer = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		struct epoll_event event = { .events = EPOLLIN, .data.ptr = &posixMCU };
+		if ((timer < 0) || epoll_ctl(posixLoop.epoll, EPOLL_CTL_ADD, timer, &event)) {
+			if (timer >= 0) {
+				close(timer);
+			}
+			//retried with the next poll
+			return;
+		}
+		posixMCU.timer = timer;
+		posixMCU.timerLoop = &posixLoop;
+	}
+	posixMCU.timerPeriod = period;
+	uint64_t ns = (uint64_t) period * 1000000000ULL / F_CPU;
+	struct itimerspec spec;
+	spec.it_interval.tv_sec = ns / 1000000000ULL;
+	spec.it_interval.tv_nsec = ns % 1000000000ULL;
+	spec.it_value = spec.it_interval;
+	timerfd_settime(posixMCU.timer, 0, &spec, 0);
+}
+
+/**
+ * Whether the port takes part in the event loop
+ */
+#define POSIX_SERVICED(port) ((port)->attached && !(port)->hungUp)
+
+#if INTERRUPT_DRIVEN
+
+/**
+ * Finds the pending vector of the port with the highest priority
+ * Returns 0 if none is pending
+ */
+static uint8_t posixPending(struct PosixUSART* port, uint8_t* vector) {
+	if (!POSIX_SERVICED(port)) {
+		return 0;
+	}
+	posixReceive(port);
+	if ((port->ucsrb & (1 << RXCIE)) && (port->ucsra & (1 << RXC))) {
+		*vector = HOST_VECTOR_RXC;
+	} else if ((port->ucsrb & (1 << UDRIE)) && (port->ucsra & (1 << UDRE))) {
+		*vector = HOST_VECTOR_UDRE;
+	} else if ((port->ucsrb & (1 << TXCIE)) && (port->ucsra & (1 << TXC))) {
+		//the flag is cleared by executing the vector
+		port->ucsra &= ~(1 << TXC);
+		*vector = HOST_VECTOR_TXC;
+	} else {
+		return 0;
+	}
+	return 1;
+}
+
+#endif
+
+/**
+ * Runs the pending interrupt vectors of the loop until none is pending. The ports go in the
+ * order of their index, each one until it has nothing pending, Timer0 last. Another pass picks
+ * up the vectors the previous ones raised.
+ */
+static void posixDispatch() {
+#if INTERRUPT_DRIVEN
+	uint8_t ran = 1;
+	while (ran && posixLoop.interruptsEnabled) {
+		ran = 0;
+		for (struct PosixUSART* port = posixLoop.ports; port; port = port->next) {
+			struct UART* uart = &uartPorts[port - posixUSARTs];
+			uint8_t vector;
+			while (posixLoop.interruptsEnabled && posixPending(port, &vector)) {
+				posixLoop.interruptsEnabled = 0;
+				hdwInterrupt(uart, vector);
+				posixLoop.interruptsEnabled = 1;
+				ran = 1;
+			}
+		}
+#if USE_TICK_TIMER0
+		if ((posixMCU.timerLoop == &posixLoop) && (posixMCU.timsk & (1 << OCIE0))
+				&& (posixMCU.tifr & (1 << OCF0)) && posixLoop.interruptsEnabled) {
+			posixMCU.tifr &= ~(1 << OCF0);
+			posixLoop.interruptsEnabled = 0;
+			TIMER0_COMP_vect();
+			posixLoop.interruptsEnabled = 1;
+			ran = 1;
+		}
+#endif
+	}
+#endif
+}
+
+/**
+ * Writes what the vectors transmitted on every port of the loop
+ */
+static void posixFlushAll() {
+	for (struct PosixUSART* port = posixLoop.ports; port; port = port->next) {
+		if (POSIX_SERVICED(port)) {
+			posixFlush(port);
+		}
+	}
+}
+
+/**
+ * Reads the lines reported readable, runs the vectors and writes what they transmitted.
+ * A port whose partner hung up leaves the event loop.
+ * Returns -1 if a partner hung up
+ */
+static int posixService() {
+	int result = 0;
+	for (struct PosixUSART* port = posixLoop.ports; port; port = port->next) {
+		if (POSIX_SERVICED(port) && port->readable) {
+			port->readable = 0;
+			if (posixRead(port)) {
+				port->hungUp = 1;
+				epoll_ctl(posixLoop.epoll, EPOLL_CTL_DEL, port->fd, 0);
+				result = -1;
+			}
+		}
+	}
+	posixDispatch();
+	posixFlushAll();
+	posixArmTimer();
+	if (result) {
+		errno = EPIPE;
+	}
+	return result;
+}
+
+int posixPoll(int timeoutMs) {
+	//the main program may have queued data since the last call
+	posixDispatch();
+	posixFlushAll();
+	posixArmTimer();
+	struct epoll_event events[POSIX_EVENTS];
+	int count = epoll_wait(posixLoop.epoll, events, POSIX_EVENTS, timeoutMs);
+	if (count < 0) {
+		return (errno == EINTR) ? 0 : -1;
+	}
+	for (int i = 0; i < count; i++) {
+		if (events[i].data.ptr != &posixMCU) {
+			//a line, read in posixService()
+			((struct PosixUSART*) events[i].data.ptr)->readable = 1;
+		} else {
+			uint64_t expirations;
+			if (read(posixMCU.timer, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+				//every compare match raises the interrupt, none is merged
+				while (expirations--) {
+					posixMCU.tifr |= 1 << OCF0;
+					posixDispatch();
+				}
+			}
+		}
+	}
+	if (posixService()) {
+		return -1;
+	}
+	return count;
+}
+
+uint8_t* posixPollUCSRA(struct PosixUSART* port) {
+#if INTERRUPT_DRIVEN
+	if (!(port->ucsra & (1 << UDRE))) {
+		//waiting for room in the output, otherwise posixPoll() writes it in one batch
+		posixFlush(port);
+	}
+#else
+	//nothing calls posixPoll() while polling, the busy waits on the flags move the data
+	if (posixRead(port) == 0) {
+		posixReceive(port);
+	}
+	posixFlush(port);
+#endif
+	return &port->ucsra;
+}
+
+/**
+ * Writing the data register collects the byte for the next write(), it is lost if the output is full
+ */
+void posixWriteUDR(struct PosixUSART* port, uint8_t data) {
+	if (!(port->ucsrb & (1 << TXEN)) || !(port->ucsra & (1 << UDRE))) {
+		return;
+	}
+	port->output[port->outputCount++] = data;
+	if (port->outputCount == sizeof(port->output)) {
+		port->ucsra &= ~(1 << UDRE);
+	}
+}
+
+/**
+ * Reading the data register clears the receive complete flag
+ */
+uint8_t posixReadUDR(struct PosixUSART* port) {
+	port->ucsra &= ~(1 << RXC | 1 << DOR);
+	return port->receiveBuffer;
+}
+
+void posixEnableInterrupts() {
+	posixLoop.interruptsEnabled = 1;
+	posixDispatch();
+}
+
+#endif
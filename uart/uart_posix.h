@@ -0,0 +1,216 @@
+/*
+ * uart_posix.h
+ */
+
+#ifndef UART_POSIX_H_
+#define UART_POSIX_H_
+
+#include <inttypes.h>
+#include "config.h"
+#include "uart_host.h"
+
+/**
+ * Bytes moved by a single read() or write() on the file descriptor
+ */
+#if (!defined(POSIX_BATCH_SIZE))
+#define POSIX_BATCH_SIZE 4096
+#endif
+
+struct PosixLoop;
+
+/**
+ * State of a USART emulated over a file descriptor (a tty or a pseudo terminal), one per port.
+ * The interrupt vectors run from posixPoll(), the event loop standing in for the hardware:
+ * the received bytes are read in batches and handed to the RXC vector one by one, the bytes
+ * written by the UDRE vector are collected and written in batches.
+ * Every thread has an event loop of its own, a port belongs to the loop of the thread that
+ * attached it and is only used from that thread.
+ */
+struct PosixUSART {
+	/**
+	 * The register file
+	 */
+	uint8_t ucsra;
+	uint8_t ucsrb;
+	uint8_t ucsrc;
+	uint8_t ubrrh;
+	uint8_t ubrrl;
+	/**
+	 * Read side of UDR, the receive buffer
+	 */
+	uint8_t receiveBuffer;
+	/**
+	 * Bytes read from the descriptor and not received yet
+	 */
+	uint8_t input[POSIX_BATCH_SIZE];
+	uint16_t inputHead;
+	uint16_t inputCount;
+	/**
+	 * Bytes written into UDR and not written to the descriptor yet, UDRE is set while there is room
+	 */
+	uint8_t output[POSIX_BATCH_SIZE];
+	uint16_t outputCount;
+	/**
+	 * The descriptor of the line, valid while the port is attached
+	 */
+	int fd;
+	uint8_t attached;
+	/**
+	 * The event loop the port belongs to, and the next port of that loop
+	 */
+	struct PosixLoop* loop;
+	struct PosixUSART* next;
+	/**
+	 * The line was reported readable
+	 */
+	uint8_t readable;
+	/**
+	 * The partner hung up, the port is not serviced anymore until it is closed
+	 */
+	uint8_t hungUp;
+	/**
+	 * The descriptor is watched for room to write the rest of the output
+	 */
+	uint8_t waitingWrite;
+};
+
+extern struct PosixUSART posixUSARTs[UART_PORTS];
+
+/**
+ * State of the emulated micro controller shared by the ports
+ */
+struct PosixMCU {
+	/**
+	 * Timer0 registers, the compare match is generated by a timerfd
+	 */
+	uint8_t tccr0;
+	uint8_t ocr0;
+	uint8_t timsk;
+	uint8_t tifr;
+	uint32_t timerPeriod;
+	/**
+	 * The timerfd generating the compare match, -1 until Timer0 is started, and the event loop
+	 * it runs in
+	 */
+	int timer;
+	struct PosixLoop* timerLoop;
+	/**
+	 * Port D and the external interrupt registers, not connected to anything
+	 */
+	uint8_t portd;
+	uint8_t ddrd;
+	uint8_t pind;
+	uint8_t mcucr;
+	uint8_t gicr;
+	uint8_t gifr;
+};
+
+extern struct PosixMCU posixMCU;
+
+/**
+ * Event loop of a thread, servicing the ports attached from it
+ */
+struct PosixLoop {
+	/**
+	 * The epoll instance waiting on the lines (and the timer), -1 while no port is attached
+	 */
+	int epoll;
+	/**
+	 * Global interrupt enable flag (I bit of SREG), the vectors of the loop only run in its thread
+	 */
+	uint8_t interruptsEnabled;
+	/**
+	 * The attached ports in the order of their index, linked through next
+	 */
+	struct PosixUSART* ports;
+};
+
+#if defined(__cplusplus)
+//included by the C++ front end (Uart.hpp), same storage as _Thread_local
+extern __thread struct PosixLoop posixLoop;
+#else
+extern _Thread_local struct PosixLoop posixLoop;
+#endif
+
+/**
+ * The emulated USART of a port
+ */
+typedef struct PosixUSART HdwPort;
+
+#define HDW_PORT(index) (&posixUSARTs[index])
+
+/**
+ * Register access. Reading UCSRA moves the pending bytes without waiting, so that busy waits
+ * make progress: while polling (without INTERRUPT_DRIVEN) on every read, otherwise only while
+ * the output is full.
+ */
+#define UART_UCSRA(port) (*posixPollUCSRA(port))
+#define UART_UCSRB(port) ((port)->ucsrb)
+#define UART_UCSRC(port) ((port)->ucsrc)
+#define UART_UBRRH(port) ((port)->ubrrh)
+#define UART_UBRRL(port) ((port)->ubrrl)
+#define TCCR0 (posixMCU.tccr0)
+#define OCR0 (posixMCU.ocr0)
+#define TIMSK (posixMCU.timsk)
+#define TIFR (posixMCU.tifr)
+#define PORTD (posixMCU.portd)
+#define DDRD (posixMCU.ddrd)
+#define PIND (posixMCU.pind)
+#define MCUCR (posixMCU.mcucr)
+#define GICR (posixMCU.gicr)
+#define GIFR (posixMCU.gifr)
+
+#define UART_WRITE_UDR(port, data) posixWriteUDR((port), (data))
+#define UART_READ_UDR(port) posixReadUDR(port)
+
+/**
+ * Interrupt handling, the vectors only run from posixPoll() and sei() of their thread so the
+ * main program is never interrupted in between
+ */
+#define ISR(vector) void vector(void)
+#define cli() (posixLoop.interruptsEnabled = 0)
+#define sei() posixEnableInterrupts()
+#define UART_CRITICAL_BEGIN() uint8_t criticalSreg = posixLoop.interruptsEnabled; cli()
+#define UART_CRITICAL_END() do { if (criticalSreg) { sei(); } } while (0)
+
+/**
+ * Opens the tty or pseudo terminal at path as the line of the port, in raw mode at BAUD_RATE.
+ * The port joins the event loop of the calling thread. Call it before UARTsetup() of the port.
+ * Returns 0, or -1 with errno set
+ */
+int posixOpen(struct PosixUSART* port, const char* path);
+
+/**
+ * Uses an open descriptor as the line of the port, e.g. the master of a pseudo terminal. A tty
+ * is switched to raw mode at BAUD_RATE. The port joins the event loop of the calling thread.
+ * Call it before UARTsetup() of the port.
+ * Returns 0, or -1 with errno set
+ */
+int posixAttach(struct PosixUSART* port, int fd);
+
+/**
+ * Closes the line of the port from the thread that attached it, and the event loop of the thread
+ * with its last port
+ */
+void posixClose(struct PosixUSART* port);
+
+/**
+ * Runs the event loop of the calling thread once: waits up to timeoutMs (-1 forever) for the
+ * lines or the timer, then runs the pending interrupt vectors and writes the output.
+ * Returns the number of events handled, or -1 with errno set (EPIPE once a partner hung up,
+ * the hungUp flag tells which one)
+ */
+int posixPoll(int timeoutMs);
+
+/**
+ * Descriptor becoming readable whenever posixPoll() of the calling thread has something to do,
+ * for embedding the event loop into another one
+ */
+int posixEventFd();
+
+uint8_t* posixPollUCSRA(struct PosixUSART* port);
+void posixWriteUDR(struct PosixUSART* port, uint8_t data);
+uint8_t posixReadUDR(struct PosixUSART* port);
+void posixEnableInterrupts();
+
+#endif /* UART_POSIX_H_ */
@@ -0,0 +1,335 @@
+/*
+ * uart_sim.c
+ */
+
+#include "uart_hdw.h"
+
+#if (UART_HARDWARE == UART_HARDWARE_SIM)
+
+#include <time.h>
+
+struct SimUSART simUSARTs[UART_PORTS];
+struct SimMCU simMCU;
+struct SimStats simStats[UART_PORTS];
+
+/**
+ * Reset the simulated USARTs and the micro controller to the power on values of the registers
+ */
+void simReset() {
+	uint8_t* raw = (uint8_t*) &simMCU;
+	for (uint16_t i = 0; i < sizeof(simMCU); i++) {
+		raw[i] = 0;
+	}
+	for (uint8_t port = 0; port < UART_PORTS; port++) {
+		struct SimUSART* usart = &simUSARTs[port];
+		raw = (uint8_t*) usart;
+		for (uint16_t i = 0; i < sizeof(*usart); i++) {
+			raw[i] = 0;
+		}
+		usart->ucsra = 1 << UDRE;
+		usart->ucsrc = 1 << URSEL | 1 << UCSZ1 | 1 << UCSZ0;
+	}
+	simMCU.interruptsEnabled = 1;
+	simResetStats();
+}
+
+void simResetStats() {
+	uint8_t* raw = (uint8_t*) simStats;
+	for (uint16_t i = 0; i < sizeof(simStats); i++) {
+		raw[i] = 0;
+	}
+}
+
+/**
+ * Number of cycles a frame takes, start bit + character bits + parity + stop bits
+ */
+uint32_t simFrameCycles(struct SimUSART* port) {
+	uint16_t ubrr = ((uint16_t) (port->ubrrh & 0x0F) << 8) | port->ubrrl;
+	uint32_t bitCycles = (uint32_t) (ubrr + 1)
+			* ((port->ucsra & (1 << U2X)) ? 8 : 16);
+	uint8_t size = (port->ucsrc >> UCSZ0) & 0x03;
+	uint8_t bits = 1;
+	if (port->ucsrb & (1 << UCSZ2)) {
+		//9 bit characters
+		bits += 9;
+	} else {
+		bits += 5 + size;
+	}
+	if (port->ucsrc & (1 << UPM1)) {
+		//parity enabled
+		bits++;
+	}
+	bits += (port->ucsrc & (1 << USBS)) ? 2 : 1;
+	return bits * bitCycles;
+}
+
+/**
+ * Period of the compare match, the prescaler is selected by the clock select bits
+ */
+uint32_t simTimerCycles() {
+	static const uint16_t prescalers[] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+	uint16_t prescaler = prescalers[simMCU.tccr0 & (1 << CS02 | 1 << CS01 | 1 << CS00)];
+	if (!(simMCU.tccr0 & (1 << WGM01))) {
+		//only the clear timer on compare match mode is simulated
+		return 0;
+	}
+	return (uint32_t) (simMCU.ocr0 + 1) * prescaler;
+}
+
+#if INTERRUPT_DRIVEN
+
+/**
+ * Host clock in nanoseconds, timing the vectors
+ */
+static uint64_t simHostNanos() {
+	struct timespec time;
+	clock_gettime(CLOCK_MONOTONIC, &time);
+	return (uint64_t) time.tv_sec * 1000000000U + time.tv_nsec;
+}
+
+#endif
+
+/**
+ * Calls the pending interrupt vector with the highest priority until none is pending.
+ * INT1 goes first, then the USARTs in the order of their ports and Timer0 last.
+ */
+static void simDispatch() {
+#if INTERRUPT_DRIVEN
+	while (simMCU.interruptsEnabled) {
+		void (*vector)(void) = 0;
+		struct UART* uart = 0;
+		uint8_t index = 0;
+		struct SimStats* stats = &simStats[0];
+#if (FLOW_CONTROL == FLOW_RTS_CTS)
+		if ((simMCU.gicr & (1 << INT1)) && (simMCU.gifr & (1 << INTF1))) {
+			simMCU.gifr &= ~(1 << INTF1);
+			vector = INT1_vect;
+			index = SIM_VECTOR_INT1;
+		}
+#endif
+		for (uint8_t port = 0; (!vector) && (!uart) && (port < UART_PORTS); port++) {
+			struct SimUSART* usart = &simUSARTs[port];
+			stats = &simStats[port];
+			if ((usart->ucsrb & (1 << RXCIE)) && (usart->ucsra & (1 << RXC))) {
+				index = SIM_VECTOR_RXC;
+			} else if ((usart->ucsrb & (1 << UDRIE)) && (usart->ucsra & (1 << UDRE))) {
+				index = SIM_VECTOR_UDRE;
+			} else if ((usart->ucsrb & (1 << TXCIE)) && (usart->ucsra & (1 << TXC))) {
+				//the flag is cleared by executing the vector
+				usart->ucsra &= ~(1 << TXC);
+				index = SIM_VECTOR_TXC;
+			} else {
+				continue;
+			}
+			uart = &uartPorts[port];
+		}
+#if USE_TICK_TIMER0
+		if ((!vector) && (!uart) && (simMCU.timsk & (1 << OCIE0)) && (simMCU.tifr & (1 << OCF0))) {
+			simMCU.tifr &= ~(1 << OCF0);
+			vector = TIMER0_COMP_vect;
+			index = SIM_VECTOR_TIMER0;
+			stats = &simStats[0];
+		}
+#endif
+		if ((!vector) && (!uart)) {
+			//nothing pending
+			return;
+		}
+		simMCU.interruptsEnabled = 0;
+		simMCU.cycles += SIM_ISR_OVERHEAD_CYCLES;
+		uint64_t start = simHostNanos();
+		if (uart) {
+			hdwInterrupt(uart, index);
+		} else {
+			(*vector)();
+		}
+		uint64_t nanos = simHostNanos() - start;
+		simMCU.interruptsEnabled = 1;
+		stats->vectorCalls[index]++;
+		stats->vectorNanos[index] += nanos;
+		if (nanos > stats->vectorMaxNanos[index]) {
+			stats->vectorMaxNanos[index] = nanos;
+		}
+	}
+#endif
+}
+
+/**
+ * Processes the line events of the port that are due at the current cycle
+ */
+static void simProcessPort(struct SimUSART* port, struct SimStats* stats) {
+	if (port->shifting && (port->shiftEnd <= simMCU.cycles)) {
+		//the shift register is done with the byte
+		stats->transmitted++;
+		if (port->transmitSink) {
+			(*port->transmitSink)(port->transmitShift);
+		}
+		if (!(port->ucsra & (1 << UDRE))) {
+			//the transmit buffer holds the next byte, no idle time on the line
+			port->transmitShift = port->transmitBuffer;
+			stats->lastTransmit = port->shiftEnd;
+			port->shiftEnd += simFrameCycles(port);
+			port->ucsra |= 1 << UDRE;
+		} else {
+			port->shifting = 0;
+			port->ucsra |= 1 << TXC;
+			port->idleSince = simMCU.cycles;
+		}
+	}
+	if (port->lineCount && (port->lineArrival <= simMCU.cycles)) {
+		uint8_t data = port->line[port->lineHead];
+		port->lineHead = (port->lineHead + 1) % SIM_LINE_SIZE;
+		port->lineCount--;
+		if (port->ucsrb & (1 << RXEN)) {
+			if (port->ucsra & (1 << RXC)) {
+				//previous byte was not read in time, this one is lost
+				port->ucsra |= 1 << DOR;
+				stats->overruns++;
+			} else {
+				port->receiveBuffer = data;
+				port->ucsra |= 1 << RXC;
+				stats->received++;
+			}
+		}
+		if (port->lineCount) {
+			port->lineArrival += simFrameCycles(port);
+		}
+	}
+}
+
+/**
+ * Processes the events that are due at the current cycle
+ */
+static void simProcessEvents() {
+	for (uint8_t port = 0; port < UART_PORTS; port++) {
+		simProcessPort(&simUSARTs[port], &simStats[port]);
+	}
+	if (simMCU.timerNext && (simMCU.timerNext <= simMCU.cycles)) {
+		simMCU.tifr |= 1 << OCF0;
+		simMCU.timerNext += simTimerCycles();
+	}
+}
+
+/**
+ * Runs the simulation until the target cycle is reached
+ */
+static void simRun(uint64_t target) {
+	for (;;) {
+		simDispatch();
+		//find the next line event
+		uint64_t next = UINT64_MAX;
+		for (uint8_t port = 0; port < UART_PORTS; port++) {
+			struct SimUSART* usart = &simUSARTs[port];
+			if (usart->shifting && (usart->shiftEnd < next)) {
+				next = usart->shiftEnd;
+			}
+			if (usart->lineCount && (usart->lineArrival < next)) {
+				next = usart->lineArrival;
+			}
+		}
+		//(re)schedule the timer as it is started and stopped
+		uint32_t period = simTimerCycles();
+		if (!period) {
+			simMCU.timerNext = 0;
+		} else if (!simMCU.timerNext) {
+			simMCU.timerNext = simMCU.cycles + period;
+		}
+		if (simMCU.timerNext && (simMCU.timerNext < next)) {
+			next = simMCU.timerNext;
+		}
+		if (next > target) {
+			break;
+		}
+		if (next > simMCU.cycles) {
+			simMCU.cycles = next;
+		}
+		simProcessEvents();
+	}
+	if (simMCU.cycles < target) {
+		simMCU.cycles = target;
+	}
+}
+
+void simAdvance(uint32_t cycles) {
+	simRun(simMCU.cycles + cycles);
+}
+
+uint16_t simFeedLine(struct SimUSART* port, const uint8_t* data, uint16_t length) {
+	uint16_t accepted = 0;
+	if ((port->lineCount == 0) && (length > 0)) {
+		//line was idle, first byte arrives one frame from now
+		port->lineArrival = simMCU.cycles + simFrameCycles(port);
+	}
+	while ((accepted < length) && (port->lineCount < SIM_LINE_SIZE)) {
+		port->line[(port->lineHead + port->lineCount) % SIM_LINE_SIZE] = data[accepted];
+		port->lineCount++;
+		accepted++;
+	}
+	return accepted;
+}
+
+void simSetPIND(uint8_t value) {
+	uint8_t changed = simMCU.pind ^ value;
+	simMCU.pind = value;
+	if ((changed & (1 << SIM_INT1_BIT))
+			&& ((simMCU.mcucr & (1 << ISC11 | 1 << ISC10)) == (1 << ISC10))) {
+		simMCU.gifr |= 1 << INTF1;
+	}
+	simDispatch();
+}
+
+void simSetTransmitSink(struct SimUSART* port, void (*sink)(uint8_t data)) {
+	port->transmitSink = sink;
+}
+
+uint8_t* simPollUCSRA(struct SimUSART* port) {
+	simAdvance(SIM_POLL_CYCLES);
+	return &port->ucsra;
+}
+
+/**
+ * Writing the data register loads the shift register directly if it is idle,
+ * otherwise the byte waits in the transmit buffer
+ */
+void simWriteUDR(struct SimUSART* port, uint8_t data) {
+	struct SimStats* stats = &simStats[port - simUSARTs];
+	if (!(port->ucsrb & (1 << TXEN)) || !(port->ucsra & (1 << UDRE))) {
+		//transmitter disabled or buffer still full, the byte is lost
+		stats->droppedWrites++;
+		return;
+	}
+	if (!port->shifting) {
+		if (stats->transmitted == 0) {
+			stats->firstTransmit = simMCU.cycles;
+		} else {
+			//the line was idle since the previous byte
+			uint64_t gap = simMCU.cycles - port->idleSince;
+			stats->idleCycles += gap;
+			if (gap > stats->maxIdleGap) {
+				stats->maxIdleGap = gap;
+			}
+		}
+		stats->lastTransmit = simMCU.cycles;
+		port->transmitShift = data;
+		port->shifting = 1;
+		port->shiftEnd = simMCU.cycles + simFrameCycles(port);
+	} else {
+		port->transmitBuffer = data;
+		port->ucsra &= ~(1 << UDRE);
+	}
+}
+
+/**
+ * Reading the data register clears the receive complete flag
+ */
+uint8_t simReadUDR(struct SimUSART* port) {
+	port->ucsra &= ~(1 << RXC | 1 << DOR);
+	return port->receiveBuffer;
+}
+
+void simEnableInterrupts() {
+	simMCU.interruptsEnabled = 1;
+	simDispatch();
+}
+
+#endif
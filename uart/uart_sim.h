@@ -0,0 +1,248 @@
+/*
+ * uart_sim.h
+ */
+
+#ifndef UART_SIM_H_
+#define UART_SIM_H_
+
+#include <inttypes.h>
+#include "config.h"
+#include "uart_host.h"
+
+/**
+ * Cycles consumed by one iteration of a busy wait loop polling UCSRA
+ */
+#define SIM_POLL_CYCLES 3
+
+/**
+ * Cycles consumed by the interrupt response, prologue, epilogue and reti of an ISR
+ */
+#define SIM_ISR_OVERHEAD_CYCLES 20
+
+/**
+ * Maximum number of bytes that can be waiting on the simulated receive line
+ */
+#define SIM_LINE_SIZE 256
+
+/**
+ * Pin of INT1 on port D
+ */
+#define SIM_INT1_BIT 3
+
+/**
+ * State of a simulated USART, one per port
+ */
+struct SimUSART {
+	/**
+	 * The register file
+	 */
+	uint8_t ucsra;
+	uint8_t ucsrb;
+	uint8_t ucsrc;
+	uint8_t ubrrh;
+	uint8_t ubrrl;
+	/**
+	 * Write side of UDR, the transmit buffer
+	 */
+	uint8_t transmitBuffer;
+	/**
+	 * Read side of UDR, the receive buffer
+	 */
+	uint8_t receiveBuffer;
+	/**
+	 * The transmit shift register and the cycle at which it has shifted out completely
+	 */
+	uint8_t transmitShift;
+	uint8_t shifting;
+	uint64_t shiftEnd;
+	/**
+	 * Cycle at which the transmit line went idle
+	 */
+	uint64_t idleSince;
+	/**
+	 * Bytes sent by the partner that have not been received yet
+	 */
+	uint8_t line[SIM_LINE_SIZE];
+	uint16_t lineHead;
+	uint16_t lineCount;
+	uint64_t lineArrival;
+	/**
+	 * Receives every byte once it has completely left the transmit shift register
+	 */
+	void (*transmitSink)(uint8_t data);
+};
+
+extern struct SimUSART simUSARTs[UART_PORTS];
+
+/**
+ * State of the simulated micro controller shared by the ports
+ */
+struct SimMCU {
+	/**
+	 * Timer0 registers and the cycle of its next compare match, 0 while it is not scheduled
+	 */
+	uint8_t tccr0;
+	uint8_t ocr0;
+	uint8_t timsk;
+	uint8_t tifr;
+	uint64_t timerNext;
+	/**
+	 * Port D and the external interrupt registers. pind is driven by the partner through simSetPIND()
+	 */
+	uint8_t portd;
+	uint8_t ddrd;
+	uint8_t pind;
+	uint8_t mcucr;
+	uint8_t gicr;
+	uint8_t gifr;
+	/**
+	 * Global interrupt enable flag (I bit of SREG)
+	 */
+	uint8_t interruptsEnabled;
+	/**
+	 * Cycles elapsed since simReset()
+	 */
+	uint64_t cycles;
+};
+
+extern struct SimMCU simMCU;
+
+/**
+ * Index of the vectors in the statistics
+ */
+#define SIM_VECTOR_RXC HOST_VECTOR_RXC
+#define SIM_VECTOR_UDRE HOST_VECTOR_UDRE
+#define SIM_VECTOR_TXC HOST_VECTOR_TXC
+#define SIM_VECTOR_TIMER0 3
+#define SIM_VECTOR_INT1 4
+
+/**
+ * Measurements taken by the simulator for every port, used for benchmarking the configurations.
+ * The theoretical line rate in bytes per second is F_CPU / simFrameCycles().
+ */
+struct SimStats {
+	/**
+	 * Bytes that completely left the shift register
+	 */
+	uint32_t transmitted;
+	/**
+	 * Bytes delivered into the receive buffer
+	 */
+	uint32_t received;
+	/**
+	 * Bytes lost because the receive buffer was not read in time
+	 */
+	uint32_t overruns;
+	/**
+	 * Writes into UDR while the transmit buffer was still full
+	 */
+	uint32_t droppedWrites;
+	/**
+	 * Cycles at which the first and the last transmitted byte started shifting out
+	 */
+	uint64_t firstTransmit;
+	uint64_t lastTransmit;
+	/**
+	 * Cycles the transmit line stayed idle between two consecutive bytes
+	 */
+	uint64_t idleCycles;
+	uint32_t maxIdleGap;
+	/**
+	 * Invocations of every vector and the host time spent in them, in total and the worst case of
+	 * a single invocation. It is the code actually executed, message handlers run by the vector
+	 * included, measured on the host clock rather than in AVR cycles. The vectors of the micro
+	 * controller (Timer0 and INT1) are counted on port 0.
+	 */
+	uint32_t vectorCalls[5];
+	uint64_t vectorNanos[5];
+	uint32_t vectorMaxNanos[5];
+};
+
+extern struct SimStats simStats[UART_PORTS];
+
+/**
+ * The simulated USART of a port
+ */
+typedef struct SimUSART HdwPort;
+
+#define HDW_PORT(index) (&simUSARTs[index])
+
+/**
+ * Register access. Reading UCSRA costs SIM_POLL_CYCLES so that busy waits advance time.
+ */
+#define UART_UCSRA(port) (*simPollUCSRA(port))
+#define UART_UCSRB(port) ((port)->ucsrb)
+#define UART_UCSRC(port) ((port)->ucsrc)
+#define UART_UBRRH(port) ((port)->ubrrh)
+#define UART_UBRRL(port) ((port)->ubrrl)
+#define TCCR0 (simMCU.tccr0)
+#define OCR0 (simMCU.ocr0)
+#define TIMSK (simMCU.timsk)
+#define TIFR (simMCU.tifr)
+#define PORTD (simMCU.portd)
+#define DDRD (simMCU.ddrd)
+#define PIND (simMCU.pind)
+#define MCUCR (simMCU.mcucr)
+#define GICR (simMCU.gicr)
+#define GIFR (simMCU.gifr)
+
+#define UART_WRITE_UDR(port, data) simWriteUDR((port), (data))
+#define UART_READ_UDR(port) simReadUDR(port)
+
+/**
+ * Interrupt handling
+ */
+#define ISR(vector) void vector(void)
+#define cli() (simMCU.interruptsEnabled = 0)
+#define sei() simEnableInterrupts()
+#define UART_CRITICAL_BEGIN() uint8_t criticalSreg = simMCU.interruptsEnabled; cli()
+#define UART_CRITICAL_END() do { if (criticalSreg) { sei(); } } while (0)
+
+/**
+ * Resets every simulated USART and the micro controller to their power on state
+ */
+void simReset();
+
+/**
+ * Clears the measurements without touching the USART state
+ */
+void simResetStats();
+
+/**
+ * Advances the simulated time by the provided number of cycles dispatching
+ * interrupts as the flags get raised
+ */
+void simAdvance(uint32_t cycles);
+
+/**
+ * Queues bytes sent by the partner of the port, they arrive back to back at its baud rate.
+ * Returns the number of bytes accepted on the line
+ */
+uint16_t simFeedLine(struct SimUSART* port, const uint8_t* data, uint16_t length);
+
+/**
+ * Drives the input pins of port D, raising INT1 when its pin changes
+ */
+void simSetPIND(uint8_t value);
+
+/**
+ * Sets the function receiving the bytes transmitted by the port
+ */
+void simSetTransmitSink(struct SimUSART* port, void (*sink)(uint8_t data));
+
+/**
+ * Returns the number of cycles a single frame takes on the line of the port with its settings
+ */
+uint32_t simFrameCycles(struct SimUSART* port);
+
+/**
+ * Returns the number of cycles between two compare matches of Timer0, 0 if it is stopped
+ */
+uint32_t simTimerCycles();
+
+uint8_t* simPollUCSRA(struct SimUSART* port);
+void simWriteUDR(struct SimUSART* port, uint8_t data);
+uint8_t simReadUDR(struct SimUSART* port);
+void simEnableInterrupts();
+
+#endif /* UART_SIM_H_ */
@@ -5,78 +5,51 @@
  *      Author: Aanal
  */
 
+#include <string.h>
 #include "../utils/Queue.h"
-#if(!SYMMETRIC_QUEUE)
-#include <alloca.h>
-#endif
 
-#if(SYMMETRIC_QUEUE)
-void queueInit(struct Queue* queue){
-	queue->head = 0;
-	queue->tail = 0;
-	queue->count = 0;
-	queue->size = QUEUE_SIZE;
-}
-#else
-void queueInit(struct Queue* queue, uint8_t size){
-	queue->buffer = (uint8_t*) malloc(size);
-	queue->head = 0;
-	queue->size = size;
-	queue->tail = 1;
-	queue->count = 0;
-}
-#endif
-
-void enqueue(struct Queue* queue, uint8_t data){
-#if(!SYMMETRIC_QUEUE)
-	if(queue->count!=queue->size){
-#else
-	if(queue->count != QUEUE_SIZE){
-#endif
-		//queue is not full
-		queue->buffer[queue->tail] = data;
-		//increment the tail and the count
-		queue->count++;
-		queue->tail++;
-		//check if the tail is out of array
-#if(!SYMMETRIC_QUEUE)
-		if(queue->tail > queue->size){
-#else
-		if(queue->tail == QUEUE_SIZE){
-#endif
-			//the tail is out of the array
-			queue->tail = 0;
+QueueSize queueEnqueueBlock(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		const uint8_t* data, QueueSize length){
+	QueueSize written = 0;
+	uint8_t* span;
+	//the free space wraps at most once
+	for(uint8_t i = 0; (i < 2) && (written < length); i++){
+		QueueSize size = queueIndexWriteSpan(index, buffer, mask, &span);
+		if(size > length - written){
+			size = length - written;
 		}
+		memcpy(span, data + written, size);
+		queueIndexProduce(index, size);
+		written += size;
 	}
+	return written;
 }
 
-uint8_t dequeue(struct Queue* queue){
-	uint8_t data = 0;
-	if(queue->count != 0){
-		//the queue is not empty
-		data = queue->buffer[queue->head];
-		//increment header
-		queue->head++;
-		//decrement count
-		queue->count--;
-		//check if header is out of the array
-#if(!SYMMETRIC_QUEUE)
-		if(queue->head > queue->size){
-#else
-		if(queue->head == QUEUE_SIZE){
-#endif
-			//the tail is out of the array
-			queue->head = 0;
-		}
+void queueIndexWriteReserved(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		QueueSize offset, const uint8_t* data, QueueSize length){
+	QueueSize start = (QueueSize) (index->tail + offset) & mask;
+	QueueSize size = mask + 1 - start;
+	//the reserved room wraps at most once
+	if(size > length){
+		size = length;
 	}
-	return data;
+	memcpy(buffer + start, data, size);
+	memcpy(buffer, data + size, length - size);
 }
 
-
-inline uint8_t peekQueueTail(struct Queue* queue){
-	return queue->buffer[queue->tail];
-}
-
-inline uint8_t peekQueueHead(struct Queue* queue){
-	return queue->buffer[queue->head];
+QueueSize queueDequeueBlock(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		uint8_t* data, QueueSize length){
+	QueueSize read = 0;
+	uint8_t* span;
+	//the items wrap at most once
+	for(uint8_t i = 0; (i < 2) && (read < length); i++){
+		QueueSize size = queueIndexReadSpan(index, buffer, mask, &span);
+		if(size > length - read){
+			size = length - read;
+		}
+		memcpy(data + read, span, size);
+		queueIndexConsume(index, size);
+		read += size;
+	}
+	return read;
 }
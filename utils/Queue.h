@@ -12,46 +12,248 @@
 #include "../uart/config.h"
 
 /**
- * Data structure to ohold the queue in place
- */
-struct Queue{
-	uint8_t head;
-	uint8_t tail;
-	uint8_t count;
-	uint8_t size;
-#if(!SYMMETRIC_QUEUE)
-	uint8_t* buffer;
+ * Type of the queue indices, counts and lengths
+ */
+#if (QUEUE_INDEX_BITS == 8)
+typedef uint8_t QueueSize;
 #else
-	uint8_t buffer[QUEUE_SIZE];
+typedef uint16_t QueueSize;
 #endif
-};
 
 /**
- * Initialize the Queue before using it.
+ * Loads and stores of the indices shared between the producer and the consumer.
+ * The producer publishes the tail only after the data is written and the consumer
+ * publishes the head only after the data is read.
  */
-#if(SYMMETRIC_QUEUE)
-void queueInit(struct Queue* queue);
+#if (defined(__AVR__) && (QUEUE_INDEX_BITS != 8))
+#include <util/atomic.h>
+
+//the AVR accesses 16 bit indices in two instructions, so an interrupt must not split them
+static inline QueueSize queueAtomicLoad(QueueSize* index){
+	QueueSize value;
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		value = *(volatile QueueSize*) index;
+	}
+	return value;
+}
+
+static inline void queueAtomicStore(QueueSize* index, QueueSize value){
+	ATOMIC_BLOCK(ATOMIC_RESTORESTATE){
+		*(volatile QueueSize*) index = value;
+	}
+}
+
+#define QUEUE_LOAD(index) queueAtomicLoad(&(index))
+#define QUEUE_STORE(index, value) queueAtomicStore(&(index), (value))
 #else
-void queueInit(struct Queue* queue, uint8_t size);
+#define QUEUE_LOAD(index) __atomic_load_n(&(index), __ATOMIC_ACQUIRE)
+#define QUEUE_STORE(index, value) __atomic_store_n(&(index), (value), __ATOMIC_RELEASE)
 #endif
+
+/**
+ * Indices of a single producer, single consumer ring: the head is written only by the
+ * consumer and the tail only by the producer. Both indices run freely and are masked on
+ * access, so the number of items is always tail - head and no critical section is required.
+ */
+struct QueueIndex{
+	QueueSize head;
+	QueueSize tail;
+};
+
+/**
+ * Declares a statically allocated queue type holding size bytes.
+ * The size has to be a power of two that QUEUE_INDEX_BITS can address. It is only known through
+ * sizeof(buffer), so every operation masks with a compile time constant.
+ */
+#define QUEUE_TYPE(name, size) \
+	struct name{ \
+		struct QueueIndex index; \
+		uint8_t buffer[size]; \
+	}
+
+/**
+ * Mask of a queue declared with QUEUE_TYPE
+ */
+#define QUEUE_MASK(queue) ((QueueSize) (sizeof((queue)->buffer) - 1))
+
+/**
+ * Initialize the Queue before using it.
+ */
+#define queueInit(queue) queueIndexInit(&(queue)->index)
+
 /**
  * Enqueues the provided data into the queue
+ * Returns 1 if the data was enqueued and 0 if the queue was full
  */
-void enqueue(struct Queue* queue, uint8_t data);
+#define enqueue(queue, data) \
+	queueEnqueue(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue), (data))
 
 /**
  * Dequeues the provided data from the queue
  */
-uint8_t dequeue(struct Queue* queue);
+#define dequeue(queue) queueDequeue(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue))
+
+/**
+ * Enqueues up to length bytes of data in at most two copies
+ * Returns the number of bytes enqueued
+ */
+#define enqueueBlock(queue, data, length) \
+	queueEnqueueBlock(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue), (data), (length))
+
+/**
+ * Dequeues up to length bytes into data in at most two copies
+ * Returns the number of bytes dequeued
+ */
+#define dequeueBlock(queue, data, length) \
+	queueDequeueBlock(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue), (data), (length))
+
+/**
+ * Points span at the oldest item and returns how many items can be read from there
+ * without wrapping around. Release them with queueConsume().
+ */
+#define queueReadSpan(queue, span) \
+	queueIndexReadSpan(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue), (span))
+
+/**
+ * Removes length items that were read through queueReadSpan()
+ */
+#define queueConsume(queue, length) queueIndexConsume(&(queue)->index, (length))
+
+/**
+ * Points span at the next free slot and returns how many items can be written from there
+ * without wrapping around. Publish them with queueProduce().
+ */
+#define queueWriteSpan(queue, span) \
+	queueIndexWriteSpan(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue), (span))
+
+/**
+ * Publishes length items that were written through queueWriteSpan()
+ */
+#define queueProduce(queue, length) queueIndexProduce(&(queue)->index, (length))
+
+/**
+ * Reserves room for length items at the tail, all or nothing, for a frame that has to reach the
+ * consumer whole. Write the items with queueWriteReserved() and publish them at once with
+ * queueProduce(), the consumer sees none of them before.
+ * Returns 0 if they do not fit, nothing is reserved then
+ */
+#define queueReserve(queue, length) (queueSpace(queue) >= (length))
+
+/**
+ * Writes length items at offset past the tail, into the room taken with queueReserve()
+ */
+#define queueWriteReserved(queue, offset, data, length) \
+	queueIndexWriteReserved(&(queue)->index, (queue)->buffer, QUEUE_MASK(queue), (offset), \
+			(data), (length))
+
+/**
+ * Number of items currently in the queue
+ */
+#define queueCount(queue) queueIndexCount(&(queue)->index)
+
+/**
+ * Number of items that can still be enqueued
+ */
+#define queueSpace(queue) queueIndexSpace(&(queue)->index, QUEUE_MASK(queue))
 
 /**
  * Peeks into the last inserted item of the queue
  */
-uint8_t peekQueueTail(struct Queue* queue);
+#define peekQueueTail(queue) \
+	((queue)->buffer[(QueueSize) ((queue)->index.tail - 1) & QUEUE_MASK(queue)])
 
 /**
  * Peaks into the first inserted item of the queue without dequeuing
  */
-uint8_t peekQueueHead(struct Queue* queue);
+#define peekQueueHead(queue) ((queue)->buffer[(queue)->index.head & QUEUE_MASK(queue)])
+
+/**
+ * ------------------------------------------
+ * Implementation, use the macros above instead
+ * ------------------------------------------
+ */
+
+static inline void queueIndexInit(struct QueueIndex* index){
+	index->head = 0;
+	index->tail = 0;
+}
+
+static inline QueueSize queueIndexCount(struct QueueIndex* index){
+	return QUEUE_LOAD(index->tail) - QUEUE_LOAD(index->head);
+}
+
+static inline QueueSize queueIndexSpace(struct QueueIndex* index, QueueSize mask){
+	return (QueueSize) (mask + 1) - queueIndexCount(index);
+}
+
+static inline uint8_t queueEnqueue(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		uint8_t data){
+	//only the producer writes the tail so it can be read without ordering
+	QueueSize tail = index->tail;
+	if((QueueSize) (tail - QUEUE_LOAD(index->head)) != (QueueSize) (mask + 1)){
+		//queue is not full
+		buffer[tail & mask] = data;
+		//publish the data to the consumer
+		QUEUE_STORE(index->tail, (QueueSize) (tail + 1));
+		return 1;
+	}
+	return 0;
+}
+
+static inline uint8_t queueDequeue(struct QueueIndex* index, uint8_t* buffer, QueueSize mask){
+	uint8_t data = 0;
+	//only the consumer writes the head so it can be read without ordering
+	QueueSize head = index->head;
+	if(head != QUEUE_LOAD(index->tail)){
+		//the queue is not empty
+		data = buffer[head & mask];
+		//release the slot to the producer
+		QUEUE_STORE(index->head, (QueueSize) (head + 1));
+	}
+	return data;
+}
+
+static inline QueueSize queueIndexReadSpan(struct QueueIndex* index, uint8_t* buffer,
+		QueueSize mask, uint8_t** span){
+	QueueSize head = index->head;
+	QueueSize count = QUEUE_LOAD(index->tail) - head;
+	QueueSize offset = head & mask;
+	*span = buffer + offset;
+	//stop at the end of the buffer
+	if(count > (QueueSize) (mask + 1 - offset)){
+		count = mask + 1 - offset;
+	}
+	return count;
+}
+
+static inline void queueIndexConsume(struct QueueIndex* index, QueueSize length){
+	QUEUE_STORE(index->head, (QueueSize) (index->head + length));
+}
+
+static inline QueueSize queueIndexWriteSpan(struct QueueIndex* index, uint8_t* buffer,
+		QueueSize mask, uint8_t** span){
+	QueueSize tail = index->tail;
+	QueueSize space = (QueueSize) (mask + 1) - (QueueSize) (tail - QUEUE_LOAD(index->head));
+	QueueSize offset = tail & mask;
+	*span = buffer + offset;
+	//stop at the end of the buffer
+	if(space > (QueueSize) (mask + 1 - offset)){
+		space = mask + 1 - offset;
+	}
+	return space;
+}
+
+static inline void queueIndexProduce(struct QueueIndex* index, QueueSize length){
+	QUEUE_STORE(index->tail, (QueueSize) (index->tail + length));
+}
+
+void queueIndexWriteReserved(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		QueueSize offset, const uint8_t* data, QueueSize length);
+
+QueueSize queueEnqueueBlock(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		const uint8_t* data, QueueSize length);
+
+QueueSize queueDequeueBlock(struct QueueIndex* index, uint8_t* buffer, QueueSize mask,
+		uint8_t* data, QueueSize length);
 
 #endif /* QUEUE_H_ */
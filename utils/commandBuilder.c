@@ -6,9 +6,19 @@
  */
 
 #include "commandBuilder.h"
+#include "../uart/uart.h"
+#if USE_CRC
+#include "crc16.h"
+#endif
+
+#if COMMAND_RESPONSE_MODEL
 
 void initCommand(struct Command* command) {
 	command->commandCode = 0;
+#if USE_COMMAND_NUMBERING
+	command->commandNumber = 0;
+#endif
+	command->data = command->buffer;
 	command->dataSize = 0;
 }
 
@@ -16,8 +26,9 @@ void initCommand(struct Command* command) {
  * Sets the provided data array as the command data.
  * Overwrites any previous data
  */
-void setCommandData(struct Command* command, uint8_t* data, uint8_t size) {
-	//TODO implement this
+void setCommandData(struct Command* command, uint8_t* data, QueueSize size) {
+	command->data = data;
+	command->dataSize = size;
 }
 
 /**
@@ -25,9 +36,8 @@ void setCommandData(struct Command* command, uint8_t* data, uint8_t size) {
  * size of the structure
  */
 uint8_t addCommandData(struct Command* command, uint8_t data) {
-	//TODO implement escape sequencing
-	if (command->dataSize < COMMAND_DATA_LENGTH) {
-		command->data[command->dataSize] = data;
+	if ((command->data == command->buffer) && (command->dataSize < COMMAND_DATA_LENGTH)) {
+		command->buffer[command->dataSize] = data;
 		command->dataSize++;
 		return (COMMAND_DATA_LENGTH - command->dataSize);
 	}
@@ -35,35 +45,305 @@ uint8_t addCommandData(struct Command* command, uint8_t data) {
 }
 
 /**
- * Queues the command for transmission
+ * A command laid out for transmission, the header and the trailer surround its data
  */
-void transmitCommand(struct Command* command) {
-	UARTbuildTransmitQueue(command->commandCode);
-	for (uint8_t i = 0; i < command->dataSize; i++) {
-		UARTbuildTransmitQueue(command->data[i]);
-	}
-	UARTbuildTransmitQueue(COM_END);
-	UARTbeginTransmit();
-	//increment command number after this
+struct Frame {
+	uint8_t header[4];
+	uint8_t headerSize;
+	uint8_t trailer[2];
+	uint8_t trailerSize;
+	const uint8_t* data;
+	QueueSize dataSize;
+};
+
+/**
+ * Builds the header: code, command number (if numbering is used) and data length (COMMAND_LENGTH
+ * encoding). The trailer is the CRC (high first, if used).
+ */
+static void initFrame(struct UART* uart, struct Frame* frame, struct Command* command) {
+	frame->headerSize = 0;
+	frame->header[frame->headerSize++] = command->commandCode;
 #if USE_COMMAND_NUMBERING
-	outCommandNumber++;
+	frame->header[frame->headerSize++] = uart->outCommandNumber;
+#else
+	(void) uart;
+#endif
+	if (command->dataSize < COM_LENGTH_EXTENDED) {
+		frame->header[frame->headerSize++] = command->dataSize;
+	} else {
+		frame->header[frame->headerSize++] = COM_LENGTH_EXTENDED | (command->dataSize & 0x7F);
+		frame->header[frame->headerSize++] = (uint16_t) command->dataSize >> 7;
+	}
+	frame->data = command->data;
+	frame->dataSize = command->dataSize;
+	frame->trailerSize = 0;
+#if USE_CRC
+	uint16_t crc = crc16Block(CRC16_INIT, frame->header, frame->headerSize);
+	crc = crc16Block(crc, frame->data, frame->dataSize);
+	frame->trailer[frame->trailerSize++] = crc >> 8;
+	frame->trailer[frame->trailerSize++] = crc;
+#endif
+}
+
+/**
+ * Destinations of an encoded frame
+ * FRAME_MEASURE - nowhere, the frame is only measured
+ * FRAME_QUEUED - the transmit queue
+ * FRAME_CONTROL - the control lane, transmitted ahead of the transmit queue
+ * FRAME_HIGH - the high priority class, transmitted after the control lane
+ * FRAME_WINDOW - the window, where it is kept until the partner acknowledges it
+ */
+#define FRAME_MEASURE 0
+#define FRAME_QUEUED 1
+#define FRAME_CONTROL 2
+#define FRAME_HIGH 3
+#define FRAME_WINDOW 4
+
+/**
+ * Writes an encoded frame into the room reserved in its destination queue, the consumer only
+ * sees it once it is complete
+ */
+struct FrameWriter {
+	struct QueueIndex* index;
+	uint8_t* buffer;
+	QueueSize mask;
+	/**
+	 * Bytes of the frame written so far
+	 */
+	uint16_t length;
+};
+
+#define FRAME_WRITER_INIT(writer, queue) \
+	do { \
+		(writer)->index = &(queue)->index; \
+		(writer)->buffer = (queue)->buffer; \
+		(writer)->mask = QUEUE_MASK(queue); \
+	} while (0)
+
+static void initFrameWriter(struct UART* uart, struct FrameWriter* writer, uint8_t target) {
+	writer->length = 0;
+	switch (target) {
+	case FRAME_MEASURE:
+		writer->buffer = 0;
+		break;
+	case FRAME_CONTROL:
+		FRAME_WRITER_INIT(writer, &uart->controlQueue);
+		break;
+	case FRAME_HIGH:
+		FRAME_WRITER_INIT(writer, &uart->highQueue);
+		break;
+#if USE_SLIDING_WINDOW
+	case FRAME_WINDOW:
+		FRAME_WRITER_INIT(writer, &uart->commandWindow.frames);
+		break;
 #endif
+	default:
+		FRAME_WRITER_INIT(writer, &uart->txQueue);
+		break;
+	}
+}
+
+/**
+ * Hands a part of the encoded frame to the writer
+ */
+static void putFrameBlock(struct FrameWriter* writer, const uint8_t* data, QueueSize length) {
+	if (writer->buffer) {
+		queueIndexWriteReserved(writer->index, writer->buffer, writer->mask, writer->length,
+				data, length);
+	}
+	writer->length += length;
+}
+
+static void putFrameByte(struct FrameWriter* writer, uint8_t data) {
+	putFrameBlock(writer, &data, 1);
+}
+
+#if (FRAMING == FRAMING_COBS)
+
+/**
+ * Byte at index of the frame, counting through the header, the data and the trailer
+ */
+static uint8_t frameByte(struct Frame* frame, uint16_t index) {
+	if (index < frame->headerSize) {
+		return frame->header[index];
+	}
+	index -= frame->headerSize;
+	if (index < frame->dataSize) {
+		return frame->data[index];
+	}
+	return frame->trailer[index - frame->dataSize];
 }
 
 /**
- * Queues the command for transmission and makes sure it happens
+ * Writes the frame encoded with COBS: every run of up to COBS_MAX_RUN non zero bytes is preceded
+ * by its length + 1 and the zero following it is implied, so 0x00 only appears at the end.
  */
-void transmitCommandForced(struct Command* command) {
-	while (!(UARTtransmit(command->commandCode) == 1))
-		;
-	for (uint8_t i = 0; i < command->dataSize; i++) {
-		while (!(UARTtransmit(command->data[i]) == 1))
-			;
+static void writeFrame(struct Frame* frame, struct FrameWriter* writer) {
+	uint16_t length = frame->headerSize + frame->dataSize + frame->trailerSize;
+	uint16_t start = 0;
+	for (;;) {
+		//find the end of the run
+		uint16_t end = start;
+		while ((end < length) && (end - start < COBS_MAX_RUN)) {
+			if (frameByte(frame, end) == 0) {
+				break;
+			}
+			end++;
+		}
+		putFrameByte(writer, end - start + 1);
+		for (uint16_t i = start; i < end; i++) {
+			putFrameByte(writer, frameByte(frame, i));
+		}
+		if (end == length) {
+			break;
+		}
+		//a full run has no implied zero, otherwise skip the zero ending the run
+		start = (end - start == COBS_MAX_RUN) ? end : end + 1;
 	}
-	while (!(UARTtransmit(COM_END) == 1))
-		;
+	putFrameByte(writer, COM_FRAME_END);
+}
+
+#else
+
+/**
+ * Hands a part of the frame to the writer, the runs without escaped bytes are copied in blocks
+ */
+static void putEscapedBlock(struct FrameWriter* writer, const uint8_t* data, QueueSize length) {
+	QueueSize start = 0;
+	for (QueueSize i = 0; i < length; i++) {
+		if (FRAME_NEEDS_ESCAPE(data[i])) {
+			putFrameBlock(writer, data + start, i - start);
+			putFrameByte(writer, COM_ESCAPE_CHAR);
+			putFrameByte(writer, data[i] ^ FRAME_ESCAPE_FLIP);
+			start = i + 1;
+		}
+	}
+	putFrameBlock(writer, data + start, length - start);
+}
+
+/**
+ * Writes the frame, any byte colliding with COM_END or COM_ESCAPE_CHAR is escaped,
+ * XON and XOFF as well with XON/XOFF flow control
+ */
+static void writeFrame(struct Frame* frame, struct FrameWriter* writer) {
+	putEscapedBlock(writer, frame->header, frame->headerSize);
+	putEscapedBlock(writer, frame->data, frame->dataSize);
+	putEscapedBlock(writer, frame->trailer, frame->trailerSize);
+	putFrameByte(writer, COM_END);
+}
+
+#endif
+
+/**
+ * Encodes the command into the target queue as a whole: the frame is measured first, written
+ * only if it fits and published at once.
+ * A frame for the window has to fit into the transmit queue as well, it is handed over whole.
+ * Returns the length of the frame, 0 if it did not fit and nothing was written
+ */
+static uint16_t encodeFrame(struct UART* uart, struct Command* command, uint8_t target) {
+	struct Frame frame;
+	initFrame(uart, &frame, command);
+	struct FrameWriter writer;
+	initFrameWriter(uart, &writer, FRAME_MEASURE);
+	writeFrame(&frame, &writer);
+	uint16_t length = writer.length;
+#if USE_SLIDING_WINDOW
+	if ((target == FRAME_WINDOW) && (length > TX_QUEUE_SIZE)) {
+		//it would never fit into the transmit queue as a whole
+		return 0;
+	}
+#endif
+	initFrameWriter(uart, &writer, target);
+	if (queueIndexSpace(writer.index, writer.mask) < length) {
+		//reject the frame as a whole
+		return 0;
+	}
+	writeFrame(&frame, &writer);
+	queueIndexProduce(writer.index, length);
+	return length;
+}
+
+/**
+ * Encodes the control or urgent command into its class (FRAME_CONTROL or FRAME_HIGH) and starts
+ * its transmission. Any context transmits these commands, so the class is filled with the
+ * interrupts disabled.
+ * Returns 0 if the class is full
+ */
+static uint8_t transmitPriority(struct UART* uart, struct Command* command, uint8_t target) {
+	UART_CRITICAL_BEGIN();
+	uint8_t fits = (encodeFrame(uart, command, target) != 0);
+	UART_CRITICAL_END();
+	UARTbeginTransmit(uart);
+	return fits;
+}
+
+#if USE_SLIDING_WINDOW
+
+/**
+ * Encodes the command into the window and starts its transmission
+ * Returns 0 if the window is full or the frame is longer than the transmit queue
+ */
+static uint8_t transmitWindowed(struct UART* uart, struct Command* command) {
+	struct CommandWindow* window = &uart->commandWindow;
+	if ((uint8_t) (uart->outCommandNumber - window->base) == WINDOW_SIZE) {
+		//too many commands in flight
+		return 0;
+	}
+	uint16_t length = encodeFrame(uart, command, FRAME_WINDOW);
+	if (!length) {
+		//no room in the window or longer than the transmit queue
+		return 0;
+	}
+	window->lengths[uart->outCommandNumber & (WINDOW_SIZE - 1)] = length;
+	uart->outCommandNumber++;
+#if USE_RETRANSMIT_TIMER
+	if (!timerRunning(&window->timer)) {
+		timerStart(&window->timer);
+	}
+#endif
+	UARTflushWindow(uart);
+	return 1;
+}
+
+#endif
+
+/**
+ * Queues the command for transmission
+ */
+uint8_t transmitCommand(struct UART* uart, struct Command* command) {
+	if (COM_IS_CONTROL(command->commandCode)) {
+		return transmitPriority(uart, command, FRAME_CONTROL);
+	}
+	if (COM_IS_URGENT(command->commandCode)) {
+		return transmitPriority(uart, command, FRAME_HIGH);
+	}
+#if USE_SLIDING_WINDOW
+	UART_PRODUCER_BEGIN();
+	uint8_t queued = transmitWindowed(uart, command);
+	UART_PRODUCER_END();
+	return queued;
+#else
+	UART_PRODUCER_BEGIN();
+	uint8_t queued = (encodeFrame(uart, command, FRAME_QUEUED) != 0);
 	//increment command number after this
 #if USE_COMMAND_NUMBERING
-	outCommandNumber++;
+	uart->outCommandNumber += queued;
+#endif
+	UART_PRODUCER_END();
+	if (!queued) {
+		//no room for the whole frame, nothing was queued
+		return 0;
+	}
+	UARTbeginTransmit(uart);
+	return 1;
 #endif
 }
+
+/**
+ * Queues the command for transmission
+ */
+uint8_t transmitCommandForced(struct UART* uart, struct Command* command) {
+	return transmitCommand(uart, command);
+}
+
+#endif
@@ -10,21 +10,69 @@
 
 #include "../commands.h"
 #include "inttypes.h"
-#include "../uart/uart.h"
+#include "../uart/config.h"
+#include "Queue.h"
+
+/**
+ * The byte ending every frame on the line
+ */
+#if (FRAMING == FRAMING_COBS)
+#define COM_FRAME_END 0x00
+#else
+#define COM_FRAME_END COM_END
+#endif
+
+/**
+ * Bytes of a frame that are escaped with FRAMING_ESCAPE. With XON/XOFF flow control the
+ * byte following COM_ESCAPE_CHAR is flipped by FRAME_ESCAPE_FLIP as well, so XON and XOFF
+ * never appear inside a frame.
+ */
+#if (FLOW_CONTROL == FLOW_XON_XOFF)
+#define FRAME_NEEDS_ESCAPE(data) (COM_NEEDS_ESCAPE(data) || ((data) == FLOW_XON) || ((data) == FLOW_XOFF))
+#define FRAME_ESCAPE_FLIP 0x20
+#else
+#define FRAME_NEEDS_ESCAPE(data) COM_NEEDS_ESCAPE(data)
+#define FRAME_ESCAPE_FLIP 0x00
+#endif
+
+/**
+ * Whether the command takes a command number. The control and the urgent commands only carry
+ * the current number: they overtake the queued commands and never have to be acknowledged themselves.
+ */
+#define COMMAND_IS_NUMBERED(code) (!COM_IS_CONTROL(code) && !COM_IS_URGENT(code))
+
+/**
+ * Longest run of non zero bytes a COBS code byte can announce
+ */
+#define COBS_MAX_RUN 254
+
+struct UART;
 
 struct Command {
 	/**
 	 * The command code
 	 */
 	uint8_t commandCode;
+#if USE_COMMAND_NUMBERING
 	/**
-	 * The maximum size the data can be
+	 * The command number, stamped by the transmitter
 	 */
-	uint8_t data[COMMAND_DATA_LENGTH];
+	uint8_t commandNumber;
+#endif
+	/**
+	 * The data of the command. Points to the buffer below, to the data given with
+	 * setCommandData() or, for received commands, into the receive queue where it is only
+	 * valid until the message handler returns.
+	 */
+	uint8_t* data;
 	/**
 	 * The size of this current data is
 	 */
-	uint8_t dataSize;
+	QueueSize dataSize;
+	/**
+	 * Room for the small data appended with addCommandData()
+	 */
+	uint8_t buffer[COMMAND_DATA_LENGTH];
 };
 
 /**
@@ -33,25 +81,30 @@ struct Command {
 void initCommand(struct Command* command);
 
 /**
- * Sets the provided data array as the command data.
+ * Sets the provided data array as the command data without copying it, it has to stay
+ * valid until the command is transmitted.
  * Overwrites any previous data
  */
-void setCommandData(struct Command* command,uint8_t* data, uint8_t size);
+void setCommandData(struct Command* command, uint8_t* data, QueueSize size);
 
 /**
  * Appends the data byte into the command structure and returns the remaining
- * size of the structure
+ * size of the structure. Nothing is appended to data set with setCommandData().
  */
 uint8_t addCommandData(struct Command* command, uint8_t data);
 
 /**
- * Forwards the Command into the transmit queue
+ * Forwards the Command into the transmit queue of the port, control commands into the control lane and
+ * urgent commands (COM_IS_URGENT) into the high priority class. The frame is queued as a whole.
+ * Returns 0 if the frame does not fit (or is longer than TX_QUEUE_SIZE with the sliding window),
+ * nothing was queued then
  */
-void transmitCommand(struct Command* command);
+uint8_t transmitCommand(struct UART* uart, struct Command* command);
 
 /**
- * Makes sure the command is transmitted
+ * Same as transmitCommand(), it never waits. Control commands always go ahead of the queued
+ * commands, so nothing has to be forced anymore.
  */
-void transmitCommandForced(struct Command* command);
+uint8_t transmitCommandForced(struct UART* uart, struct Command* command);
 
 #endif /* COMMANDBUILDER_H_ */
@@ -0,0 +1,228 @@
+/*
+ * commandParser.c
+ */
+
+#include "commandParser.h"
+#include "../uart/uart.h"
+#if USE_CRC
+#include "crc16.h"
+#endif
+
+/**
+ * The state following the data of a frame
+ */
+#if USE_CRC
+#define PARSE_AFTER_DATA PARSE_CRC_HIGH
+#else
+#define PARSE_AFTER_DATA PARSE_END
+#endif
+
+#if COMMAND_RESPONSE_MODEL
+
+void initCommandParser(struct CommandParser* parser) {
+	parser->state = PARSE_CODE;
+	parser->reserved = 0;
+#if USE_CRC
+	parser->crc = CRC16_INIT;
+#endif
+#if (FRAMING == FRAMING_COBS)
+	parser->remaining = 0;
+	parser->zero = 0;
+#else
+	parser->escaped = 0;
+#endif
+	initCommand(&parser->command);
+}
+
+/**
+ * Reserves room for the announced data in the receive queue. The data is kept contiguous
+ * so the handler can use it in place, if it would wrap the end of the buffer is skipped.
+ */
+static void reserveCommandData(struct UART* uart) {
+	struct CommandParser* parser = &uart->commandParser;
+	QueueSize length = parser->command.dataSize;
+	uint8_t* span;
+	QueueSize contiguous = queueWriteSpan(&uart->rxQueue, &span);
+	parser->received = 0;
+	if (length <= contiguous) {
+		parser->reserved = length;
+	} else if (length <= (QueueSize) (queueSpace(&uart->rxQueue) - contiguous)) {
+		//continue at the start of the buffer
+		span = uart->rxQueue.buffer;
+		parser->reserved = contiguous + length;
+	} else {
+		parser->state = PARSE_NO_ROOM;
+		return;
+	}
+	parser->command.data = span;
+	parser->state = (length == 0) ? PARSE_AFTER_DATA : PARSE_DATA;
+}
+
+/**
+ * Advances the parser with a decoded byte of the frame: code, command number
+ * (if numbering is used), data length (see COM_LENGTH_EXTENDED), data and the CRC (high first,
+ * if used)
+ */
+static void parseFrameByte(struct UART* uart, uint8_t data) {
+	struct CommandParser* parser = &uart->commandParser;
+#if USE_CRC
+	//the CRC is checked as the bytes arrive, the trailer brings it to 0
+	parser->crc = crc16Update(parser->crc, data);
+#endif
+	switch (parser->state) {
+	case PARSE_CODE:
+		parser->command.commandCode = data;
+		parser->reserved = 0;
+#if USE_COMMAND_NUMBERING
+		parser->state = PARSE_NUMBER;
+#else
+		parser->state = PARSE_LENGTH;
+#endif
+		break;
+#if USE_COMMAND_NUMBERING
+	case PARSE_NUMBER:
+		parser->command.commandNumber = data;
+		parser->state = PARSE_LENGTH;
+		break;
+#endif
+	case PARSE_LENGTH:
+		if (data & COM_LENGTH_EXTENDED) {
+			parser->command.dataSize = data & 0x7F;
+			parser->state = PARSE_LENGTH_HIGH;
+		} else {
+			parser->command.dataSize = data;
+			reserveCommandData(uart);
+		}
+		break;
+	case PARSE_LENGTH_HIGH: {
+		//the receive queue holds the data, longer commands can not be taken
+		uint16_t length = parser->command.dataSize | (uint16_t) data << 7;
+		if (length > RX_QUEUE_SIZE) {
+			parser->state = PARSE_NO_ROOM;
+		} else {
+			parser->command.dataSize = length;
+			reserveCommandData(uart);
+		}
+		break;
+	}
+	case PARSE_DATA:
+		parser->command.data[parser->received++] = data;
+		if (parser->received == parser->command.dataSize) {
+			parser->state = PARSE_AFTER_DATA;
+		}
+		break;
+#if USE_CRC
+	case PARSE_CRC_HIGH:
+		parser->state = PARSE_CRC_LOW;
+		break;
+	case PARSE_CRC_LOW:
+		parser->state = PARSE_END;
+		break;
+#endif
+	case PARSE_END:
+		//more data than announced
+		parser->state = PARSE_DROP;
+		break;
+	default:
+		//the rest of the frame is ignored
+		break;
+	}
+}
+
+/**
+ * Ends the frame and reports whether it held a complete command
+ */
+static uint8_t endFrame(struct CommandParser* parser) {
+	uint8_t state = parser->state;
+	parser->state = PARSE_CODE;
+#if USE_CRC
+	uint16_t crc = parser->crc;
+	parser->crc = CRC16_INIT;
+	if (crc != 0) {
+		//corrupted on the line, a lost command is only reported for intact frames
+		return COMMAND_INCOMPLETE;
+	}
+#endif
+	if (state == PARSE_NO_ROOM) {
+		return COMMAND_LOST;
+	}
+	if (state == PARSE_END) {
+		return COMMAND_COMPLETE;
+	}
+	return COMMAND_INCOMPLETE;
+}
+
+void commitCommandData(struct UART* uart) {
+	queueProduce(&uart->rxQueue, uart->commandParser.reserved);
+	uart->commandParser.reserved = 0;
+}
+
+void releaseCommandData(struct UART* uart, struct Command* command) {
+	struct RxQueue* queue = &uart->rxQueue;
+	QueueSize offset = queue->index.head & QUEUE_MASK(queue);
+	QueueSize length = command->dataSize;
+	if (command->data != queue->buffer + offset) {
+		//the end of the buffer was skipped
+		length += sizeof(queue->buffer) - offset;
+	}
+	queueConsume(queue, length);
+}
+
+#if (FRAMING == FRAMING_COBS)
+
+/**
+ * Frame on the line: the COBS encoded frame followed by COM_FRAME_END.
+ * Each code byte announces a run of code - 1 bytes, followed by an implied zero unless
+ * the code is 0xFF. The zero of the last run is the end of the frame itself.
+ */
+uint8_t parseCommandByte(struct UART* uart, uint8_t data) {
+	struct CommandParser* parser = &uart->commandParser;
+	if (data == COM_FRAME_END) {
+		uint8_t remaining = parser->remaining;
+		parser->remaining = 0;
+		parser->zero = 0;
+		if (remaining != 0) {
+			//the frame ended within a run
+			parser->state = PARSE_DROP;
+		}
+		return endFrame(parser);
+	}
+	if (parser->remaining == 0) {
+		//code byte, the previous run ended in a zero if it was not full
+		if (parser->zero) {
+			parseFrameByte(uart, 0);
+		}
+		parser->remaining = data - 1;
+		parser->zero = (data != (COBS_MAX_RUN + 1));
+		return COMMAND_INCOMPLETE;
+	}
+	parser->remaining--;
+	parseFrameByte(uart, data);
+	return COMMAND_INCOMPLETE;
+}
+
+#else
+
+/**
+ * Frame on the line: the frame bytes followed by COM_END
+ * Any byte of the frame colliding with COM_END or COM_ESCAPE_CHAR is preceded by COM_ESCAPE_CHAR
+ */
+uint8_t parseCommandByte(struct UART* uart, uint8_t data) {
+	struct CommandParser* parser = &uart->commandParser;
+	if (parser->escaped) {
+		//literal byte
+		parser->escaped = 0;
+		data ^= FRAME_ESCAPE_FLIP;
+	} else if (data == COM_ESCAPE_CHAR) {
+		parser->escaped = 1;
+		return COMMAND_INCOMPLETE;
+	} else if (data == COM_END) {
+		return endFrame(parser);
+	}
+	parseFrameByte(uart, data);
+	return COMMAND_INCOMPLETE;
+}
+
+#endif
+
+#endif
@@ -0,0 +1,115 @@
+/*
+ * commandParser.h
+ */
+
+#ifndef COMMANDPARSER_H_
+#define COMMANDPARSER_H_
+
+#include "inttypes.h"
+#include "commandBuilder.h"
+
+/**
+ * Parser states, the next byte expected on the line
+ */
+#define PARSE_CODE 0x00
+#define PARSE_NUMBER 0x01
+#define PARSE_LENGTH 0x02
+#define PARSE_LENGTH_HIGH 0x03
+#define PARSE_DATA 0x04
+#define PARSE_CRC_HIGH 0x05
+#define PARSE_CRC_LOW 0x06
+/**
+ * The frame is complete, only its end may follow
+ */
+#define PARSE_END 0x07
+/**
+ * The data does not fit into the receive queue, the rest of the frame is ignored
+ */
+#define PARSE_NO_ROOM 0x08
+/**
+ * The frame is malformed, the rest of it is ignored
+ */
+#define PARSE_DROP 0x09
+
+/**
+ * Results of parsing a byte
+ */
+#define COMMAND_INCOMPLETE 0x00
+#define COMMAND_COMPLETE 0x01
+/**
+ * A command ended but its data did not fit into the receive queue
+ */
+#define COMMAND_LOST 0x02
+
+/**
+ * Incremental parser building a command from the received bytes one at a time,
+ * so that the command is complete as soon as its end arrives.
+ */
+struct CommandParser {
+	/**
+	 * The next byte expected
+	 */
+	uint8_t state;
+#if (FRAMING == FRAMING_COBS)
+	/**
+	 * Bytes left in the current COBS run, the next byte is a code byte when 0
+	 */
+	uint8_t remaining;
+	/**
+	 * The current run is followed by an implied zero
+	 */
+	uint8_t zero;
+#else
+	/**
+	 * The previous byte was COM_ESCAPE_CHAR, the next one is taken literally
+	 */
+	uint8_t escaped;
+#endif
+#if USE_CRC
+	/**
+	 * CRC of the frame bytes received so far
+	 */
+	uint16_t crc;
+#endif
+	/**
+	 * Data bytes of the command in flight written so far
+	 */
+	QueueSize received;
+	/**
+	 * Bytes of the receive queue reserved for the data, including the skipped end of the buffer,
+	 * 0 once they are committed or no frame is in progress
+	 */
+	QueueSize reserved;
+	/**
+	 * The command in flight, its data points into the receive queue
+	 */
+	struct Command command;
+};
+
+struct UART;
+
+/**
+ * Initialises the parser to wait for the start of a command
+ */
+void initCommandParser(struct CommandParser* parser);
+
+/**
+ * Advances the parser of the port with a received byte.
+ * Returns COMMAND_COMPLETE once the command in the parser is complete, it stays valid until
+ * the next byte. Its data is written in place in the receive queue but only becomes part of
+ * it with commitCommandData().
+ */
+uint8_t parseCommandByte(struct UART* uart, uint8_t data);
+
+/**
+ * Keeps the data of the completed command in the receive queue of the port, until it is released with
+ * releaseCommandData(). The data is discarded by the next command otherwise.
+ */
+void commitCommandData(struct UART* uart);
+
+/**
+ * Releases the data of the oldest committed command from the receive queue
+ */
+void releaseCommandData(struct UART* uart, struct Command* command);
+
+#endif /* COMMANDPARSER_H_ */
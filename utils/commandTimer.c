@@ -0,0 +1,45 @@
+/*
+ * commandTimer.c
+ */
+
+#include "commandTimer.h"
+
+#if (COMMAND_RESPONSE_MODEL && USE_RETRANSMIT_TIMER)
+
+void initCommandTimer(struct CommandTimer* timer) {
+	timer->remaining = 0;
+	timer->timeout = RETRANSMIT_TIMEOUT_TICKS;
+	timer->attempts = 0;
+}
+
+void timerStart(struct CommandTimer* timer) {
+	timer->timeout = RETRANSMIT_TIMEOUT_TICKS;
+	timer->attempts = 0;
+	//written last, the timer runs from here
+	timer->remaining = RETRANSMIT_TIMEOUT_TICKS;
+}
+
+void timerStop(struct CommandTimer* timer) {
+	timer->remaining = 0;
+}
+
+uint8_t timerTick(struct CommandTimer* timer) {
+	if ((timer->remaining == 0) || (--timer->remaining != 0)) {
+		return TIMER_RUNNING;
+	}
+	if (timer->attempts == RETRANSMIT_ATTEMPTS) {
+		//give up, the timer stays stopped
+		return TIMER_FAILED;
+	}
+	timer->attempts++;
+	//back off
+	if (timer->timeout > RETRANSMIT_MAX_TIMEOUT_TICKS / 2) {
+		timer->timeout = RETRANSMIT_MAX_TIMEOUT_TICKS;
+	} else {
+		timer->timeout *= 2;
+	}
+	timer->remaining = timer->timeout;
+	return TIMER_EXPIRED;
+}
+
+#endif
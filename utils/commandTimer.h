@@ -0,0 +1,65 @@
+/*
+ * commandTimer.h
+ */
+
+#ifndef COMMANDTIMER_H_
+#define COMMANDTIMER_H_
+
+#include <inttypes.h>
+#include "../uart/config.h"
+
+/**
+ * Results of a tick
+ * TIMER_RUNNING - the timer is stopped or has not expired yet
+ * TIMER_EXPIRED - the timer expired, retransmit and it restarts with twice the timeout
+ * TIMER_FAILED - the timer expired after RETRANSMIT_ATTEMPTS retransmissions and stopped
+ */
+#define TIMER_RUNNING 0x00
+#define TIMER_EXPIRED 0x01
+#define TIMER_FAILED 0x02
+
+/**
+ * Retransmission timer counting UARTtick() calls, with exponential backoff.
+ * Every field is a single byte so the interrupts always see a consistent value.
+ */
+struct CommandTimer {
+	/**
+	 * Ticks until the timer expires, 0 when it is stopped
+	 */
+	volatile uint8_t remaining;
+	/**
+	 * The current timeout
+	 */
+	uint8_t timeout;
+	/**
+	 * Retransmissions since the timer was started
+	 */
+	uint8_t attempts;
+};
+
+/**
+ * Initialises a stopped timer
+ */
+void initCommandTimer(struct CommandTimer* timer);
+
+/**
+ * Starts the timer with RETRANSMIT_TIMEOUT_TICKS, restarting it if it was running
+ */
+void timerStart(struct CommandTimer* timer);
+
+/**
+ * Stops the timer
+ */
+void timerStop(struct CommandTimer* timer);
+
+/**
+ * Whether the timer is running
+ */
+#define timerRunning(timer) ((timer)->remaining != 0)
+
+/**
+ * Advances the timer by one tick
+ */
+uint8_t timerTick(struct CommandTimer* timer);
+
+#endif /* COMMANDTIMER_H_ */
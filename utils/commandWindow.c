@@ -0,0 +1,173 @@
+/*
+ * commandWindow.c
+ */
+
+#include "commandWindow.h"
+#include "../uart/uart.h"
+
+#if (COMMAND_RESPONSE_MODEL && USE_SLIDING_WINDOW)
+
+void initCommandWindow(struct CommandWindow* window) {
+	queueInit(&window->frames);
+	window->sent = 0;
+	window->sentNumber = 0;
+	window->base = 0;
+	window->retransmit = 0;
+	window->recovering = 0;
+	window->resync = 0;
+#if USE_RETRANSMIT_TIMER
+	initCommandTimer(&window->timer);
+#endif
+}
+
+/**
+ * Removes the oldest count commands from the window
+ */
+static void windowRelease(struct CommandWindow* window, uint8_t count) {
+	QueueSize length = 0;
+	for (uint8_t i = 0; i < count; i++) {
+		length += window->lengths[(uint8_t) (window->base + i) & (WINDOW_SIZE - 1)];
+	}
+	queueConsume(&window->frames, length);
+	window->base += count;
+	window->recovering = 0;
+}
+
+void windowAcknowledge(struct UART* uart, uint8_t next) {
+	struct CommandWindow* window = &uart->commandWindow;
+	uint8_t inFlight = uart->outCommandNumber - window->base;
+	uint8_t acknowledged = next - window->base;
+	if (acknowledged > inFlight) {
+		if ((uint8_t) (window->base - next) > WINDOW_SIZE) {
+			//the partner expects a command that is neither in flight nor recently released,
+			//the numbering is out of step
+			window->resync = WINDOW_RESYNC_DUE;
+		}
+		//a late acknowledgement otherwise
+		return;
+	}
+	if (window->resync == WINDOW_RESYNC_SENT) {
+		//the partner continues with the window
+		window->resync = 0;
+	}
+	if (acknowledged == 0) {
+		//the partner is still expecting the oldest command, it was lost
+		if (inFlight && !window->recovering) {
+			window->recovering = 1;
+			window->retransmit = 1;
+		}
+		return;
+	}
+	windowRelease(window, acknowledged);
+#if USE_RETRANSMIT_TIMER
+	if (acknowledged == inFlight) {
+		timerStop(&window->timer);
+	} else {
+		//the partner is making progress, give the rest a full timeout
+		timerStart(&window->timer);
+	}
+#endif
+}
+
+void windowRetransmit(struct CommandWindow* window) {
+	window->retransmit = 1;
+}
+
+uint8_t windowResync(struct UART* uart, uint8_t next) {
+	struct CommandWindow* window = &uart->commandWindow;
+	//the receive interrupt takes the acknowledgements, change the window consistently
+	UART_CRITICAL_BEGIN();
+	uint8_t inFlight = uart->outCommandNumber - window->base;
+	uint8_t acknowledged = next - window->base;
+	uint8_t dropped = 0;
+	if (acknowledged <= inFlight) {
+		windowRelease(window, acknowledged);
+	} else {
+		//none of the commands in flight can reach the partner any more
+		windowRelease(window, inFlight);
+		window->base = next;
+		uart->outCommandNumber = next;
+		dropped = (inFlight != 0);
+	}
+	window->resync = 0;
+	//go back to the oldest command in flight
+	window->retransmit = 1;
+#if USE_RETRANSMIT_TIMER
+	if (window->base == uart->outCommandNumber) {
+		timerStop(&window->timer);
+	}
+#endif
+	UART_CRITICAL_END();
+	return dropped;
+}
+
+#if USE_RETRANSMIT_TIMER
+
+uint8_t windowTick(struct UART* uart) {
+	struct CommandWindow* window = &uart->commandWindow;
+	switch (timerTick(&window->timer)) {
+	case TIMER_EXPIRED:
+		//nothing acknowledged in time, go back to the oldest command in flight
+		window->recovering = 1;
+		window->retransmit = 1;
+		if (window->resync == WINDOW_RESYNC_SENT) {
+			//the resync may have been lost as well
+			window->resync = WINDOW_RESYNC_DUE;
+		}
+		break;
+	case TIMER_FAILED:
+		//drop the commands in flight, the partner still expects the oldest one
+		{
+			UART_CRITICAL_BEGIN();
+			windowRelease(window, uart->outCommandNumber - window->base);
+			window->resync = WINDOW_RESYNC_DUE;
+			UART_CRITICAL_END();
+		}
+		return 1;
+	}
+	return 0;
+}
+
+#endif
+
+void windowFlush(struct UART* uart) {
+	struct CommandWindow* window = &uart->commandWindow;
+	//the receive interrupt releases acknowledged commands and requests retransmissions, take the
+	//oldest one consistently
+	UART_CRITICAL_BEGIN();
+	QueueSize head = window->frames.index.head;
+	uint8_t base = window->base;
+	uint8_t retransmit = window->retransmit;
+	window->retransmit = 0;
+	UART_CRITICAL_END();
+	if (retransmit) {
+		//go back to the oldest command in flight
+		window->sentNumber = base;
+		window->sent = head;
+	}
+	if ((uint8_t) (window->sentNumber - base) > (uint8_t) (uart->outCommandNumber - base)) {
+		//acknowledged while it was being transmitted again
+		window->sentNumber = base;
+		window->sent = head;
+	}
+	while (window->sentNumber != uart->outCommandNumber) {
+		QueueSize length = window->lengths[window->sentNumber & (WINDOW_SIZE - 1)];
+		if (!queueReserve(&uart->txQueue, length)) {
+			//the transmit queue is full, continue with the next flush
+			break;
+		}
+		//the frame may wrap around the end of the window
+		QueueSize offset = window->sent & QUEUE_MASK(&window->frames);
+		QueueSize first = sizeof(window->frames.buffer) - offset;
+		if (first > length) {
+			first = length;
+		}
+		queueWriteReserved(&uart->txQueue, 0, window->frames.buffer + offset, first);
+		queueWriteReserved(&uart->txQueue, first, window->frames.buffer, length - first);
+		queueProduce(&uart->txQueue, length);
+		window->sent += length;
+		window->sentNumber++;
+	}
+}
+
+#endif
@@ -0,0 +1,116 @@
+/*
+ * commandWindow.h
+ */
+
+#ifndef COMMANDWINDOW_H_
+#define COMMANDWINDOW_H_
+
+#include <inttypes.h>
+#include "../uart/config.h"
+#include "Queue.h"
+#include "commandTimer.h"
+
+QUEUE_TYPE(WindowQueue, WINDOW_BUFFER_SIZE);
+
+/**
+ * States of the resync of a window
+ * WINDOW_RESYNC_DUE - COM_RESYNC_COMMAND_NUMBER has to be transmitted
+ * WINDOW_RESYNC_SENT - it was transmitted, transmitted again when the retransmission timer expires
+ *     before the partner acknowledges a command number of the window
+ */
+#define WINDOW_RESYNC_DUE 0x01
+#define WINDOW_RESYNC_SENT 0x02
+
+/**
+ * Go back N sliding window over the command numbers. The encoded commands stay in the window
+ * from their transmission until the partner acknowledges them, a negative acknowledgement
+ * sends all of them again.
+ * The acknowledgements are taken by the receive interrupt, everything else by the main loop.
+ */
+struct CommandWindow {
+	/**
+	 * The encoded commands in flight, the head is the oldest unacknowledged one
+	 */
+	struct WindowQueue frames;
+	/**
+	 * Encoded length of the commands in flight, indexed by their command number
+	 */
+	QueueSize lengths[WINDOW_SIZE];
+	/**
+	 * The next byte of the frames handed to the transmit queue
+	 */
+	QueueSize sent;
+	/**
+	 * Command number of the next frame handed to the transmit queue
+	 */
+	uint8_t sentNumber;
+	/**
+	 * Command number of the oldest unacknowledged command
+	 */
+	uint8_t base;
+	/**
+	 * The commands in flight have to be transmitted again
+	 */
+	volatile uint8_t retransmit;
+	/**
+	 * A retransmission was requested and nothing was acknowledged since
+	 */
+	uint8_t recovering;
+	/**
+	 * The partner expects a command number outside the window, COM_RESYNC_COMMAND_NUMBER
+	 * tells it where the window continues: 0, WINDOW_RESYNC_DUE or WINDOW_RESYNC_SENT
+	 */
+	volatile uint8_t resync;
+#if USE_RETRANSMIT_TIMER
+	/**
+	 * Runs while commands are in flight, restarted whenever one is acknowledged
+	 */
+	struct CommandTimer timer;
+#endif
+};
+
+struct UART;
+
+/**
+ * Initialises an empty window
+ */
+void initCommandWindow(struct CommandWindow* window);
+
+/**
+ * Releases the commands of the window of the port before next, the next command number the
+ * partner expects.
+ * Acknowledging nothing while commands are in flight requests their retransmission, a number
+ * outside the window requests a resync.
+ */
+void windowAcknowledge(struct UART* uart, uint8_t next);
+
+/**
+ * Continues the window of the port at next, the command number the partner expects according to
+ * its COM_RESYNC_COMMAND_NUMBER. The commands in flight from next on are transmitted again, if
+ * next is outside the window all of them are dropped and the numbering continues at next.
+ * Returns 1 if commands were dropped
+ */
+uint8_t windowResync(struct UART* uart, uint8_t next);
+
+/**
+ * Requests the transmission of all the commands in flight
+ */
+void windowRetransmit(struct CommandWindow* window);
+
+#if USE_RETRANSMIT_TIMER
+
+/**
+ * Advances the retransmission timer, requesting a retransmission when it expires.
+ * Returns 1 when it failed and the commands in flight were dropped, the partner is resynced then.
+ */
+uint8_t windowTick(struct UART* uart);
+
+#endif
+
+/**
+ * Hands the commands of the window that were not transmitted yet to the transmit queue of the port,
+ * only whole frames that fit into it
+ */
+void windowFlush(struct UART* uart);
+
+#endif /* COMMANDWINDOW_H_ */
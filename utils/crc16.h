@@ -0,0 +1,57 @@
+/*
+ * crc16.h
+ */
+
+#ifndef CRC16_H_
+#define CRC16_H_
+
+#include <inttypes.h>
+#include "../uart/config.h"
+
+/**
+ * CRC-16 CCITT: polynomial 0x1021, initial value 0xFFFF, no reflection.
+ * Sent high byte first, running the CRC over the frame including its trailer leaves 0.
+ */
+#define CRC16_INIT 0xFFFF
+
+#if (CRC_MODE == CRC_TABLE)
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#define CRC16_TABLE_READ(index) pgm_read_word(&crc16Table[(index)])
+#else
+#define PROGMEM
+#define CRC16_TABLE_READ(index) (crc16Table[(index)])
+#endif
+
+/**
+ * Remainders of every byte value, kept in flash
+ */
+extern const uint16_t crc16Table[256] PROGMEM;
+
+/**
+ * Updates the CRC with a byte, one table lookup per byte
+ */
+static inline uint16_t crc16Update(uint16_t crc, uint8_t data) {
+	return (crc << 8) ^ CRC16_TABLE_READ((uint8_t) (crc >> 8) ^ data);
+}
+
+#else
+
+/**
+ * Updates the CRC with a byte, computed with shifts instead of a table
+ */
+static inline uint16_t crc16Update(uint16_t crc, uint8_t data) {
+	uint8_t x = (crc >> 8) ^ data;
+	x ^= x >> 4;
+	return (crc << 8) ^ ((uint16_t) x << 12) ^ ((uint16_t) x << 5) ^ x;
+}
+
+#endif
+
+/**
+ * Updates the CRC with length bytes of data
+ */
+uint16_t crc16Block(uint16_t crc, const uint8_t* data, uint16_t length);
+
+#endif /* CRC16_H_ */